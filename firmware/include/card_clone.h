@@ -0,0 +1,35 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "card_decoder.h"
+
+// blocks written to a t5577 for a clone: the configuration block (0) and
+// three data blocks
+#define T5577_CLONE_BLOCKS 4
+
+// configuration blocks, as proxmark writes them
+// fsk2a, rf/50, 3 data blocks
+#define T5577_CONFIG_HID 0x00107060
+// manchester, rf/32, 3 data blocks
+#define T5577_CONFIG_GALLAGHER 0x00088060
+
+// what to write to a t5577 (or compatible) tag to clone a card
+struct T5577Clone {
+  uint32_t blocks[T5577_CLONE_BLOCKS];
+  // proxmark client command that writes the same clone
+  char proxmark[64];
+};
+
+// clone data for a decoded card. hid cards are written as hid prox (the
+// 44 bit card value in card.hex), gallagher cards as cardax with the frame
+// re-encoded from the decoded values. returns false for anything else or a
+// card that didn't decode
+bool cloneToT5577(const CardData &card, T5577Clone &clone);
+
+// the card value stored in a hid prox clone's data blocks, for checking
+// clones. returns false if the blocks aren't valid hid prox data
+bool hidProxValue(const T5577Clone &clone, uint64_t &value);
@@ -0,0 +1,69 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// max number of bits
+#define MAX_BITS 100
+
+// bump whenever decoding changes, stored records are re-decoded on boot when
+// the version saved on the sd card doesn't match
+#define DECODER_VERSION 2
+
+// card type
+enum CardType {
+  HID,
+  GALLAGHER,
+  UNKNOWN,
+};
+
+// outcome of decoding a frame
+enum DecodeStatus {
+  DECODE_OK,
+  // no decoder for this bit length
+  DECODE_UNSUPPORTED,
+  // a decoder matched but the data didn't make sense
+  DECODE_ERROR,
+};
+
+// a raw frame and what was decoded from it
+struct CardData {
+  unsigned char bits[MAX_BITS];
+  unsigned int bitCount;
+
+  CardType cardType;
+  DecodeStatus status;
+  // reason for a failed decode, static string
+  const char *error;
+
+  unsigned long facilityCode;
+  unsigned long cardNumber;
+  unsigned long regionCode;
+  unsigned long issueLevel;
+  // hex data string
+  char hex[24];
+};
+
+const char *cardTypeToString(CardType cardType);
+const char *decodeStatusToString(DecodeStatus status);
+
+// run the decoders over a frame, the bits are copied into card. returns true
+// if a decoder produced a facility code or card number
+bool decodeCard(const unsigned char *bits, unsigned int bitCount,
+                CardData &card);
+
+// build the frame for a card's values, the reverse of decodeCard. the card
+// type, bitCount (for hid formats) and the values to encode are taken from
+// card, which is then decoded from the new frame. returns false if there's
+// no encoder for the format or a value doesn't fit it, and like decodeCard
+// if both facility code and card number are 0
+bool encodeCard(CardData &card);
+
+// convert between bits and the "0101..." strings stored in cards.jsonl.
+// rawLength must be at least bitCount + 1
+void formatRawBits(const CardData &card, char *raw, size_t rawLength);
+// returns the number of bits parsed, 0 if raw isn't a valid bit string
+unsigned int parseRawBits(const char *raw, unsigned char *bits,
+                          unsigned int maxBits);
@@ -0,0 +1,57 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "card_storage.h"
+#include "gzip_stream.h"
+
+// state of a single /api/carddata or /api/carddata/export response: the
+// records as stored, as csv or as msgpack, optionally filtered by time or id
+// and gzip compressed on the fly. memory use is fixed (~23KB) whatever the
+// size of the log.
+//
+// set the options, begin() with a reader, then fill() until it returns 0.
+struct CardDataExport {
+  bool compress = true;
+  bool csv = false;
+  bool msgpack = false;
+  // time range filter (inclusive), only applied when set
+  bool filterTime = false;
+  unsigned long from = 0;
+  unsigned long to = ULONG_MAX;
+  // only records with an id above since, when set. records stored before
+  // they had ids are left out
+  bool filterSince = false;
+  unsigned long since = 0;
+
+  // start streaming the records from reader, which is deleted with the
+  // export
+  void begin(RecordReader *reader);
+  // chunked response filler, returning 0 ends the response
+  size_t fill(uint8_t *buffer, size_t maxLen);
+
+  uint32_t bytesIn() const { return gzip.totalIn(); }
+  uint32_t bytesOut() const { return gzip.totalOut(); }
+
+private:
+  bool nextLine();
+  bool readRecord(size_t &length);
+
+  std::unique_ptr<RecordReader> reader;
+  GzipStream gzip;
+  bool headerWritten = false;
+  // records read from the reader and not yet split into lines
+  uint8_t input[512];
+  size_t inputLength = 0;
+  size_t inputOffset = 0;
+  // current output line and how much of it has been sent
+  char line[RECORD_LINE_SIZE + 1];
+  size_t lineLength = 0;
+  size_t lineOffset = 0;
+};
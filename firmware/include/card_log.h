@@ -0,0 +1,91 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <FS.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// records are written as whole sectors, so the card never has to read a
+// sector back to change part of it
+#define CARD_LOG_SECTOR_SIZE 512
+// the log grows this much at a time, in one go so the clusters are
+// allocated together
+#define CARD_LOG_EXTENT_SIZE (64 * 1024)
+// reserve() grows the log once less than this is left
+#define CARD_LOG_LOW_SPACE (CARD_LOG_EXTENT_SIZE / 2)
+// longest record append() takes
+#define CARD_LOG_MAX_RECORD CARD_LOG_SECTOR_SIZE
+// appends are synced to the card (which rewrites the directory entry's
+// modification time) every this many records, or by reserve() once the
+// oldest unsynced one is this old
+#define CARD_LOG_SYNC_RECORDS 16
+#define CARD_LOG_SYNC_MS 2000
+// the unused space after the records is filled with this. readers that
+// don't know where the records end see blank lines
+#define CARD_LOG_PAD '\n'
+
+// the card log (cards.jsonl), preallocated and appended to in place.
+//
+// the file is kept open and grown an extent at a time, filled with padding.
+// a record is written into the padding at the logical end of the log by
+// rewriting the sectors it covers, so appending neither allocates clusters
+// nor changes the file size in the directory entry. the logical end is
+// tracked in memory and found again on begin() as the end of the last line
+// that isn't padding. logs written without padding are read the same way.
+// syncs are batched, see CARD_LOG_SYNC_RECORDS, so records appended since
+// the last one can be lost to a power cut. call sync() before reading the
+// log through another handle.
+//
+// not thread safe, callers hold cardDataMutex.
+class CardLog {
+public:
+  CardLog();
+
+  // open the log (which must exist) and find its logical end
+  bool begin(fs::FS &fs, const char *path);
+  void end();
+  bool isOpen() const { return open; }
+
+  // add a record, line is the whole line including its newline
+  bool append(const char *line, size_t length);
+  // grow the log ahead of time if it is running out of space and sync it
+  // when due, call when there is time for a slow write
+  bool reserve();
+  // write appended records through to the card
+  void sync();
+  // throw all records away
+  bool clear();
+
+  // bytes of records, readers stop here
+  size_t size() const { return logicalEnd; }
+  // bytes preallocated for the log, including the records
+  size_t allocated() const { return fileSize; }
+  // times the log has been grown since begin()
+  unsigned long extents() const { return extentCount; }
+  // times the log has been opened, offsets into it only hold until the next
+  unsigned long opens() const { return openCount; }
+
+private:
+  bool findEnd();
+  bool extend(size_t minSize);
+  bool loadTail();
+
+  fs::FS *fs;
+  const char *path;
+  File file;
+  bool open;
+  size_t logicalEnd;
+  size_t fileSize;
+  unsigned long extentCount;
+  unsigned long openCount;
+  // records appended since the last sync, and when the first of them was
+  unsigned int unsynced;
+  uint32_t unsyncedSince;
+  // a record is missing its newline (a log cut short by older firmware)
+  bool needsNewline;
+  // the sector the logical end is in, as it is on the card
+  uint8_t tail[CARD_LOG_SECTOR_SIZE];
+  // sectors being written by append()
+  uint8_t block[CARD_LOG_SECTOR_SIZE + CARD_LOG_MAX_RECORD];
+};
@@ -0,0 +1,73 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// compact MessagePack encoding of capture log records, served by
+// /api/carddata instead of ndjson when asked for.
+//
+// every record is a MessagePack array, concatenated one after another:
+//
+//   [card_type, bit_length, facility_code, card_number, region_code,
+//    issue_level, hex, raw, decode_status, timestamp, id]
+//
+// raw is a bin of the frame bits packed msb first (bit_length bits, the last
+// byte zero padded). fields a record doesn't have are nil.
+#define CARD_MSGPACK_FIELDS 11
+
+// a record as stored in cards.jsonl. strings are referenced, not copied
+struct CardRecord {
+  const char *cardType;
+  unsigned int bitLength;
+  unsigned long facilityCode;
+  unsigned long cardNumber;
+  bool hasRegionCode;
+  unsigned long regionCode;
+  bool hasIssueLevel;
+  unsigned long issueLevel;
+  const char *hex;
+  // frame bits as a string of '0' and '1'
+  const char *raw;
+  const char *decodeStatus;
+  bool hasTimestamp;
+  unsigned long timestamp;
+  bool hasId;
+  unsigned long id;
+};
+
+// minimal MessagePack writer into a fixed buffer
+class MsgPackWriter {
+public:
+  MsgPackWriter(uint8_t *buffer, size_t capacity);
+
+  void writeNil();
+  void writeUint(uint32_t value);
+  // nil for NULL
+  void writeStr(const char *str);
+  void writeBin(const uint8_t *data, size_t len);
+  void writeArray(size_t count);
+
+  size_t size() const { return length; }
+  // something didn't fit, the output is incomplete
+  bool overflowed() const { return overflow; }
+
+private:
+  void put(uint8_t byte);
+  void putBytes(const uint8_t *data, size_t len);
+  void putHeader(uint8_t type, uint32_t value, size_t bytes);
+
+  uint8_t *buffer;
+  size_t capacity;
+  size_t length;
+  bool overflow;
+};
+
+// read a record from a cards.jsonl line. the line is changed in place and
+// the record's strings point into it. returns false if it isn't a json
+// object of string, number and null values
+bool parseCardRecord(char *line, CardRecord &record);
+
+// encode a record into out, returns its length or 0 if it doesn't fit
+size_t packCardRecord(const CardRecord &record, uint8_t *out, size_t maxLen);
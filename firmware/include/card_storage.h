@@ -0,0 +1,50 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// max length of a single record in cards.jsonl
+#define RECORD_LINE_SIZE 512
+
+// the records in the card log as they were when the reader was opened,
+// records appended later aren't seen
+class RecordReader {
+public:
+  virtual ~RecordReader() {}
+
+  // read up to length bytes of records, 0 once they have all been read
+  virtual size_t read(uint8_t *buffer, size_t length) = 0;
+};
+
+// where captured cards and settings are kept. the firmware keeps both on the
+// sd card (sd_storage.h), the host tools in a local directory, so the web
+// api can run on either.
+//
+// the record calls aren't thread safe, callers hold cardDataMutex. readers
+// don't need it once they are open.
+class CardStorage {
+public:
+  virtual ~CardStorage() {}
+
+  // add a record, line is the whole line including its newline
+  virtual bool appendRecord(const char *line, size_t length) = 0;
+  // throw all records away
+  virtual bool clearRecords() = 0;
+  // bytes of records
+  virtual size_t recordBytes() = 0;
+  // read the records, nullptr if they can't be. the caller deletes it
+  virtual RecordReader *openRecords() = 0;
+  // read the records from the first with an id above since. readers may
+  // start earlier, so callers still skip those at or below it
+  virtual RecordReader *openRecordsSince(unsigned long since) {
+    (void)since;
+    return openRecords();
+  }
+
+  // settings are single line values kept by name (the path of the file
+  // they are in on the sd card). false if the setting isn't there
+  virtual bool readSetting(const char *name, char *value, size_t size) = 0;
+  virtual bool writeSetting(const char *name, const char *value) = 0;
+};
@@ -0,0 +1,123 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+#include "card_storage.h"
+#include "flash_ring.h"
+
+// the data partition in partitions.csv the flash ring is kept in
+#define CARD_RING_LABEL "cardring"
+#define CARD_RING_SUBTYPE 0x40
+
+// an sd append taking longer than this sends captures to the flash ring for
+// SD_SLOW_BACKOFF_US
+#define SD_SLOW_APPEND_US 100000
+#define SD_SLOW_BACKOFF_US 10000000
+
+// the card ring partition as flash for FlashRing
+class PartitionFlash : public RingFlash {
+public:
+  PartitionFlash() : partition(nullptr) {}
+
+  // false if the partition table has no card ring
+  bool begin();
+
+  size_t size() const override { return partition ? partition->size : 0; }
+  bool read(size_t offset, void *data, size_t length) override;
+  bool write(size_t offset, const void *data, size_t length) override;
+  bool erase(size_t offset) override;
+
+private:
+  const esp_partition_t *partition;
+};
+
+struct FallbackStatus {
+  bool sdAvailable;
+  bool sdFull;
+  bool ringOpen;
+  size_t ringCapacity;
+  unsigned long pendingRecords;
+  size_t pendingBytes;
+  FlashRingStats ring;
+  uint32_t minEraseCount;
+  uint32_t maxEraseCount;
+};
+
+// card data on the sd card, falling back to a ring buffer in internal flash
+// when the card is missing, full or slow. migrate() moves records from the
+// ring to the card once it is back, oldest first, and while any are waiting
+// new records go to the ring too so the log stays in order. reads return the
+// records on the card followed by those still in the ring.
+//
+// a failed append marks the card full. it stays mounted for reads and is
+// written again once cleared or after resumeSd(), unless the firmware finds
+// it has gone and calls setSdAvailable(false).
+//
+// record calls are made with cardDataMutex held like any CardStorage, apart
+// from appendToRing(), which capture uses when something else holds it. the
+// ring is guarded by a mutex of its own. settings are only on the sd card.
+class FallbackStorage : public CardStorage {
+public:
+  FallbackStorage(CardStorage &sd, FlashRing &ring);
+
+  // open the ring, records go to it until setSdAvailable(true)
+  bool begin(RingFlash &flash);
+
+  bool appendRecord(const char *line, size_t length) override;
+  // fails without the sd card
+  bool clearRecords() override;
+  size_t recordBytes() override;
+  RecordReader *openRecords() override;
+  // the card's records from the first with an id above since, then all of
+  // the ring's
+  RecordReader *openRecordsSince(unsigned long since) override;
+
+  bool readSetting(const char *name, char *value, size_t size) override;
+  bool writeSetting(const char *name, const char *value) override;
+
+  // store a record in the ring without touching the sd card
+  bool appendToRing(const char *line, size_t length);
+  // move up to count records from the ring to the sd card, returns how many
+  // were moved
+  unsigned int migrate(unsigned int count);
+  // erase the ring ahead of the next record, slow
+  void reserve();
+  // the newest record in the ring, 0 if there is none
+  size_t newestRingRecord(char *line, size_t size);
+
+  bool hasRing() const { return ring.isOpen(); }
+  bool sdAvailable() const { return sdUp; }
+  void setSdAvailable(bool available) {
+    sdUp = available;
+    sdFull = false;
+  }
+  // records go to the ring rather than the card until it is cleared
+  bool sdWritable() const { return sdUp && !sdFull; }
+  bool isSdFull() const { return sdUp && sdFull; }
+  // write to a card marked full again, the failed append wasn't for lack of
+  // space
+  void resumeSd() { sdFull = false; }
+  // records in the ring waiting for the sd card
+  unsigned long pending() const { return ring.pending(); }
+  FallbackStatus status();
+
+private:
+  friend class LockedRingReader;
+
+  // the card's records from sdReader, then the ring's
+  RecordReader *chainRing(RecordReader *sdReader);
+
+  void lockRing() { xSemaphoreTake(ringMutex, portMAX_DELAY); }
+  void unlockRing() { xSemaphoreGive(ringMutex); }
+
+  CardStorage &sd;
+  FlashRing &ring;
+  SemaphoreHandle_t ringMutex;
+  volatile bool sdUp;
+  volatile bool sdFull;
+  // sd appends skip the card until then after a slow one
+  int64_t slowUntil;
+};
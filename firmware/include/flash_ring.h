@@ -0,0 +1,153 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "card_storage.h"
+
+// flash is erased a sector at a time
+#define FLASH_RING_SECTOR_SIZE 4096
+// most sectors a ring uses, larger partitions are only used this far
+#define FLASH_RING_MAX_SECTORS 128
+
+// the flash a ring is kept in, a partition on the device
+class RingFlash {
+public:
+  virtual ~RingFlash() {}
+
+  virtual size_t size() const = 0;
+  virtual bool read(size_t offset, void *data, size_t length) = 0;
+  // writing only clears bits, anything written has to be erased first
+  virtual bool write(size_t offset, const void *data, size_t length) = 0;
+  // erase the sector at offset
+  virtual bool erase(size_t offset) = 0;
+};
+
+struct RingRecordHeader;
+
+// where a record is in the ring
+struct RingPosition {
+  unsigned int sector;
+  uint32_t sequence;
+  size_t offset;
+};
+
+struct FlashRingStats {
+  // records stored and moved out
+  unsigned long appended;
+  unsigned long migrated;
+  // records lost to the ring wrapping before they were moved out
+  unsigned long dropped;
+  // sectors that had to be erased while appending, rather than ahead of time
+  unsigned long inlineErases;
+};
+
+// a ring buffer of card records in raw flash, for when the sd card can't
+// take them.
+//
+// the flash is used as a log of sectors, each starting with a header
+// holding its sequence number and erase count. records are appended to the
+// newest sector and the sectors are reused in turn, oldest first, so every
+// sector is erased as often as the others. records are marked as migrated
+// once they have been copied elsewhere by clearing a bit in their header,
+// which needs no erase. when the ring is full the oldest records are
+// overwritten.
+//
+// a record that was cut short by a power cut fails its checksum and is
+// skipped, and appends continue in a new sector after begin().
+//
+// not thread safe, the firmware serialises access with a mutex.
+class FlashRing {
+public:
+  FlashRing();
+
+  // find the records in flash, formatting it if it holds none
+  bool begin(RingFlash &flash);
+  bool isOpen() const { return flash != nullptr; }
+
+  // add a record, line is the whole line including its newline
+  bool append(const char *line, size_t length);
+  // erase the sector appends go to next ahead of time, so append() doesn't
+  // have to. call when there's time for a slow erase
+  bool reserve();
+  // throw every record away
+  bool clear();
+
+  // records that haven't been migrated
+  unsigned long pending() const { return pendingRecords; }
+  size_t pendingBytes() const { return pendingLength; }
+  // read the oldest record that hasn't been migrated into line and where it
+  // is into position, returns its length or 0 if there is none
+  size_t oldest(RingPosition &position, char *line, size_t size);
+  // mark the record oldest() returned as migrated, false if it has been
+  // overwritten since
+  bool markMigrated(const RingPosition &position);
+  // the newest record, returns its length or 0 if there is none
+  size_t newest(char *line, size_t size);
+
+  // the records that haven't been migrated, from oldest to newest
+  RingPosition begin() const { return tail; }
+  RingPosition end() const { return head; }
+  // read the record at position into line and move position on to the
+  // next one. returns its length, 0 once position reaches end
+  size_t next(RingPosition &position, const RingPosition &end, char *line,
+              size_t size);
+
+  size_t capacity() const;
+  unsigned int sectors() const { return sectorCount; }
+  uint32_t minEraseCount() const;
+  uint32_t maxEraseCount() const;
+  const FlashRingStats &stats() const { return counters; }
+
+private:
+  int readRecord(unsigned int sector, size_t offset, RingRecordHeader &header,
+                 char *line, size_t size);
+  bool scanSector(unsigned int sector, size_t &end, RingPosition &firstLive);
+  bool load(RingPosition &position, const RingPosition &end,
+            RingRecordHeader &header, char *line, size_t size);
+  void seekLive(RingPosition &position);
+  bool eraseSector(unsigned int sector);
+  bool startSector();
+  size_t sectorOffset(unsigned int sector) const {
+    return (size_t)sector * FLASH_RING_SECTOR_SIZE;
+  }
+
+  RingFlash *flash;
+  unsigned int sectorCount;
+  // sequence number of each sector, 0 if it holds no records
+  uint32_t sequences[FLASH_RING_MAX_SECTORS];
+  uint32_t eraseCounts[FLASH_RING_MAX_SECTORS];
+  // records in each sector that haven't been migrated
+  uint16_t liveRecords[FLASH_RING_MAX_SECTORS];
+  uint16_t liveLengths[FLASH_RING_MAX_SECTORS];
+  // records in sectors numbered below this were thrown away by clear()
+  uint32_t floor;
+  // where the next record is written, and the oldest pending record
+  RingPosition head;
+  RingPosition tail;
+  // the sector after head has been erased and is ready to use
+  bool erasedAhead;
+  unsigned long pendingRecords;
+  size_t pendingLength;
+  FlashRingStats counters;
+  char scratch[RECORD_LINE_SIZE];
+};
+
+// reads the pending records of a ring from where they were when opened.
+// records overwritten while reading are left out
+class FlashRingReader : public RecordReader {
+public:
+  explicit FlashRingReader(FlashRing &ring);
+
+  size_t read(uint8_t *buffer, size_t length) override;
+
+private:
+  FlashRing &ring;
+  RingPosition position;
+  RingPosition end;
+  char line[RECORD_LINE_SIZE];
+  size_t lineLength;
+  size_t lineOffset;
+};
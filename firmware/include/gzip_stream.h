@@ -0,0 +1,79 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// streaming gzip (deflate, fixed huffman codes) encoder with a fixed memory
+// footprint, used to compress card data exports on the fly.
+//
+// usage: write() input until it returns less than it was given, then read()
+// the compressed output and continue. call finish() after the last write()
+// and keep calling read() until done() returns true.
+class GzipStream {
+public:
+  // lz77 history window, must be a power of two
+  static const size_t kWindowSize = 4096;
+  // number of hash buckets used to find matches (as a power of two)
+  static const unsigned int kHashBits = 11;
+  // how many previous matches are checked before giving up
+  static const unsigned int kMaxChain = 16;
+  // size of the compressed output buffer
+  static const size_t kOutSize = 1024;
+
+  GzipStream();
+
+  // reset the encoder and queue the gzip header
+  void begin();
+  // feed uncompressed data, returns the number of bytes consumed
+  size_t write(const uint8_t *data, size_t len);
+  // no more input will follow
+  void finish();
+  // drain compressed output, returns the number of bytes copied to dst
+  size_t read(uint8_t *dst, size_t maxLen);
+  // bytes of compressed output waiting to be read
+  size_t available() const { return outTail - outHead; }
+  // true once the trailer has been queued and fully read
+  bool done() const { return finished && trailerWritten && available() == 0; }
+
+  uint32_t totalIn() const { return inBytes; }
+  uint32_t totalOut() const { return outBytes; }
+
+private:
+  static const size_t kMinMatch = 3;
+  static const size_t kMaxMatch = 258;
+  static const size_t kHashSize = 1 << kHashBits;
+
+  bool deflate(bool flush);
+  unsigned int hashAt(size_t pos) const;
+  void insertHash(size_t pos);
+  size_t longestMatch(size_t &matchPos);
+  void slideWindow();
+
+  void putBits(uint32_t value, unsigned int count);
+  void putCode(uint32_t code, unsigned int count);
+  void putLiteral(uint8_t c);
+  void putMatch(size_t length, size_t distance);
+  void putByte(uint8_t b);
+  void alignToByte();
+  size_t outFree() const { return kOutSize - outTail; }
+
+  uint8_t window[2 * kWindowSize];
+  // positions are stored plus one, zero marks an empty slot
+  uint16_t head[kHashSize];
+  uint16_t prev[kWindowSize];
+  uint8_t out[kOutSize];
+
+  size_t fill;
+  size_t strStart;
+  size_t outHead;
+  size_t outTail;
+  uint32_t bitBuffer;
+  unsigned int bitCount;
+  uint32_t crc;
+  uint32_t inBytes;
+  uint32_t outBytes;
+  bool finished;
+  bool trailerWritten;
+};
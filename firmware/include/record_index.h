@@ -0,0 +1,41 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+
+// newest records remembered
+#define RECORD_INDEX_SIZE 64
+
+// where the newest records start in the card log by id, so a poll for the
+// records after an id can skip the ones before it instead of reading the
+// whole log. ids go up through the log (see initRecordId), a record stored
+// with a lower id than the last makes the index start again.
+class RecordIndex {
+public:
+  RecordIndex();
+
+  // forget every record, for a log that was cleared or replaced
+  void reset();
+  // a record with id was stored at offset, call for each one stored
+  void add(size_t offset, unsigned long id);
+  // the records in the last length bytes of the log, which ends at end. the
+  // records stored after them have ids above the last one in tail
+  void addTail(const char *tail, size_t length, size_t end);
+  // an offset no record with an id above since comes before, 0 if that
+  // isn't known
+  size_t start(unsigned long since) const;
+
+private:
+  struct Mark {
+    size_t offset;
+    unsigned long id;
+  };
+  // oldest first from next once full
+  Mark marks[RECORD_INDEX_SIZE];
+  unsigned int count;
+  unsigned int next;
+};
+
+// the id of a stored record line, false if it has none
+bool recordLineId(const char *line, size_t length, unsigned long &id);
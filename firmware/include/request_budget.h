@@ -0,0 +1,64 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stdint.h>
+
+// how many requests the web server works on at once. lwip has 10 sockets by
+// default, this leaves room for the ones being turned away
+#define MAX_CONCURRENT_REQUESTS 6
+// slots only live requests can use, so the interface stays usable while
+// files are being served
+#define LIVE_RESERVED_REQUESTS 2
+// full card log reads (which stay open for the whole transfer)
+#define MAX_BULK_REQUESTS 1
+
+// seconds clients are told to wait before retrying a rejected request
+#define RETRY_AFTER_SECONDS 1
+#define BULK_RETRY_AFTER_SECONDS 5
+
+enum RequestPriority {
+  // small in-memory responses: settings, stats, progress, commands
+  PRIORITY_LIVE,
+  // interface files and other single reads
+  PRIORITY_NORMAL,
+  // streams of the whole card log
+  PRIORITY_BULK,
+  PRIORITY_COUNT
+};
+
+struct RequestStats {
+  unsigned long admitted[PRIORITY_COUNT];
+  unsigned long rejected[PRIORITY_COUNT];
+  unsigned int inFlightPeak;
+};
+
+// admission control for the web server. a request is admitted when there is
+// room for its priority and holds its slot until the client disconnects.
+//
+// not thread safe: the async web server runs every handler and disconnect
+// callback on its own task.
+class RequestBudget {
+public:
+  RequestBudget();
+
+  // take a slot, false if the request should be turned away
+  bool tryAcquire(RequestPriority priority);
+  void release(RequestPriority priority);
+  // value for the Retry-After header of a rejected request
+  unsigned int retryAfter(RequestPriority priority) const;
+
+  unsigned int inFlight() const { return total; }
+  unsigned int inFlight(RequestPriority priority) const {
+    return active[priority];
+  }
+  const RequestStats &stats() const { return counters; }
+
+private:
+  unsigned int total;
+  unsigned int active[PRIORITY_COUNT];
+  RequestStats counters;
+};
+
+// name used in the stats api
+const char *requestPriorityToString(RequestPriority priority);
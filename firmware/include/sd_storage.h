@@ -0,0 +1,37 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <FS.h>
+
+#include "card_log.h"
+#include "card_storage.h"
+#include "record_index.h"
+
+// card data and settings on the sd card: records go through the
+// preallocated card log, settings are one file each.
+class SdStorage : public CardStorage {
+public:
+  // log must already be open on fs at logPath
+  SdStorage(fs::FS &fs, CardLog &log, const char *logPath);
+
+  bool appendRecord(const char *line, size_t length) override;
+  bool clearRecords() override;
+  size_t recordBytes() override { return log.size(); }
+  RecordReader *openRecords() override;
+  RecordReader *openRecordsSince(unsigned long since) override;
+
+  bool readSetting(const char *name, char *value, size_t size) override;
+  bool writeSetting(const char *name, const char *value) override;
+
+private:
+  void updateIndex();
+  RecordReader *openFrom(size_t offset);
+
+  fs::FS &fs;
+  CardLog &log;
+  const char *logPath;
+  // where the newest records are in the log as it was last opened
+  RecordIndex index;
+  unsigned long indexedOpens;
+};
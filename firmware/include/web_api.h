@@ -0,0 +1,141 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "card_export.h"
+#include "card_storage.h"
+#include "request_budget.h"
+#include "wiegand_capture.h"
+
+// clocks the sd_spi_khz setting accepts, the esp32 spi peripheral tops out
+// at 80MHz but sd cards in spi mode at 25MHz (50MHz for high speed cards)
+#define SD_SPI_MIN_KHZ 400
+#define SD_SPI_MAX_KHZ 40000
+
+// settings the api saves, by the path of their file on the sd card
+extern const char *ssidPath;
+extern const char *passwordPath;
+extern const char *channelPath;
+extern const char *hidessidPath;
+// spi clock for the sd card in kHz, used from the next boot
+extern const char *sdClockPath;
+
+// what the settings endpoints show and change
+struct DeviceSettings {
+  const char *version = "0.1";
+  bool capturing = true;
+  bool powerSave = false;
+  // whether power save got light sleep going, see setPowerSave()
+  bool lightSleep = false;
+  uint32_t sdSpiFrequency = 0;
+  // wifi config, used from the next boot once changed
+  std::string ssid;
+  std::string password;
+  std::string channel;
+  std::string hidessid;
+};
+
+// a request as the api handlers see it. the firmware wraps the async web
+// server's, bench_api its own socket server's.
+class ApiRequest {
+public:
+  virtual ~ApiRequest() {}
+
+  // a query parameter, or a form field with post, nullptr if there isn't one
+  virtual const char *param(const char *name, bool post = false) = 0;
+  // the form fields in the order they were sent
+  virtual size_t formFieldCount() = 0;
+  virtual const char *formFieldName(size_t i) = 0;
+  virtual const char *formFieldValue(size_t i) = 0;
+  // a request header, nullptr if there isn't one
+  virtual const char *header(const char *name) = 0;
+
+  // sent with the response
+  virtual void addHeader(const char *name, const char *value) = 0;
+  virtual void send(int status, const char *contentType,
+                    const std::string &body) = 0;
+  // a 200 response filled a chunk at a time until fill returns 0
+  virtual void sendStream(const char *contentType,
+                          std::function<size_t(uint8_t *, size_t)> fill) = 0;
+  // called once the client has gone, after the last chunk of a stream
+  virtual void onDisconnect(std::function<void()> callback) = 0;
+};
+
+class WebApi;
+
+struct ApiRoute {
+  const char *path;
+  // POST rather than GET
+  bool post;
+  RequestPriority priority;
+  void (WebApi::*handler)(ApiRequest &request);
+};
+
+// the routes below, a path is also matched by those under it so the longer
+// ones come first
+extern const ApiRoute apiRoutes[];
+extern const size_t apiRouteCount;
+
+// the settings, wifi config, stats and card data endpoints of the web api,
+// run by the firmware (main.cpp) and bench_api. what differs between the two
+// is left to a subclass.
+//
+// not thread safe: the async web server runs every handler on its own task.
+class WebApi {
+public:
+  WebApi(CardStorage &storage, RequestBudget &budget, WiegandCapture &capture,
+         DeviceSettings &settings);
+  virtual ~WebApi() {}
+
+  // the route's handler once the request is admitted
+  void handle(const ApiRoute &route, ApiRequest &request);
+  // take a slot for the request or answer 503, admitted requests hold their
+  // slot until the client disconnects
+  bool admit(RequestPriority priority, ApiRequest &request);
+  // 503, telling the client when to try again
+  static void sendBusy(ApiRequest &request, unsigned int retryAfter);
+
+  // save a setting, logging how it went
+  bool saveSetting(const char *name, const char *value);
+
+  // the card data lock (cardDataMutex), given up on after HANDLER_LOCK_WAIT
+  // since handlers must not block the web server
+  virtual bool lockCardData() = 0;
+  virtual void unlockCardData() = 0;
+
+  void cardDataGet(ApiRequest &request);
+  void cardDataExport(ApiRequest &request);
+  void generalSettingsGet(ApiRequest &request);
+  void generalSettingsPost(ApiRequest &request);
+  void wifiConfigGet(ApiRequest &request);
+  void wifiConfigPost(ApiRequest &request);
+  void webStatsGet(ApiRequest &request);
+
+protected:
+  // a new export for a card data response
+  virtual std::shared_ptr<CardDataExport> newExport();
+  // which log the records are read from, sent as X-Card-Data-Version when
+  // not empty. called with the card data lock held
+  virtual std::string cardDataVersion() { return std::string(); }
+  virtual void setPowerSave(bool enable) { settings.powerSave = enable; }
+  virtual void log(const char *format, ...) { (void)format; }
+
+  CardStorage &storage;
+  RequestBudget &budget;
+  WiegandCapture &capture;
+  DeviceSettings &settings;
+
+private:
+  std::shared_ptr<CardDataExport> openExport(ApiRequest &request,
+                                             bool filterSince,
+                                             unsigned long since,
+                                             std::string *version);
+  void sendCardData(ApiRequest &request, std::shared_ptr<CardDataExport> exp);
+};
@@ -0,0 +1,75 @@
+// vim: ts=2 sw=2 et
+
+#pragma once
+
+#include <stdint.h>
+
+#include "card_decoder.h"
+
+#ifdef ARDUINO
+#include <esp_attr.h>
+#else
+#define IRAM_ATTR
+#endif
+
+// frames shorter than this are assumed to be noise and never stored
+#define MIN_FRAME_BITS 20
+// accepted width of a data pulse in microseconds, anything outside this is
+// treated as a glitch (weigand pulses are nominally 20-100us)
+#define MIN_PULSE_WIDTH 10
+#define MAX_PULSE_WIDTH 500
+// time without a new bit after which a frame is complete, in microseconds
+#define FRAME_GAP 25000
+
+// why pulses and frames were thrown away
+struct CaptureStats {
+  volatile unsigned long pulsesTooShort;
+  volatile unsigned long pulsesTooLong;
+  volatile unsigned long bothLinesLow;
+  volatile unsigned long framesTooShort;
+  volatile unsigned long framesTooLong;
+  volatile unsigned long framesAccepted;
+};
+
+// assembles weigand frames from data line edges. onEdge() runs in interrupt
+// context, the rest from the main loop; callers serialise the two.
+class WiegandCapture {
+public:
+  WiegandCapture();
+
+  // feed an edge on DATA0 (line 0) or DATA1 (line 1) with the level of both
+  // lines after it and the time in microseconds. returns true when this edge
+  // added the first bit of a new frame
+  bool onEdge(unsigned char line, bool lineLow, bool otherLow, uint32_t now);
+
+  // a frame has bits and FRAME_GAP has passed since the last one
+  bool frameComplete(uint32_t now) const;
+  bool hasBits() const { return bitCount > 0; }
+
+  // move the current frame into bits and start a new one. returns the bit
+  // count, or 0 if the frame was rejected
+  unsigned int takeFrame(unsigned char *frame);
+
+  // glitch filter settings
+  volatile uint32_t minPulseWidth;
+  volatile uint32_t maxPulseWidth;
+  unsigned int minFrameBits;
+  // waking from light sleep delays the interrupt for the first falling edge
+  // (or misses it entirely), so the first pulse of a frame only has to pass
+  // the upper width limit
+  volatile bool wakeCompensation;
+
+  CaptureStats stats;
+
+private:
+  volatile unsigned char bits[MAX_BITS];
+  volatile unsigned int bitCount;
+  // more than MAX_BITS bits arrived for the current frame
+  volatile bool overflow;
+  volatile uint32_t lastBitTime;
+
+  // when each line last went low, and whether that pulse has been rejected
+  volatile uint32_t pulseStart[2];
+  volatile bool pulseActive[2];
+  volatile bool pulseRejected[2];
+};
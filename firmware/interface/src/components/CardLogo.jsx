@@ -21,5 +21,7 @@ export default function CardLogo({ cardType }) {
           alt="gallagher-logo"
         />
       );
+    default:
+      return <div className="badge font-semibold uppercase">{cardType}</div>;
   }
 }
@@ -1,70 +1,114 @@
-import React, { useState, useEffect, useMemo } from "react";
-import ndjsonStream from "can-ndjson-stream";
+import React, { useState, useEffect, useRef } from "react";
 import Spinner from "./Spinner";
 import ErrorAlert from "./ErrorAlert";
 import InfoAlert from "./InfoAlert";
 import CardLogo from "./CardLogo";
 import RawDataModal from "./RawDataModal";
+import useVirtualRows from "../helpers/useVirtualRows";
+
+// rows are a fixed height so only the visible ones need rendering
+const tableRowHeight = 72;
+const mobileCardHeight = 112;
+// tailwind's md breakpoint, where the table replaces the cards
+const desktopQuery = "(min-width: 768px)";
 
 export default function DataTable({ filter }) {
-  const [cardData, setCardData] = useState([]);
+  const workerRef = useRef(null);
+  const [view, setView] = useState({ version: 0, total: 0 });
+  const [rows, setRows] = useState({ start: 0, rows: [] });
   const [isLoading, setIsLoading] = useState(true);
-  const [isFetching, setIsFetching] = useState(false);
   const [error, setError] = useState("");
   const [sortColumn, setSortColumn] = useState("");
   const [sortDirection, setSortDirection] = useState("");
+  const [isDesktop, setIsDesktop] = useState(
+    () => window.matchMedia(desktopQuery).matches
+  );
 
-  const streamerr = (error) => {
-    setError(
-      "Failed to fetch card data. Check console logs for additional information."
+  // the worker fetches, parses, sorts and filters the card data
+  useEffect(() => {
+    const worker = new Worker(
+      new URL("../workers/cardData.worker.js", import.meta.url),
+      { type: "module" }
     );
-    console.error(error.message);
-  };
+    workerRef.current = worker;
 
-  const getCardData = async () => {
-    setIsFetching(true);
-    fetch("/api/carddata")
-      .then((response) => {
-        return ndjsonStream(response.body);
-      })
-      .then((cardDataStream) => {
-        let read;
-        let cardEntry = [];
-        const reader = cardDataStream.getReader();
-        reader
-          .read()
-          .then(function processValue({ done, value }) {
-            if (done) {
-              return cardEntry;
-            }
-            cardEntry.push(value);
-            return reader.read().then(processValue, streamerr);
-          }, streamerr)
-          .then((data) => {
-            setCardData([...cardData, ...cardEntry]);
-            setError("");
-          });
-      })
-      .catch((error) => {
-        setError(
-          "Failed to fetch card data. Check console logs for additional information."
-        );
-        console.error(error.message);
-      });
-    setIsFetching(false);
-    setIsLoading(false);
-  };
+    let isFetching = false;
+    worker.onmessage = ({ data }) => {
+      switch (data.type) {
+        case "view":
+          setView(data);
+          break;
+        case "rows":
+          setRows(data);
+          break;
+        case "loaded":
+          isFetching = false;
+          setIsLoading(false);
+          setError("");
+          break;
+        case "error":
+          isFetching = false;
+          setIsLoading(false);
+          setError(
+            "Failed to fetch card data. Check console logs for additional information."
+          );
+          console.error(data.message);
+          break;
+      }
+    };
 
-  useEffect(() => {
-    const intervalCall = setInterval(() => {
+    const params = new URLSearchParams(window.location.search);
+    const synthetic = parseInt(params.get("synthetic"));
+    if (synthetic > 0) {
+      worker.postMessage({ type: "synthetic", count: synthetic });
+    }
+
+    const getCardData = () => {
       if (!isFetching) {
-        getCardData();
+        isFetching = true;
+        worker.postMessage({ type: "refresh" });
       }
-    }, 5000);
+    };
+    getCardData();
+    const intervalCall = setInterval(getCardData, 5000);
     return () => {
       clearInterval(intervalCall);
+      worker.terminate();
     };
-  }, [isFetching]);
+  }, []);
+
+  useEffect(() => {
+    const media = window.matchMedia(desktopQuery);
+    const onChange = (event) => setIsDesktop(event.matches);
+    media.addEventListener("change", onChange);
+    return () => media.removeEventListener("change", onChange);
+  }, []);
+
+  const { container, containerRef, start, end, paddingTop, paddingBottom } =
+    useVirtualRows(view.total, isDesktop ? tableRowHeight : mobileCardHeight);
+
+  useEffect(() => {
+    workerRef.current.postMessage({
+      type: "query",
+      filter,
+      sortColumn,
+      sortDirection,
+    });
+    if (container) {
+      container.scrollTop = 0;
+    }
+  }, [filter, sortColumn, sortDirection]);
+
+  // ask the worker for the rows in view whenever they or the view change
+  useEffect(() => {
+    workerRef.current.postMessage({ type: "rows", start, end });
+  }, [start, end, view.version]);
+
+  // rows from the previous request are shown until the new ones arrive
+  const visibleRows = [];
+  for (let i = start; i < end; i++) {
+    visibleRows.push({ position: i, item: rows.rows[i - rows.start] });
+  }
 
   const handleSort = (column) => {
     if (column === sortColumn) {
@@ -100,89 +144,72 @@ export default function DataTable({ filter }) {
     return <CardLogo cardType={cardType} />;
   };
 
-  const filteredCardData = useMemo(
-    () =>
-      cardData.filter((card) => card.card_number.toString().includes(filter)),
-    [cardData, filter]
-  );
-
-  const sortedCardData = useMemo(() => {
-    if (sortColumn && sortDirection) {
-      const sortedData = [...filteredCardData].sort((a, b) => {
-        if (sortDirection === "asc") {
-          return a[sortColumn] - b[sortColumn];
-        } else {
-          return b[sortColumn] - a[sortColumn];
-        }
-      });
-      return sortedData;
-    }
-    return filteredCardData;
-  }, [filteredCardData, sortColumn, sortDirection]);
-
   const renderCardData = (
     <div>
-      {sortedCardData.length > 0 ? (
-        <div>
-          <div className="hidden overflow-x-auto md:block">
-            <table className="table w-full">
-              <thead className="border-b-2 uppercase">
-                <tr>
-                  <th>Type</th>
-                  <th
-                    className="cursor-pointer"
-                    onClick={() => handleSort("bit_length")}
-                  >
-                    <div class="flex items-center">
-                      Bit Length {renderSortIndicator("bit_length")}
-                    </div>
-                  </th>
-                  <th
-                    className="cursor-pointer"
-                    onClick={() => handleSort("region_code")}
-                  >
-                    <div class="flex items-center">
-                      Region Code {renderSortIndicator("region_code")}
-                    </div>
-                  </th>
-                  <th
-                    className="cursor-pointer"
-                    onClick={() => handleSort("facility_code")}
-                  >
-                    <div class="flex items-center">
-                      Facility Code {renderSortIndicator("facility_code")}
-                    </div>
-                  </th>
-                  <th
-                    className="cursor-pointer"
-                    onClick={() => handleSort("card_number")}
-                  >
-                    <div class="flex items-center">
-                      Card Number {renderSortIndicator("card_number")}
-                    </div>
-                  </th>
-                  <th
-                    className="cursor-pointer"
-                    onClick={() => handleSort("issue_level")}
-                  >
-                    <div class="flex items-center">
-                      Issue Level {renderSortIndicator("issue_level")}
-                    </div>
-                  </th>
-                  <th
-                    className="cursor-pointer"
-                    onClick={() => handleSort("hex")}
-                  >
-                    <div class="flex items-center">
-                      Hex {renderSortIndicator("hex")}
-                    </div>
-                  </th>
-                  <th>Raw</th>
-                </tr>
-              </thead>
-              <tbody className="divide-y">
-                {sortedCardData.map((item, index) => (
-                  <tr key={index}>
+      {view.total === 0 ? (
+        <InfoAlert message="No card data found." />
+      ) : isDesktop ? (
+        <div ref={containerRef} className="h-[70vh] overflow-auto">
+          <table className="table w-full">
+            <thead className="sticky top-0 z-10 border-b-2 bg-base-100 uppercase">
+              <tr>
+                <th>Type</th>
+                <th
+                  className="cursor-pointer"
+                  onClick={() => handleSort("bit_length")}
+                >
+                  <div class="flex items-center">
+                    Bit Length {renderSortIndicator("bit_length")}
+                  </div>
+                </th>
+                <th
+                  className="cursor-pointer"
+                  onClick={() => handleSort("region_code")}
+                >
+                  <div class="flex items-center">
+                    Region Code {renderSortIndicator("region_code")}
+                  </div>
+                </th>
+                <th
+                  className="cursor-pointer"
+                  onClick={() => handleSort("facility_code")}
+                >
+                  <div class="flex items-center">
+                    Facility Code {renderSortIndicator("facility_code")}
+                  </div>
+                </th>
+                <th
+                  className="cursor-pointer"
+                  onClick={() => handleSort("card_number")}
+                >
+                  <div class="flex items-center">
+                    Card Number {renderSortIndicator("card_number")}
+                  </div>
+                </th>
+                <th
+                  className="cursor-pointer"
+                  onClick={() => handleSort("issue_level")}
+                >
+                  <div class="flex items-center">
+                    Issue Level {renderSortIndicator("issue_level")}
+                  </div>
+                </th>
+                <th
+                  className="cursor-pointer"
+                  onClick={() => handleSort("hex")}
+                >
+                  <div class="flex items-center">
+                    Hex {renderSortIndicator("hex")}
+                  </div>
+                </th>
+                <th>Raw</th>
+              </tr>
+            </thead>
+            <tbody className="divide-y">
+              {paddingTop > 0 && <tr style={{ height: paddingTop }} />}
+              {visibleRows.map(({ position, item }) =>
+                item ? (
+                  <tr key={item.id} style={{ height: tableRowHeight }}>
                     <td>{renderCardTypeImage(item.card_type)}</td>
                     <td>{item.bit_length}</td>
                     <td>{item.region_code}</td>
@@ -191,60 +218,75 @@ export default function DataTable({ filter }) {
                     <td>{item.issue_level}</td>
                     <td className="font-mono uppercase">{item.hex}</td>
                     <td>
-                      <RawDataModal index={index} raw={item.raw} />
+                      <RawDataModal index={item.id} raw={item.raw} />
                     </td>
                   </tr>
-                ))}
-              </tbody>
-            </table>
-          </div>
-          <div className="grid grid-cols-1 gap-4 p-2 md:hidden">
-            {sortedCardData.map((item) => (
-              <div className="space-y-3 rounded-lg border p-4">
-                <div className="flex w-full items-center text-sm">
-                  <div className="flex w-full items-center">
-                    <div className="text-sm font-semibold">Hex:</div>
-                    <div className="text-sm uppercase pl-0.5">{item.hex}</div>
-                  </div>
-                  <div
-                    className={
-                      "badge font-semibold uppercase " +
-                      (item.card_type === "hid"
-                        ? "bg-blue-700 text-white"
-                        : "bg-amber-500 text-black")
-                    }
-                  >
-                    {item.card_type}
-                  </div>
-                </div>
-                <div className="flex items-center space-x-4 text-sm">
-                  <div className="flex">
-                    <div className="text-sm font-semibold">FC:</div>
-                    <div className="text-sm pl-0.5">{item.facility_code}</div>
-                  </div>
-                  <div className="flex">
-                    <div className="text-sm font-semibold">CN:</div>
-                    <div className="text-sm pl-0.5">{item.card_number}</div>
+                ) : (
+                  <tr
+                    key={"pending-" + position}
+                    style={{ height: tableRowHeight }}
+                  />
+                )
+              )}
+              {paddingBottom > 0 && <tr style={{ height: paddingBottom }} />}
+            </tbody>
+          </table>
+        </div>
+      ) : (
+        <div ref={containerRef} className="h-[70vh] overflow-y-auto p-2">
+          <div style={{ height: paddingTop }} />
+          {visibleRows.map(({ position, item }) => (
+            <div
+              key={item ? item.id : "pending-" + position}
+              className="pb-4"
+              style={{ height: mobileCardHeight }}
+            >
+              {item && (
+                <div className="h-full space-y-3 rounded-lg border p-4">
+                  <div className="flex w-full items-center text-sm">
+                    <div className="flex w-full items-center">
+                      <div className="text-sm font-semibold">Hex:</div>
+                      <div className="text-sm uppercase pl-0.5">{item.hex}</div>
+                    </div>
+                    <div
+                      className={
+                        "badge font-semibold uppercase " +
+                        (item.card_type === "hid"
+                          ? "bg-blue-700 text-white"
+                          : "bg-amber-500 text-black")
+                      }
+                    >
+                      {item.card_type}
+                    </div>
                   </div>
-                  {item.region_code && (
+                  <div className="flex items-center space-x-4 text-sm">
                     <div className="flex">
-                      <div className="text-sm font-semibold">RC:</div>
-                      <div className="text-sm pl-0.5">{item.region_code}</div>
+                      <div className="text-sm font-semibold">FC:</div>
+                      <div className="text-sm pl-0.5">{item.facility_code}</div>
                     </div>
-                  )}
-                  {item.issue_level && (
                     <div className="flex">
-                      <div className="text-sm font-semibold">IL:</div>
-                      <div className="text-sm pl-0.5">{item.issue_level}</div>
+                      <div className="text-sm font-semibold">CN:</div>
+                      <div className="text-sm pl-0.5">{item.card_number}</div>
                     </div>
-                  )}
+                    {item.region_code && (
+                      <div className="flex">
+                        <div className="text-sm font-semibold">RC:</div>
+                        <div className="text-sm pl-0.5">{item.region_code}</div>
+                      </div>
+                    )}
+                    {item.issue_level && (
+                      <div className="flex">
+                        <div className="text-sm font-semibold">IL:</div>
+                        <div className="text-sm pl-0.5">{item.issue_level}</div>
+                      </div>
+                    )}
+                  </div>
                 </div>
-              </div>
-            ))}
-          </div>
+              )}
+            </div>
+          ))}
+          <div style={{ height: paddingBottom }} />
         </div>
-      ) : (
-        <InfoAlert message="No card data found." />
       )}
     </div>
   );
@@ -17,8 +17,20 @@ export const DeviceSettingsProvider = ({ children }) => {
     }
   };
 
+  // the device has no rtc, so hand it the browser's clock for timestamps
+  const setDeviceTime = async () => {
+    try {
+      const formData = new URLSearchParams();
+      formData.append("epoch", Math.floor(Date.now() / 1000));
+      await fetch("/api/device/time", { method: "POST", body: formData });
+    } catch (error) {
+      console.error("An error occurred while setting the device's clock.");
+    }
+  };
+
   useEffect(() => {
     getDeviceSettings();
+    setDeviceTime();
   }, []);
 
   return (
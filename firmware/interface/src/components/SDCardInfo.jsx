@@ -9,6 +9,7 @@ export default function SDCardInfo({
 }) {
   const opentab = currentTab;
   const [sdcardinfo, setSDCardInfo] = useState([]);
+  const [redecode, setRedecode] = useState({});
 
   const getSDCardInfo = async () => {
     try {
@@ -30,10 +31,46 @@ export default function SDCardInfo({
     }
   };
 
+  const getRedecodeProgress = async () => {
+    try {
+      const response = await fetchApiRequest("/api/carddata/redecode");
+      setRedecode(response);
+    } catch (error) {
+      console.error(error);
+    }
+  };
+
+  const startRedecode = async () => {
+    try {
+      const message = await postApiRequest("/api/carddata/redecode");
+      showToastMessage(message);
+      getRedecodeProgress();
+    } catch (error) {
+      setErrorMessage("An error occurred while starting the re-decode.");
+      console.error(error);
+    }
+  };
+
   useEffect(() => {
     getSDCardInfo();
+    getRedecodeProgress();
   }, []);
 
+  // follow the re-decode job while it runs
+  useEffect(() => {
+    if (!redecode.running) {
+      return;
+    }
+    const intervalCall = setInterval(getRedecodeProgress, 2000);
+    return () => {
+      clearInterval(intervalCall);
+    };
+  }, [redecode.running]);
+
+  const redecodePercent = redecode.bytes_total
+    ? Math.floor((redecode.bytes_done / redecode.bytes_total) * 100)
+    : 0;
+
   const { totalBytes: sdcardTotalBytes, usedBytes: sdcardUsedBytes } =
     sdcardinfo;
   const prettysdcardinfototal = formatBytes(sdcardTotalBytes);
@@ -57,6 +94,43 @@ export default function SDCardInfo({
         </div>
       </div>
 
+      <div className="container flex justify-center gap-2 pt-6">
+        <a
+          className="btn-info btn-outline btn"
+          href="/api/carddata/export?format=ndjson"
+          download="cards.jsonl"
+        >
+          Export JSONL
+        </a>
+        <a
+          className="btn-info btn-outline btn"
+          href="/api/carddata/export?format=csv"
+          download="cards.csv"
+        >
+          Export CSV
+        </a>
+      </div>
+
+      <div className="container pt-6">
+        {redecode.running ? (
+          <div className="flex flex-col items-center">
+            <span className="text-sm">
+              Re-decoding card data: {redecode.records} records,{" "}
+              {redecode.changed} changed
+            </span>
+            <progress
+              className="progress progress-info w-56"
+              value={redecodePercent}
+              max="100"
+            ></progress>
+          </div>
+        ) : (
+          <button className="btn-info btn-outline btn" onClick={startRedecode}>
+            Re-decode Card Data
+          </button>
+        )}
+      </div>
+
       <div className="container pt-6">
         <button
           className="btn-error btn"
@@ -1,6 +1,18 @@
+// the device answers 503 with Retry-After when it is too busy, wait and try
+// once more
+const fetchWithRetry = async (url, options) => {
+  const response = await fetch(url, options);
+  if (response.status === 503 && response.headers.has("Retry-After")) {
+    const seconds = parseInt(response.headers.get("Retry-After")) || 1;
+    await new Promise((resolve) => setTimeout(resolve, seconds * 1000));
+    return fetch(url, options);
+  }
+  return response;
+};
+
 const postApiRequest = async (url, data = {}) => {
   try {
-    const response = await fetch(url, {
+    const response = await fetchWithRetry(url, {
       method: "POST",
       headers: {
         "Content-Type": "application/json",
@@ -26,7 +38,7 @@ const postApiRequest = async (url, data = {}) => {
 
 const fetchApiRequest = async (url) => {
   try {
-    const response = await fetch(url);
+    const response = await fetchWithRetry(url);
     if (response.status !== 200) {
       throw new Error(
         `Network Error: ${response.status}, ${response.statusText}`
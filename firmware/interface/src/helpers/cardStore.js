@@ -0,0 +1,126 @@
+// Card data handling used by the card data worker: parsing responses,
+// de-duplicating records by id, and the sorted/filtered view shown in the
+// table.
+
+// Newline delimited json, skipping lines that don't parse
+const parseNdjson = (text) => {
+  const cards = [];
+  for (const line of text.split("\n")) {
+    if (!line.trim()) {
+      continue;
+    }
+    try {
+      cards.push(JSON.parse(line));
+    } catch (error) {
+      console.error("Skipping unreadable card data record", line);
+    }
+  }
+  return cards;
+};
+
+// Records keyed by id. Records stored by older firmware have no id, the
+// firmware numbers those by their position in the log so the same is done
+// here. Later records win if an id appears twice.
+const indexCardData = (cards) => {
+  const index = new Map();
+  cards.forEach((card, position) => {
+    if (card.id === undefined) {
+      card.id = position;
+    }
+    index.set(card.id, card);
+  });
+  return index;
+};
+
+// FNV-1a hash of a response, to skip re-indexing when nothing changed
+const hashBytes = (bytes) => {
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < bytes.length; i++) {
+    hash ^= bytes[i];
+    hash = Math.imul(hash, 0x01000193);
+  }
+  return hash >>> 0;
+};
+
+const compareValues = (a, b) => {
+  if (a === b) return 0;
+  if (a === undefined || a === null) return -1;
+  if (b === undefined || b === null) return 1;
+  if (typeof a === "number" && typeof b === "number") return a - b;
+  return String(a).localeCompare(String(b));
+};
+
+// Filtered by card number and sorted by the selected column. Unsorted views
+// keep log order.
+const buildView = (index, { filter, sortColumn, sortDirection }) => {
+  let view = Array.from(index.values());
+  if (filter) {
+    view = view.filter(
+      (card) =>
+        card.card_number !== undefined &&
+        card.card_number.toString().includes(filter)
+    );
+  }
+  if (sortColumn && sortDirection) {
+    const direction = sortDirection === "asc" ? 1 : -1;
+    view.sort(
+      (a, b) =>
+        direction * compareValues(a[sortColumn], b[sortColumn]) || a.id - b.id
+    );
+  }
+  return view;
+};
+
+// Made up records in the stored format, for measuring the table with large
+// logs (open the interface with ?synthetic=50000)
+const syntheticCardData = (count) => {
+  const cards = [];
+  let seed = 1;
+  const random = (max) => {
+    seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+    return seed % max;
+  };
+  const randomBits = (length) => {
+    let raw = "";
+    for (let i = 0; i < length; i++) {
+      // the low bit of the generator alternates, use a high one
+      raw += random(65536) >> 15;
+    }
+    return raw;
+  };
+
+  for (let id = 0; id < count; id++) {
+    const card = { id, timestamp: 1700000000 + id * 37, decode_status: "ok" };
+    if (random(4) > 0) {
+      card.raw = randomBits(26);
+      card.card_type = "hid";
+      card.bit_length = 26;
+      card.facility_code = parseInt(card.raw.slice(1, 9), 2);
+      card.card_number = parseInt(card.raw.slice(9, 25), 2);
+      card.hex = parseInt(card.raw, 2).toString(16);
+    } else {
+      card.raw = randomBits(96);
+      card.card_type = "gallagher";
+      card.bit_length = 96;
+      card.facility_code = random(65536);
+      card.card_number = random(16777216);
+      card.region_code = random(16);
+      card.issue_level = random(16);
+      // the 8 credential bytes
+      card.hex = "";
+      for (let bit = 16; bit < 80; bit += 4) {
+        card.hex += parseInt(card.raw.slice(bit, bit + 4), 2).toString(16);
+      }
+    }
+    cards.push(card);
+  }
+  return cards;
+};
+
+export {
+  parseNdjson,
+  indexCardData,
+  hashBytes,
+  buildView,
+  syntheticCardData,
+};
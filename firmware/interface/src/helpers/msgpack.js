@@ -0,0 +1,186 @@
+// Decoder for the compact card data format served by
+// /api/carddata?format=msgpack: a sequence of MessagePack arrays, one per
+// record, see firmware/include/card_msgpack.h for the field order.
+
+const recordFields = [
+  "card_type",
+  "bit_length",
+  "facility_code",
+  "card_number",
+  "region_code",
+  "issue_level",
+  "hex",
+  "raw",
+  "decode_status",
+  "timestamp",
+  "id",
+];
+
+const textDecoder = new TextDecoder();
+
+// "00000000".."11111111" for every byte value, used to unpack raw bits
+const byteBits = Array.from({ length: 256 }, (_, i) =>
+  i.toString(2).padStart(8, "0")
+);
+
+// record strings are short and ascii, TextDecoder costs more than it saves
+const decodeString = (bytes) => {
+  if (bytes.length > 32) {
+    return textDecoder.decode(bytes);
+  }
+  let str = "";
+  for (let i = 0; i < bytes.length; i++) {
+    if (bytes[i] >= 0x80) {
+      return textDecoder.decode(bytes);
+    }
+    str += String.fromCharCode(bytes[i]);
+  }
+  return str;
+};
+
+// Reads the subset of MessagePack the firmware writes (plus signed ints,
+// booleans and maps, so extra fields don't break older interfaces)
+class Reader {
+  constructor(buffer) {
+    this.view = new DataView(buffer);
+    this.bytes = new Uint8Array(buffer);
+    this.offset = 0;
+  }
+
+  done() {
+    return this.offset >= this.bytes.length;
+  }
+
+  take(length) {
+    const start = this.offset;
+    this.offset += length;
+    if (this.offset > this.bytes.length) {
+      throw new Error("Truncated card data");
+    }
+    return this.bytes.subarray(start, this.offset);
+  }
+
+  uint(size) {
+    const offset = this.offset;
+    this.take(size);
+    switch (size) {
+      case 1:
+        return this.view.getUint8(offset);
+      case 2:
+        return this.view.getUint16(offset);
+      case 4:
+        return this.view.getUint32(offset);
+      default:
+        return Number(this.view.getBigUint64(offset));
+    }
+  }
+
+  int(size) {
+    const offset = this.offset;
+    this.take(size);
+    switch (size) {
+      case 1:
+        return this.view.getInt8(offset);
+      case 2:
+        return this.view.getInt16(offset);
+      case 4:
+        return this.view.getInt32(offset);
+      default:
+        return Number(this.view.getBigInt64(offset));
+    }
+  }
+
+  array(length) {
+    const items = [];
+    for (let i = 0; i < length; i++) {
+      items.push(this.value());
+    }
+    return items;
+  }
+
+  map(length) {
+    const items = {};
+    for (let i = 0; i < length; i++) {
+      const key = this.value();
+      items[key] = this.value();
+    }
+    return items;
+  }
+
+  value() {
+    const type = this.uint(1);
+    if (type < 0x80) return type;
+    if (type >= 0xe0) return type - 0x100;
+    if ((type & 0xf0) === 0x80) return this.map(type & 0x0f);
+    if ((type & 0xf0) === 0x90) return this.array(type & 0x0f);
+    if ((type & 0xe0) === 0xa0) return decodeString(this.take(type & 0x1f));
+
+    switch (type) {
+      case 0xc0:
+        return null;
+      case 0xc2:
+        return false;
+      case 0xc3:
+        return true;
+      case 0xc4:
+      case 0xc5:
+      case 0xc6:
+        return this.take(this.uint(1 << (type - 0xc4)));
+      case 0xcc:
+      case 0xcd:
+      case 0xce:
+      case 0xcf:
+        return this.uint(1 << (type - 0xcc));
+      case 0xd0:
+      case 0xd1:
+      case 0xd2:
+      case 0xd3:
+        return this.int(1 << (type - 0xd0));
+      case 0xd9:
+      case 0xda:
+      case 0xdb:
+        return decodeString(this.take(this.uint(1 << (type - 0xd9))));
+      case 0xdc:
+      case 0xdd:
+        return this.array(this.uint(2 << (type - 0xdc)));
+      case 0xde:
+      case 0xdf:
+        return this.map(this.uint(2 << (type - 0xde)));
+      default:
+        throw new Error(
+          `Unsupported MessagePack type 0x${type.toString(16)}`
+        );
+    }
+  }
+}
+
+// packed raw bits back to the "0101..." string used everywhere else
+const unpackRawBits = (packed, bitLength) => {
+  let raw = "";
+  for (let i = 0; i < packed.length; i++) {
+    raw += byteBits[packed[i]];
+  }
+  return raw.slice(0, bitLength);
+};
+
+// Decodes a whole response into the same objects the ndjson format gives
+const decodeCardData = (buffer) => {
+  const reader = new Reader(buffer);
+  const cards = [];
+  while (!reader.done()) {
+    const fields = reader.value();
+    const card = {};
+    recordFields.forEach((name, index) => {
+      if (fields[index] !== null && fields[index] !== undefined) {
+        card[name] = fields[index];
+      }
+    });
+    if (card.raw instanceof Uint8Array) {
+      card.raw = unpackRawBits(card.raw, card.bit_length);
+    }
+    cards.push(card);
+  }
+  return cards;
+};
+
+export { decodeCardData };
@@ -0,0 +1,55 @@
+import { useState, useEffect } from "react";
+
+// Windowing for a scroll container of fixed height rows: only the rows in
+// view (plus overscan either side) are rendered, with padding standing in
+// for the rest. containerRef is a callback ref, so the container can mount
+// after the data has loaded.
+export default function useVirtualRows(total, rowHeight, overscan = 8) {
+  const [container, containerRef] = useState(null);
+  const [range, setRange] = useState({ start: 0, end: 0 });
+
+  useEffect(() => {
+    if (!container) {
+      return;
+    }
+    let frame = null;
+    const update = () => {
+      frame = null;
+      const first = Math.floor(container.scrollTop / rowHeight);
+      const visible = Math.ceil(container.clientHeight / rowHeight);
+      const start = Math.max(0, first - overscan);
+      const end = Math.min(total, first + visible + overscan);
+      setRange((current) =>
+        current.start === start && current.end === end
+          ? current
+          : { start, end }
+      );
+    };
+    // at most one update per frame however fast the scroll events come
+    const schedule = () => {
+      if (frame === null) {
+        frame = requestAnimationFrame(update);
+      }
+    };
+
+    update();
+    container.addEventListener("scroll", schedule, { passive: true });
+    window.addEventListener("resize", schedule);
+    return () => {
+      container.removeEventListener("scroll", schedule);
+      window.removeEventListener("resize", schedule);
+      if (frame !== null) {
+        cancelAnimationFrame(frame);
+      }
+    };
+  }, [container, total, rowHeight, overscan]);
+
+  return {
+    container,
+    containerRef,
+    start: range.start,
+    end: range.end,
+    paddingTop: range.start * rowHeight,
+    paddingBottom: Math.max(0, total - range.end) * rowHeight,
+  };
+}
@@ -0,0 +1,133 @@
+// Fetches, parses, sorts and filters the card data off the main thread. The
+// table only asks for the rows it is showing.
+//
+// messages in:
+//   { type: "refresh" }                     fetch new records from
+//                                           /api/carddata
+//   { type: "query", filter, sortColumn, sortDirection }
+//   { type: "rows", start, end }            rows of the current view
+//   { type: "synthetic", count }            use made up data instead
+// messages out:
+//   { type: "view", version, total }        the view changed
+//   { type: "rows", version, start, rows }
+//   { type: "loaded" } / { type: "error", message }
+
+import { decodeCardData } from "../helpers/msgpack";
+import {
+  parseNdjson,
+  indexCardData,
+  hashBytes,
+  buildView,
+  syntheticCardData,
+} from "../helpers/cardStore";
+
+const textDecoder = new TextDecoder();
+
+let cards = new Map();
+let lastHash = null;
+// newest id fetched, later polls only ask for records after it
+let newestId = null;
+// X-Card-Data-Version of the log the cards came from
+let logVersion = null;
+let query = { filter: "", sortColumn: "", sortDirection: "" };
+let view = [];
+let version = 0;
+let synthetic = false;
+
+const updateView = () => {
+  view = buildView(cards, query);
+  version++;
+  postMessage({ type: "view", version, total: view.length });
+};
+
+const refresh = async () => {
+  if (synthetic) {
+    postMessage({ type: "loaded" });
+    return;
+  }
+  const full = newestId === null;
+  try {
+    // the compact msgpack format is several times smaller, older firmware
+    // ignores the Accept header and sends ndjson
+    const url = full ? "/api/carddata" : `/api/carddata?since=${newestId}`;
+    const response = await fetch(url, {
+      headers: { Accept: "application/x-msgpack, application/x-ndjson" },
+    });
+    // the device is busy serving the log to someone else, keep what we have
+    // and try again on the next poll
+    if (response.status === 503) {
+      postMessage({ type: "loaded" });
+      return;
+    }
+    if (response.status !== 200) {
+      throw new Error(
+        `Network Error: ${response.status}, ${response.statusText}`
+      );
+    }
+    // the log was cleared, re-decoded or swapped, or the device restarted,
+    // the records we have may be gone or changed
+    const version = response.headers.get("X-Card-Data-Version");
+    if (!full && version !== logVersion) {
+      newestId = null;
+      refresh();
+      return;
+    }
+    logVersion = version;
+    const buffer = await response.arrayBuffer();
+    const bytes = new Uint8Array(buffer);
+    const contentType = response.headers.get("Content-Type") || "";
+    const decode = () =>
+      contentType.includes("msgpack")
+        ? decodeCardData(buffer)
+        : parseNdjson(textDecoder.decode(bytes));
+
+    if (full) {
+      // only rebuild when the log changed
+      const hash = hashBytes(bytes);
+      if (hash !== lastHash) {
+        cards = indexCardData(decode());
+        lastHash = hash;
+        updateView();
+      }
+    } else if (bytes.length > 0) {
+      // new records go after those we have, replacing any with the same id
+      cards = indexCardData([...cards.values(), ...decode()]);
+      lastHash = null;
+      updateView();
+    }
+    newestId = null;
+    for (const id of cards.keys()) {
+      if (newestId === null || id > newestId) {
+        newestId = id;
+      }
+    }
+    postMessage({ type: "loaded" });
+  } catch (error) {
+    postMessage({ type: "error", message: error.message });
+  }
+};
+
+onmessage = ({ data }) => {
+  switch (data.type) {
+    case "refresh":
+      refresh();
+      break;
+    case "query":
+      query = data;
+      updateView();
+      break;
+    case "rows":
+      postMessage({
+        type: "rows",
+        version,
+        start: data.start,
+        rows: view.slice(data.start, data.end),
+      });
+      break;
+    case "synthetic":
+      synthetic = true;
+      cards = indexCardData(syntheticCardData(data.count));
+      updateView();
+      break;
+  }
+};
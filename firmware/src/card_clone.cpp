@@ -0,0 +1,99 @@
+// vim: ts=2 sw=2 et
+
+#include "card_clone.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// hid prox data starts with this byte, before the manchester coded value
+#define HID_PROX_PREAMBLE 0x1D
+
+// 16 bits to 32, 1 as 10 and 0 as 01
+static uint32_t manchesterEncode(uint16_t value) {
+  uint32_t encoded = 0;
+  for (int i = 15; i >= 0; i--) {
+    encoded = (encoded << 2) | ((value >> i) & 1 ? 2 : 1);
+  }
+  return encoded;
+}
+
+static bool manchesterDecode(uint32_t encoded, unsigned int pairs,
+                             uint32_t &value) {
+  value = 0;
+  for (int i = pairs - 1; i >= 0; i--) {
+    uint32_t pair = (encoded >> (i * 2)) & 3;
+    if (pair != 1 && pair != 2) {
+      return false;
+    }
+    value = (value << 1) | (pair == 2);
+  }
+  return true;
+}
+
+static bool cloneHID(const CardData &card, T5577Clone &clone) {
+  uint64_t value = strtoull(card.hex, nullptr, 16);
+  if (value == 0 || value >> 44 != 0) {
+    return false;
+  }
+  uint32_t high = value >> 32;
+  uint32_t low = value & 0xFFFFFFFF;
+
+  clone.blocks[0] = T5577_CONFIG_HID;
+  clone.blocks[1] = (uint32_t)HID_PROX_PREAMBLE << 24 |
+                    (manchesterEncode(high) & 0xFFFFFF);
+  clone.blocks[2] = manchesterEncode(low >> 16);
+  clone.blocks[3] = manchesterEncode(low & 0xFFFF);
+  snprintf(clone.proxmark, sizeof(clone.proxmark), "lf hid clone -r %s",
+           card.hex);
+  return true;
+}
+
+static bool cloneGallagher(const CardData &card, T5577Clone &clone) {
+  // captured frames can have extra bits around them, write a clean one
+  CardData encoded = card;
+  if (!encodeCard(encoded)) {
+    return false;
+  }
+
+  clone.blocks[0] = T5577_CONFIG_GALLAGHER;
+  for (int b = 1; b < T5577_CLONE_BLOCKS; b++) {
+    uint32_t block = 0;
+    for (int i = 0; i < 32; i++) {
+      block = (block << 1) | encoded.bits[(b - 1) * 32 + i];
+    }
+    clone.blocks[b] = block;
+  }
+  snprintf(clone.proxmark, sizeof(clone.proxmark),
+           "lf gallagher clone --raw %08lX%08lX%08lX",
+           (unsigned long)clone.blocks[1], (unsigned long)clone.blocks[2],
+           (unsigned long)clone.blocks[3]);
+  return true;
+}
+
+bool cloneToT5577(const CardData &card, T5577Clone &clone) {
+  if (card.status != DECODE_OK) {
+    return false;
+  }
+  if (card.cardType == HID) {
+    return cloneHID(card, clone);
+  }
+  if (card.cardType == GALLAGHER) {
+    return cloneGallagher(card, clone);
+  }
+  return false;
+}
+
+bool hidProxValue(const T5577Clone &clone, uint64_t &value) {
+  if (clone.blocks[0] != T5577_CONFIG_HID ||
+      clone.blocks[1] >> 24 != HID_PROX_PREAMBLE) {
+    return false;
+  }
+  uint32_t high, middle, low;
+  if (!manchesterDecode(clone.blocks[1] & 0xFFFFFF, 12, high) ||
+      !manchesterDecode(clone.blocks[2], 16, middle) ||
+      !manchesterDecode(clone.blocks[3], 16, low)) {
+    return false;
+  }
+  value = (uint64_t)high << 32 | middle << 16 | low;
+  return true;
+}
@@ -0,0 +1,514 @@
+// vim: ts=2 sw=2 et
+
+#include "card_decoder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+const char *cardTypeToString(CardType cardType) {
+  switch (cardType) {
+    case HID:
+      return "hid";
+    case GALLAGHER:
+      return "gallagher";
+    case UNKNOWN:
+      return "unknown";
+    default:
+      return "Invalid Card Type";
+  }
+}
+
+const char *decodeStatusToString(DecodeStatus status) {
+  switch (status) {
+    case DECODE_OK:
+      return "ok";
+    case DECODE_UNSUPPORTED:
+      return "unsupported";
+    case DECODE_ERROR:
+      return "error";
+    default:
+      return "Invalid Decode Status";
+  }
+}
+
+// Process hid cards
+static unsigned long decodeHIDFacilityCode(const unsigned char *bits,
+                                           unsigned int start,
+                                           unsigned int end) {
+  unsigned long HIDFacilityCode = 0;
+  for (unsigned int i = start; i < end; i++) {
+    HIDFacilityCode = (HIDFacilityCode << 1) | bits[i];
+  }
+  return HIDFacilityCode;
+}
+
+static unsigned long decodeHIDCardNumber(const unsigned char *bits,
+                                         unsigned int start,
+                                         unsigned int end) {
+  unsigned long HIDCardNumber = 0;
+  for (unsigned int i = start; i < end; i++) {
+    HIDCardNumber = (HIDCardNumber << 1) | bits[i];
+  }
+  return HIDCardNumber;
+}
+
+// Card value processing functions
+// Function to append the card value (bitHolder1 and bitHolder2) to the
+// necessary array then translate that to the two chunks for the card value that
+// will be output. bitHolder1 holds the first 22 bits of the frame and
+// bitHolder2 the rest
+static void setCardChunkBits(unsigned int cardChunk1Offset,
+                             unsigned int bitHolderOffset,
+                             unsigned int cardChunk2Offset, uint32_t bitHolder1,
+                             uint32_t bitHolder2, uint32_t &cardChunk1,
+                             uint32_t &cardChunk2) {
+  for (int i = 19; i >= 0; i--) {
+    if (i == 13 || i == (int)cardChunk1Offset) {
+      cardChunk1 |= 1UL << i;
+    } else if (i > (int)cardChunk1Offset) {
+      cardChunk1 &= ~(1UL << i);
+    } else {
+      cardChunk1 |= ((bitHolder1 >> (i + bitHolderOffset)) & 1) << i;
+    }
+    if (i < (int)bitHolderOffset) {
+      cardChunk2 |= ((bitHolder1 >> i) & 1) << (i + cardChunk2Offset);
+    }
+    if (i < (int)cardChunk2Offset) {
+      cardChunk2 |= ((bitHolder2 >> i) & 1) << i;
+    }
+  }
+}
+
+// hid formats by frame length: where the facility code and card number are,
+// how the frame is split into the two chunks of the hex card value, and the
+// parity bits (for encoding, they aren't checked when decoding)
+// see http://www.pagemac.com/projects/rfid/hid_data_formats for more info
+// also specifically: www.brivo.com/app/static_data/js/calculate.js
+enum HIDParity {
+  // even parity over the first half of the frame in the first bit, odd
+  // parity over the second half in the last (if it isn't data)
+  HID_PARITY_STANDARD,
+  // hid corporate 1000 35 bit, three interleaved parity bits
+  HID_PARITY_CORPORATE_1000,
+};
+
+struct HIDFormat {
+  unsigned int bitCount;
+  unsigned int facilityStart;
+  unsigned int facilityEnd;
+  unsigned int numberStart;
+  unsigned int numberEnd;
+  unsigned int cardChunk1Offset;
+  unsigned int bitHolderOffset;
+  unsigned int cardChunk2Offset;
+  HIDParity parity;
+};
+
+static const HIDFormat hidFormats[] = {
+    {26, 1, 9, 9, 25, 2, 20, 4, HID_PARITY_STANDARD},
+    {27, 1, 13, 13, 27, 3, 19, 5, HID_PARITY_STANDARD},
+    {29, 1, 13, 13, 29, 5, 17, 7, HID_PARITY_STANDARD},
+    {30, 1, 13, 13, 29, 6, 16, 8, HID_PARITY_STANDARD},
+    {31, 1, 5, 5, 28, 7, 15, 9, HID_PARITY_STANDARD},
+    {32, 1, 13, 13, 31, 8, 14, 10, HID_PARITY_STANDARD},
+    {33, 1, 8, 8, 32, 9, 13, 11, HID_PARITY_STANDARD},
+    {34, 1, 17, 17, 33, 10, 12, 12, HID_PARITY_STANDARD},
+    {35, 2, 14, 14, 34, 11, 11, 13, HID_PARITY_CORPORATE_1000},
+    {36, 21, 33, 1, 17, 12, 10, 14, HID_PARITY_STANDARD},
+};
+
+static const HIDFormat *findHIDFormat(unsigned int bitCount) {
+  for (const HIDFormat &format : hidFormats) {
+    if (format.bitCount == bitCount) {
+      return &format;
+    }
+  }
+  return nullptr;
+}
+
+static void processHIDCard(CardData &card) {
+  // Example of full card value
+  // |>   preamble   <| |>   Actual card value   <|
+  // 000000100000000001 11 111000100000100100111000
+  // |> write to chunk1 <| |>  write to chunk2   <|
+  card.cardType = HID;
+  const unsigned char *bits = card.bits;
+
+  const HIDFormat *format = findHIDFormat(card.bitCount);
+  if (!format) {
+    card.status = DECODE_UNSUPPORTED;
+    card.error = "Unsupported bitCount for HID card";
+    return;
+  }
+  card.facilityCode =
+      decodeHIDFacilityCode(bits, format->facilityStart, format->facilityEnd);
+  card.cardNumber =
+      decodeHIDCardNumber(bits, format->numberStart, format->numberEnd);
+
+  // split the frame the same way the interrupts used to while capturing
+  uint32_t bitHolder1 = 0;
+  uint32_t bitHolder2 = 0;
+  for (unsigned int i = 0; i < card.bitCount; i++) {
+    if (i < 22) {
+      bitHolder1 = (bitHolder1 << 1) | bits[i];
+    } else {
+      bitHolder2 = (bitHolder2 << 1) | bits[i];
+    }
+  }
+
+  uint32_t cardChunk1 = 0;
+  uint32_t cardChunk2 = 0;
+  setCardChunkBits(format->cardChunk1Offset, format->bitHolderOffset,
+                   format->cardChunk2Offset, bitHolder1, bitHolder2,
+                   cardChunk1, cardChunk2);
+  snprintf(card.hex, sizeof(card.hex), "%lx%06lx", (unsigned long)cardChunk1,
+           (unsigned long)cardChunk2);
+  card.status = DECODE_OK;
+}
+
+// gallagher cardholder credential data structure
+struct CardholderCredentials {
+  int region_code;
+  int facility_code;
+  int card_number;
+  int issue_level;
+};
+
+// gallagher substitution table, scrambled byte to plain. const data stays
+// in flash on the esp32
+static constexpr uint8_t descrambleTable[256] = {
+      0x2f, 0x6e, 0xdd, 0xdf, 0x1d, 0x0f, 0xb0, 0x76, 0xad, 0xaf, 0x7f, 0xbb,
+      0x77, 0x85, 0x11, 0x6d, 0xf4, 0xd2, 0x84, 0x42, 0xeb, 0xf7, 0x34, 0x55,
+      0x4a, 0x3a, 0x10, 0x71, 0xe7, 0xa1, 0x62, 0x1a, 0x3e, 0x4c, 0x14, 0xd3,
+      0x5e, 0xb2, 0x7d, 0x56, 0xbc, 0x27, 0x82, 0x60, 0xe3, 0xae, 0x1f, 0x9b,
+      0xaa, 0x2b, 0x95, 0x49, 0x73, 0xe1, 0x92, 0x79, 0x91, 0x38, 0x6c, 0x19,
+      0x0e, 0xa9, 0xe2, 0x8d, 0x66, 0xc7, 0x5a, 0xf5, 0x1c, 0x80, 0x99, 0xbe,
+      0x4e, 0x41, 0xf0, 0xe8, 0xa6, 0x20, 0xab, 0x87, 0xc8, 0x1e, 0xa0, 0x59,
+      0x7b, 0x0c, 0xc3, 0x3c, 0x61, 0xcc, 0x40, 0x9e, 0x06, 0x52, 0x1b, 0x32,
+      0x8c, 0x12, 0x93, 0xbf, 0xef, 0x3b, 0x25, 0x0d, 0xc2, 0x88, 0xd1, 0xe0,
+      0x07, 0x2d, 0x70, 0xc6, 0x29, 0x6a, 0x4d, 0x47, 0x26, 0xa3, 0xe4, 0x8b,
+      0xf6, 0x97, 0x2c, 0x5d, 0x3d, 0xd7, 0x96, 0x28, 0x02, 0x08, 0x30, 0xa7,
+      0x22, 0xc9, 0x65, 0xf8, 0xb7, 0xb4, 0x8a, 0xca, 0xb9, 0xf2, 0xd0, 0x17,
+      0xff, 0x46, 0xfb, 0x9a, 0xba, 0x8f, 0xb6, 0x69, 0x68, 0x8e, 0x21, 0x6f,
+      0xc4, 0xcb, 0xb3, 0xce, 0x51, 0xd4, 0x81, 0x00, 0x2e, 0x9c, 0x74, 0x63,
+      0x45, 0xd9, 0x16, 0x35, 0x5f, 0xed, 0x78, 0x9f, 0x01, 0x48, 0x04, 0xc1,
+      0x33, 0xd6, 0x4f, 0x94, 0xde, 0x31, 0x9d, 0x0a, 0xac, 0x18, 0x4b, 0xcd,
+      0x98, 0xb8, 0x37, 0xa2, 0x83, 0xec, 0x03, 0xd8, 0xda, 0xe5, 0x7a, 0x6b,
+      0x53, 0xd5, 0x15, 0xa4, 0x43, 0xe9, 0x90, 0x67, 0x58, 0xc0, 0xa5, 0xfa,
+      0x2a, 0xb1, 0x75, 0x50, 0x39, 0x5c, 0xe6, 0xdc, 0x89, 0xfc, 0xcf, 0xfe,
+      0xf9, 0x57, 0x54, 0x64, 0xa8, 0xee, 0x23, 0x0b, 0xf1, 0xea, 0xfd, 0xdb,
+      0xbd, 0x09, 0xb5, 0x5b, 0x05, 0x86, 0x13, 0xf3, 0x24, 0xc5, 0x3f, 0x44,
+      0x72, 0x7c, 0x7e, 0x36};
+
+// the position of value in descrambleTable, plain byte to scrambled
+static constexpr uint8_t scrambleOf(uint8_t value, unsigned int i = 0) {
+  return i > 255                        ? 0
+         : descrambleTable[i] == value ? i
+                                       : scrambleOf(value, i + 1);
+}
+
+#define SCRAMBLE_4(n)                                                          \
+  scrambleOf(n), scrambleOf(n + 1), scrambleOf(n + 2), scrambleOf(n + 3)
+#define SCRAMBLE_16(n)                                                         \
+  SCRAMBLE_4(n), SCRAMBLE_4(n + 4), SCRAMBLE_4(n + 8), SCRAMBLE_4(n + 12)
+#define SCRAMBLE_64(n)                                                         \
+  SCRAMBLE_16(n), SCRAMBLE_16(n + 16), SCRAMBLE_16(n + 32), SCRAMBLE_16(n + 48)
+
+// the inverse of descrambleTable, generated at compile time
+static constexpr uint8_t scrambleTable[256] = {
+    SCRAMBLE_64(0), SCRAMBLE_64(64), SCRAMBLE_64(128), SCRAMBLE_64(192)};
+
+// every byte maps back to itself, so descrambleTable is a permutation
+static constexpr bool isInverse(unsigned int i = 0) {
+  return i > 255 ||
+         (descrambleTable[scrambleTable[i]] == i && isInverse(i + 1));
+}
+static_assert(isInverse(), "gallagher scramble table is not a permutation");
+
+// deobfuscate Gallagher cardholder credentials
+static CardholderCredentials
+deobfuscate_cardholder_credentials(const uint8_t *bytes) {
+  uint8_t arr[8];
+  for (int i = 0; i < 8; i++) {
+    arr[i] = descrambleTable[bytes[i]];
+  }
+
+  CardholderCredentials credentials;
+  // 4bit region code
+  credentials.region_code = (arr[3] & 0x1E) >> 1;
+  // 16bit facility code
+  credentials.facility_code =
+      ((arr[5] & 0x0F) << 12) | (arr[1] << 4) | ((arr[7] >> 4) & 0x0F);
+  // 24bit card number
+  credentials.card_number = (arr[0] << 16) | ((arr[4] & 0x1F) << 11) |
+                            (arr[2] << 3) | ((arr[3] & 0xE0) >> 5);
+  // 4bit issue level
+  credentials.issue_level = (arr[7] & 0x0F);
+
+  return credentials;
+}
+
+// Function to decode raw Gallagher Cardax 125kHz card data into 8 bytes
+static bool decode_cardax_125khz(CardData &card, uint8_t *bytes) {
+  static const unsigned char magic_prefix[] = {0, 1, 1, 1, 1, 1, 1,
+                                               1, 1, 1, 1, 0, 1, 0};
+  const unsigned int prefixLength = sizeof(magic_prefix);
+
+  int i = -1;
+  for (unsigned int start = 0; start + prefixLength <= card.bitCount;
+       start++) {
+    if (memcmp(card.bits + start, magic_prefix, prefixLength) == 0) {
+      i = start;
+      break;
+    }
+  }
+
+  if (i == -1) {
+    card.error = "Magic prefix not found - not a valid gallagher cardax card";
+    return false;
+  }
+
+  // 8 data bytes, each followed by a parity bit, and a checksum byte
+  const unsigned char *data = card.bits + i + 16;
+  if (i + 16 + 9 * 8 + 8 > (int)card.bitCount) {
+    card.error = "Invalid gallagher card data length";
+    return false;
+  }
+
+  for (int b = 0; b < 8; b++) {
+    const unsigned char *n = data + 9 * b;
+    if (n[7] == n[8]) {
+      card.error = "Invalid gallagher data";
+      return false;
+    }
+    bytes[b] = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      bytes[b] = (bytes[b] << 1) | n[bit];
+    }
+  }
+
+  /*
+  TODO: the checksum always fails
+  byte check_sum = 0x2C;
+  byte xcc[] = {0x7, 0xE, 0x1C, 0x38, 0x70, 0xE0, 0xC7, 0x89};
+
+  for (int c = 0; c < 8; c++) {
+    byte ncs = check_sum ^ ((byte*)&n)[c];
+    check_sum = ncs;
+    for (int i = 0; i < 8; i++) {
+      if (ncs & (1 << i)) {
+        check_sum ^= xcc[i];
+      }
+    }
+  }
+  */
+
+  return true;
+}
+
+static void processGallagherCard(CardData &card) {
+  card.cardType = GALLAGHER;
+  uint8_t hex[8];
+  if (!decode_cardax_125khz(card, hex)) {
+    card.status = DECODE_ERROR;
+    return;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    snprintf(card.hex + i * 2, sizeof(card.hex) - i * 2, "%02x", hex[i]);
+  }
+  CardholderCredentials credentials = deobfuscate_cardholder_credentials(hex);
+  card.regionCode = credentials.region_code;
+  card.facilityCode = credentials.facility_code;
+  card.cardNumber = credentials.card_number;
+  card.issueLevel = credentials.issue_level;
+  card.status = DECODE_OK;
+}
+
+bool decodeCard(const unsigned char *bits, unsigned int bitCount,
+                CardData &card) {
+  if (bitCount > MAX_BITS) {
+    bitCount = MAX_BITS;
+  }
+  memcpy(card.bits, bits, bitCount);
+  card.bitCount = bitCount;
+  card.cardType = UNKNOWN;
+  card.status = DECODE_UNSUPPORTED;
+  card.error = "Unsupported bitCount";
+  card.facilityCode = 0;
+  card.cardNumber = 0;
+  card.regionCode = 0;
+  card.issueLevel = 0;
+  card.hex[0] = '\0';
+
+  if (bitCount >= 26 && bitCount <= 36) {
+    processHIDCard(card);
+  }
+
+  if (bitCount == 96) {
+    processGallagherCard(card);
+  }
+
+  if (card.status == DECODE_OK && card.facilityCode == 0 &&
+      card.cardNumber == 0) {
+    card.status = DECODE_ERROR;
+    card.error = "Blank facility code or card number";
+  }
+  if (card.status == DECODE_OK) {
+    card.error = nullptr;
+  }
+  return card.status == DECODE_OK;
+}
+
+// Card encoding, the reverse of the decoders above
+static void encodeBits(unsigned char *bits, unsigned int start,
+                       unsigned int end, unsigned long value) {
+  for (unsigned int i = end; i > start; i--) {
+    bits[i - 1] = value & 1;
+    value >>= 1;
+  }
+}
+
+// 1 if an odd number of bits in [start, end) are set
+static unsigned char parityOf(const unsigned char *bits, unsigned int start,
+                              unsigned int end) {
+  unsigned char parity = 0;
+  for (unsigned int i = start; i < end; i++) {
+    parity ^= bits[i];
+  }
+  return parity;
+}
+
+static void setHIDParity(unsigned char *bits, const HIDFormat &format) {
+  if (format.parity == HID_PARITY_CORPORATE_1000) {
+    unsigned char even = 0;
+    for (unsigned int i = 2; i < 34; i++) {
+      if (i % 3 != 1) {
+        even ^= bits[i];
+      }
+    }
+    bits[1] = even;
+    unsigned char odd = 1;
+    for (unsigned int i = 1; i < 33; i++) {
+      if (i % 3 != 0) {
+        odd ^= bits[i];
+      }
+    }
+    bits[34] = odd;
+    bits[0] = 1 ^ parityOf(bits, 1, 35);
+    return;
+  }
+
+  unsigned int dataEnd = format.facilityEnd > format.numberEnd
+                             ? format.facilityEnd
+                             : format.numberEnd;
+  unsigned int last =
+      dataEnd < format.bitCount ? format.bitCount - 1 : format.bitCount;
+  unsigned int half = 1 + (last - 1) / 2;
+  bits[0] = parityOf(bits, 1, half);
+  if (last < format.bitCount) {
+    bits[last] = 1 ^ parityOf(bits, half, last);
+  }
+}
+
+static bool encodeHIDCard(const CardData &card, unsigned char *bits) {
+  const HIDFormat *format = findHIDFormat(card.bitCount);
+  if (!format) {
+    return false;
+  }
+  unsigned int facilityBits = format->facilityEnd - format->facilityStart;
+  unsigned int numberBits = format->numberEnd - format->numberStart;
+  if (card.facilityCode >> facilityBits != 0 ||
+      card.cardNumber >> numberBits != 0) {
+    return false;
+  }
+
+  memset(bits, 0, card.bitCount);
+  encodeBits(bits, format->facilityStart, format->facilityEnd,
+             card.facilityCode);
+  encodeBits(bits, format->numberStart, format->numberEnd, card.cardNumber);
+  setHIDParity(bits, *format);
+  return true;
+}
+
+// crc-8 over the scrambled bytes (polynomial 0x2d, initial value 0x2c), as
+// written by proxmark's gallagher clone. not checked when decoding
+static uint8_t gallagherChecksum(const uint8_t *bytes) {
+  uint8_t crc = 0x2c;
+  for (int i = 0; i < 8; i++) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x2d : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static bool encodeGallagherCard(const CardData &card, unsigned char *bits) {
+  if (card.regionCode > 0x0F || card.issueLevel > 0x0F ||
+      card.facilityCode > 0xFFFF || card.cardNumber > 0xFFFFFF) {
+    return false;
+  }
+
+  // the reverse of deobfuscate_cardholder_credentials
+  unsigned long fc = card.facilityCode;
+  unsigned long cn = card.cardNumber;
+  uint8_t arr[8];
+  arr[0] = cn >> 16;
+  arr[1] = (fc >> 4) & 0xFF;
+  arr[2] = (cn >> 3) & 0xFF;
+  arr[3] = (cn & 0x07) << 5 | card.regionCode << 1;
+  arr[4] = (cn >> 11) & 0x1F;
+  arr[5] = fc >> 12;
+  arr[6] = 0;
+  arr[7] = (fc & 0x0F) << 4 | card.issueLevel;
+  for (int i = 0; i < 8; i++) {
+    arr[i] = scrambleTable[arr[i]];
+  }
+
+  // magic prefix, 8 data bytes each followed by the inverse of its last
+  // bit, then the checksum
+  encodeBits(bits, 0, 16, 0x7FEA);
+  for (int b = 0; b < 8; b++) {
+    unsigned char *n = bits + 16 + 9 * b;
+    encodeBits(n, 0, 8, arr[b]);
+    n[8] = !n[7];
+  }
+  encodeBits(bits, 88, 96, gallagherChecksum(arr));
+  return true;
+}
+
+bool encodeCard(CardData &card) {
+  unsigned char bits[MAX_BITS];
+  bool encoded = false;
+  if (card.cardType == HID) {
+    encoded = encodeHIDCard(card, bits);
+  } else if (card.cardType == GALLAGHER) {
+    card.bitCount = 96;
+    encoded = encodeGallagherCard(card, bits);
+  }
+  if (!encoded) {
+    return false;
+  }
+  return decodeCard(bits, card.bitCount, card);
+}
+
+void formatRawBits(const CardData &card, char *raw, size_t rawLength) {
+  size_t i = 0;
+  for (; i < card.bitCount && i + 1 < rawLength; i++) {
+    raw[i] = card.bits[i] ? '1' : '0';
+  }
+  raw[i] = '\0';
+}
+
+unsigned int parseRawBits(const char *raw, unsigned char *bits,
+                          unsigned int maxBits) {
+  unsigned int count = 0;
+  for (; raw[count] != '\0'; count++) {
+    if (count == maxBits || (raw[count] != '0' && raw[count] != '1')) {
+      return 0;
+    }
+    bits[count] = raw[count] - '0';
+  }
+  return count;
+}
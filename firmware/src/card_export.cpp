@@ -0,0 +1,186 @@
+// vim: ts=2 sw=2 et
+
+#include "card_export.h"
+
+#include "card_msgpack.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *csvHeader = "card_type,bit_length,region_code,"
+                               "facility_code,card_number,issue_level,hex,"
+                               "raw,timestamp\n";
+
+void CardDataExport::begin(RecordReader *reader) {
+  this->reader.reset(reader);
+}
+
+// read the next non-empty line of the log into line, without its newline.
+// lines too long to be records are skipped
+bool CardDataExport::readRecord(size_t &length) {
+  length = 0;
+  bool tooLong = false;
+  while (true) {
+    if (inputOffset == inputLength) {
+      inputOffset = 0;
+      inputLength = reader ? reader->read(input, sizeof(input)) : 0;
+      if (inputLength == 0) {
+        // a last record without its newline
+        return length > 0 && !tooLong;
+      }
+    }
+
+    uint8_t *start = input + inputOffset;
+    size_t available = inputLength - inputOffset;
+    uint8_t *newline = (uint8_t *)memchr(start, '\n', available);
+    size_t n = newline ? newline - start : available;
+    inputOffset += newline ? n + 1 : n;
+
+    if (length + n > RECORD_LINE_SIZE - 1) {
+      tooLong = true;
+    } else if (!tooLong) {
+      memcpy(line + length, start, n);
+      length += n;
+    }
+    if (newline) {
+      if (length > 0 && !tooLong) {
+        return true;
+      }
+      // padding, or a line that was too long
+      length = 0;
+      tooLong = false;
+    }
+  }
+}
+
+// printf onto the end of out, length goes past size once it's full
+static void appendf(char *out, size_t size, size_t &length, const char *format,
+                    ...) {
+  va_list args;
+  va_start(args, format);
+  if (length < size) {
+    length += vsnprintf(out + length, size - length, format, args);
+  }
+  va_end(args);
+}
+
+// an optional number as a csv column, empty if not present
+static void appendCsvNumber(char *out, size_t size, size_t &length,
+                            bool present, unsigned long value) {
+  if (present) {
+    appendf(out, size, length, "%lu,", value);
+  } else {
+    appendf(out, size, length, ",");
+  }
+}
+
+// load the next record to send into line, false once the log is done
+bool CardDataExport::nextLine() {
+  lineOffset = 0;
+  // nothing left to send once the log is done
+  lineLength = 0;
+  if (csv && !headerWritten) {
+    headerWritten = true;
+    lineLength = strlen(csvHeader);
+    memcpy(line, csvHeader, lineLength);
+    return true;
+  }
+
+  size_t n;
+  while (readRecord(n)) {
+    line[n] = '\0';
+
+    // plain ndjson without a filter is passed through untouched
+    if (!csv && !msgpack && !filterTime && !filterSince) {
+      line[n++] = '\n';
+      lineLength = n;
+      return true;
+    }
+
+    // parsed from a copy, the stored line is sent as is for plain ndjson
+    char text[RECORD_LINE_SIZE];
+    memcpy(text, line, n + 1);
+    CardRecord record;
+    if (!parseCardRecord(text, record)) {
+      continue;
+    }
+
+    if (filterSince && (!record.hasId || record.id <= since)) {
+      continue;
+    }
+    if (filterTime) {
+      if (!record.hasTimestamp || record.timestamp < from ||
+          record.timestamp > to) {
+        continue;
+      }
+    }
+
+    if (msgpack) {
+      lineLength = packCardRecord(record, (uint8_t *)line, sizeof(line));
+      if (lineLength == 0) {
+        continue;
+      }
+    } else if (csv) {
+      size_t size = sizeof(line);
+      size_t length = 0;
+      appendf(line, size, length, "%s,%u,",
+              record.cardType ? record.cardType : "", record.bitLength);
+      appendCsvNumber(line, size, length, record.hasRegionCode,
+                      record.regionCode);
+      appendf(line, size, length, "%lu,%lu,", record.facilityCode,
+              record.cardNumber);
+      appendCsvNumber(line, size, length, record.hasIssueLevel,
+                      record.issueLevel);
+      appendf(line, size, length, "%s,%s,", record.hex ? record.hex : "",
+              record.raw ? record.raw : "");
+      if (record.hasTimestamp) {
+        appendf(line, size, length, "%lu", record.timestamp);
+      }
+      appendf(line, size, length, "\n");
+      if (length >= size) {
+        continue;
+      }
+      lineLength = length;
+    } else {
+      line[n++] = '\n';
+      lineLength = n;
+    }
+    return true;
+  }
+  return false;
+}
+
+size_t CardDataExport::fill(uint8_t *buffer, size_t maxLen) {
+  if (!compress) {
+    size_t written = 0;
+    while (written < maxLen) {
+      if (lineOffset == lineLength && !nextLine()) {
+        break;
+      }
+      size_t n = lineLength - lineOffset;
+      if (n > maxLen - written) {
+        n = maxLen - written;
+      }
+      memcpy(buffer + written, line + lineOffset, n);
+      lineOffset += n;
+      written += n;
+    }
+    return written;
+  }
+
+  // compress until the encoder's output buffer is full or the log ends
+  while (gzip.available() < maxLen) {
+    if (lineOffset == lineLength && !nextLine()) {
+      gzip.finish();
+      break;
+    }
+    size_t n = gzip.write((const uint8_t *)line + lineOffset,
+                          lineLength - lineOffset);
+    lineOffset += n;
+    if (lineOffset < lineLength) {
+      break;
+    }
+  }
+  return gzip.read(buffer, maxLen);
+}
@@ -0,0 +1,227 @@
+// vim: ts=2 sw=2 et
+
+#include "card_log.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+// read and write, without truncating or moving every write to the end
+#define FILE_UPDATE "r+"
+
+CardLog::CardLog()
+    : fs(nullptr), path(nullptr), open(false), logicalEnd(0), fileSize(0),
+      extentCount(0), openCount(0), unsynced(0), unsyncedSince(0),
+      needsNewline(false) {}
+
+bool CardLog::begin(fs::FS &fs, const char *path) {
+  end();
+  this->fs = &fs;
+  this->path = path;
+  openCount++;
+  file = fs.open(path, FILE_UPDATE);
+  if (!file) {
+    return false;
+  }
+  fileSize = file.size();
+  extentCount = 0;
+  unsynced = 0;
+  if (!findEnd() || !loadTail()) {
+    file.close();
+    return false;
+  }
+  open = true;
+  return true;
+}
+
+void CardLog::end() {
+  if (open) {
+    file.close();
+    open = false;
+  }
+}
+
+// is the sector at offset nothing but padding
+static bool isPadSector(File &file, size_t offset, size_t fileSize,
+                        uint8_t *buffer) {
+  size_t n = fileSize - offset;
+  if (n > CARD_LOG_SECTOR_SIZE) {
+    n = CARD_LOG_SECTOR_SIZE;
+  }
+  if (!file.seek(offset) || file.read(buffer, n) != n) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (buffer[i] != CARD_LOG_PAD) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CardLog::findEnd() {
+  logicalEnd = 0;
+  needsNewline = false;
+  size_t sectors =
+      (fileSize + CARD_LOG_SECTOR_SIZE - 1) / CARD_LOG_SECTOR_SIZE;
+
+  // the padding is a run of whole sectors at the end of the file (plus the
+  // rest of the sector the records end in), binary search for where it
+  // starts
+  size_t low = 0;
+  size_t high = sectors;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (isPadSector(file, mid * CARD_LOG_SECTOR_SIZE, fileSize, block)) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  if (low == 0) {
+    return true;
+  }
+
+  // the records end in the sector before, after its last non-padding byte
+  // and the newline that follows it
+  size_t offset = (low - 1) * CARD_LOG_SECTOR_SIZE;
+  size_t n = fileSize - offset;
+  if (n > CARD_LOG_SECTOR_SIZE) {
+    n = CARD_LOG_SECTOR_SIZE;
+  }
+  if (!file.seek(offset) || file.read(block, n) != n) {
+    return false;
+  }
+  while (n > 0 && block[n - 1] == CARD_LOG_PAD) {
+    n--;
+  }
+  logicalEnd = offset + n;
+  if (logicalEnd < fileSize) {
+    logicalEnd++;
+  } else {
+    needsNewline = true;
+  }
+  return true;
+}
+
+// read the sector the logical end is in, padded out past the end
+bool CardLog::loadTail() {
+  memset(tail, CARD_LOG_PAD, sizeof(tail));
+  size_t offset = logicalEnd - logicalEnd % CARD_LOG_SECTOR_SIZE;
+  size_t n = logicalEnd - offset;
+  if (n == 0) {
+    return true;
+  }
+  return file.seek(offset) && file.read(tail, n) == n;
+}
+
+// pad the file out to at least minSize and on to the end of an extent
+bool CardLog::extend(size_t minSize) {
+  size_t target =
+      (minSize / CARD_LOG_EXTENT_SIZE + 1) * CARD_LOG_EXTENT_SIZE;
+  if (target <= fileSize) {
+    return true;
+  }
+  if (!file.seek(fileSize)) {
+    return false;
+  }
+
+  memset(block, CARD_LOG_PAD, CARD_LOG_SECTOR_SIZE);
+  while (fileSize < target) {
+    // the first write lines the rest up with sectors
+    size_t n = CARD_LOG_SECTOR_SIZE - fileSize % CARD_LOG_SECTOR_SIZE;
+    if (file.write(block, n) != n) {
+      file.flush();
+      fileSize = file.size();
+      return false;
+    }
+    fileSize += n;
+  }
+  file.flush();
+  unsynced = 0;
+  extentCount++;
+  return true;
+}
+
+bool CardLog::append(const char *line, size_t length) {
+  if (!open) {
+    return false;
+  }
+
+  size_t start = logicalEnd;
+  size_t offset = start % CARD_LOG_SECTOR_SIZE;
+  size_t prefix = needsNewline ? 1 : 0;
+  size_t used = offset + prefix + length;
+  if (length == 0 || used > sizeof(block)) {
+    return false;
+  }
+  size_t blockLength =
+      (used + CARD_LOG_SECTOR_SIZE - 1) / CARD_LOG_SECTOR_SIZE *
+      CARD_LOG_SECTOR_SIZE;
+  size_t sector = start - offset;
+  if (sector + blockLength > fileSize && !extend(sector + blockLength)) {
+    return false;
+  }
+
+  // the records already in the sector, the new one, then padding
+  memcpy(block, tail, offset);
+  if (prefix) {
+    block[offset] = '\n';
+  }
+  memcpy(block + offset + prefix, line, length);
+  memset(block + used, CARD_LOG_PAD, blockLength - used);
+
+  if (!file.seek(sector) || file.write(block, blockLength) != blockLength) {
+    // whatever made it is beyond the logical end, the next append rewrites
+    // it
+    return false;
+  }
+  if (unsynced++ == 0) {
+    unsyncedSince = millis();
+  }
+  if (unsynced >= CARD_LOG_SYNC_RECORDS) {
+    sync();
+  }
+
+  logicalEnd = sector + used;
+  needsNewline = false;
+  size_t tailStart = logicalEnd - logicalEnd % CARD_LOG_SECTOR_SIZE;
+  if (tailStart < sector + blockLength) {
+    memcpy(tail, block + (tailStart - sector), CARD_LOG_SECTOR_SIZE);
+  } else {
+    memset(tail, CARD_LOG_PAD, sizeof(tail));
+  }
+  return true;
+}
+
+bool CardLog::reserve() {
+  if (!open) {
+    return true;
+  }
+  if (unsynced > 0 && millis() - unsyncedSince >= CARD_LOG_SYNC_MS) {
+    sync();
+  }
+  if (fileSize - logicalEnd >= CARD_LOG_LOW_SPACE) {
+    return true;
+  }
+  return extend(logicalEnd + CARD_LOG_LOW_SPACE);
+}
+
+void CardLog::sync() {
+  if (open && unsynced > 0) {
+    file.flush();
+  }
+  unsynced = 0;
+}
+
+bool CardLog::clear() {
+  if (!fs) {
+    return false;
+  }
+  end();
+  File empty = fs->open(path, FILE_WRITE);
+  if (!empty) {
+    return false;
+  }
+  empty.close();
+  return begin(*fs, path);
+}
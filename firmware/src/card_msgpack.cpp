@@ -0,0 +1,290 @@
+// vim: ts=2 sw=2 et
+
+#include "card_msgpack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+MsgPackWriter::MsgPackWriter(uint8_t *buffer, size_t capacity)
+    : buffer(buffer), capacity(capacity), length(0), overflow(false) {}
+
+void MsgPackWriter::put(uint8_t byte) {
+  if (length < capacity) {
+    buffer[length++] = byte;
+  } else {
+    overflow = true;
+  }
+}
+
+void MsgPackWriter::putBytes(const uint8_t *data, size_t len) {
+  if (len > capacity - length) {
+    overflow = true;
+    return;
+  }
+  memcpy(buffer + length, data, len);
+  length += len;
+}
+
+// type byte followed by a big endian value
+void MsgPackWriter::putHeader(uint8_t type, uint32_t value, size_t bytes) {
+  put(type);
+  for (size_t i = bytes; i > 0; i--) {
+    put((value >> ((i - 1) * 8)) & 0xff);
+  }
+}
+
+void MsgPackWriter::writeNil() { put(0xc0); }
+
+void MsgPackWriter::writeUint(uint32_t value) {
+  if (value < 0x80) {
+    put(value);
+  } else if (value <= 0xff) {
+    putHeader(0xcc, value, 1);
+  } else if (value <= 0xffff) {
+    putHeader(0xcd, value, 2);
+  } else {
+    putHeader(0xce, value, 4);
+  }
+}
+
+void MsgPackWriter::writeStr(const char *str) {
+  if (!str) {
+    writeNil();
+    return;
+  }
+  size_t len = strlen(str);
+  if (len < 32) {
+    put(0xa0 | len);
+  } else if (len <= 0xff) {
+    putHeader(0xd9, len, 1);
+  } else {
+    putHeader(0xda, len, 2);
+  }
+  putBytes((const uint8_t *)str, len);
+}
+
+void MsgPackWriter::writeBin(const uint8_t *data, size_t len) {
+  if (len <= 0xff) {
+    putHeader(0xc4, len, 1);
+  } else {
+    putHeader(0xc5, len, 2);
+  }
+  putBytes(data, len);
+}
+
+void MsgPackWriter::writeArray(size_t count) {
+  if (count < 16) {
+    put(0x90 | count);
+  } else {
+    putHeader(0xdc, count, 2);
+  }
+}
+
+size_t packCardRecord(const CardRecord &record, uint8_t *out, size_t maxLen) {
+  MsgPackWriter writer(out, maxLen);
+  writer.writeArray(CARD_MSGPACK_FIELDS);
+  writer.writeStr(record.cardType);
+  writer.writeUint(record.bitLength);
+  writer.writeUint(record.facilityCode);
+  writer.writeUint(record.cardNumber);
+  if (record.hasRegionCode) {
+    writer.writeUint(record.regionCode);
+  } else {
+    writer.writeNil();
+  }
+  if (record.hasIssueLevel) {
+    writer.writeUint(record.issueLevel);
+  } else {
+    writer.writeNil();
+  }
+  writer.writeStr(record.hex);
+
+  if (record.raw) {
+    // pack the bits msb first
+    uint8_t packed[64];
+    size_t bits = strlen(record.raw);
+    if (bits > sizeof(packed) * 8) {
+      return 0;
+    }
+    memset(packed, 0, (bits + 7) / 8);
+    for (size_t i = 0; i < bits; i++) {
+      if (record.raw[i] == '1') {
+        packed[i / 8] |= 0x80 >> (i % 8);
+      }
+    }
+    writer.writeBin(packed, (bits + 7) / 8);
+  } else {
+    writer.writeNil();
+  }
+
+  writer.writeStr(record.decodeStatus);
+  if (record.hasTimestamp) {
+    writer.writeUint(record.timestamp);
+  } else {
+    writer.writeNil();
+  }
+  if (record.hasId) {
+    writer.writeUint(record.id);
+  } else {
+    writer.writeNil();
+  }
+  return writer.overflowed() ? 0 : writer.size();
+}
+
+static char *skipSpace(char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+    p++;
+  }
+  return p;
+}
+
+// unescape a json string in place, p is after the opening quote. returns
+// the position after the closing quote or nullptr
+static char *parseString(char *p, const char *&value) {
+  value = p;
+  char *out = p;
+  while (*p && *p != '"') {
+    if (*p == '\\') {
+      p++;
+      switch (*p) {
+      case 'n':
+        *out++ = '\n';
+        break;
+      case 't':
+        *out++ = '\t';
+        break;
+      case 'r':
+        *out++ = '\r';
+        break;
+      case 'b':
+        *out++ = '\b';
+        break;
+      case 'f':
+        *out++ = '\f';
+        break;
+      case 'u':
+        // nothing in a record needs more than ascii
+        if (strlen(p) < 5) {
+          return nullptr;
+        }
+        *out++ = '?';
+        p += 4;
+        break;
+      case '\0':
+        return nullptr;
+      default:
+        *out++ = *p;
+        break;
+      }
+      p++;
+    } else {
+      *out++ = *p++;
+    }
+  }
+  if (*p != '"') {
+    return nullptr;
+  }
+  *out = '\0';
+  return p + 1;
+}
+
+static char *skipNumber(char *p) {
+  while (*p && strchr("0123456789.eE+-", *p)) {
+    p++;
+  }
+  return p;
+}
+
+static void setString(CardRecord &record, const char *key, const char *value) {
+  if (strcmp(key, "card_type") == 0) {
+    record.cardType = value;
+  } else if (strcmp(key, "hex") == 0) {
+    record.hex = value;
+  } else if (strcmp(key, "raw") == 0) {
+    record.raw = value;
+  } else if (strcmp(key, "decode_status") == 0) {
+    record.decodeStatus = value;
+  }
+}
+
+static void setNumber(CardRecord &record, const char *key,
+                      unsigned long value) {
+  if (strcmp(key, "bit_length") == 0) {
+    record.bitLength = value;
+  } else if (strcmp(key, "facility_code") == 0) {
+    record.facilityCode = value;
+  } else if (strcmp(key, "card_number") == 0) {
+    record.cardNumber = value;
+  } else if (strcmp(key, "region_code") == 0) {
+    record.hasRegionCode = true;
+    record.regionCode = value;
+  } else if (strcmp(key, "issue_level") == 0) {
+    record.hasIssueLevel = true;
+    record.issueLevel = value;
+  } else if (strcmp(key, "timestamp") == 0) {
+    record.hasTimestamp = true;
+    record.timestamp = value;
+  } else if (strcmp(key, "id") == 0) {
+    record.hasId = true;
+    record.id = value;
+  }
+}
+
+bool parseCardRecord(char *line, CardRecord &record) {
+  memset(&record, 0, sizeof(record));
+  char *p = skipSpace(line);
+  if (*p++ != '{') {
+    return false;
+  }
+  p = skipSpace(p);
+  if (*p == '}') {
+    return true;
+  }
+
+  while (true) {
+    const char *key;
+    if (*p != '"' || !(p = parseString(p + 1, key))) {
+      return false;
+    }
+    p = skipSpace(p);
+    if (*p++ != ':') {
+      return false;
+    }
+    p = skipSpace(p);
+
+    if (*p == '"') {
+      const char *value;
+      if (!(p = parseString(p + 1, value))) {
+        return false;
+      }
+      setString(record, key, value);
+    } else if (*p >= '0' && *p <= '9') {
+      char *end;
+      unsigned long value = strtoul(p, &end, 10);
+      // fractions and exponents aren't unsigned numbers, the field is left
+      // out like a null
+      if (*end != '.' && *end != 'e' && *end != 'E') {
+        setNumber(record, key, value);
+      }
+      p = skipNumber(end);
+    } else if (strncmp(p, "null", 4) == 0 || strncmp(p, "true", 4) == 0) {
+      p += 4;
+    } else if (strncmp(p, "false", 5) == 0) {
+      p += 5;
+    } else if (*p == '-') {
+      p = skipNumber(p + 1);
+    } else {
+      // records are flat
+      return false;
+    }
+
+    p = skipSpace(p);
+    if (*p == '}') {
+      return true;
+    }
+    if (*p++ != ',') {
+      return false;
+    }
+    p = skipSpace(p);
+  }
+}
@@ -0,0 +1,249 @@
+// vim: ts=2 sw=2 et
+
+#include "fallback_storage.h"
+
+#include <esp_timer.h>
+#include <memory>
+#include <new>
+
+bool PartitionFlash::begin() {
+  partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)CARD_RING_SUBTYPE,
+      CARD_RING_LABEL);
+  return partition != nullptr;
+}
+
+bool PartitionFlash::read(size_t offset, void *data, size_t length) {
+  return partition &&
+         esp_partition_read(partition, offset, data, length) == ESP_OK;
+}
+
+bool PartitionFlash::write(size_t offset, const void *data, size_t length) {
+  return partition &&
+         esp_partition_write(partition, offset, data, length) == ESP_OK;
+}
+
+bool PartitionFlash::erase(size_t offset) {
+  return partition && esp_partition_erase_range(partition, offset,
+                                                FLASH_RING_SECTOR_SIZE) ==
+                          ESP_OK;
+}
+
+// reads the ring a record at a time with its mutex held, so capture can
+// append between reads
+class LockedRingReader : public RecordReader {
+public:
+  explicit LockedRingReader(FallbackStorage &storage)
+      : storage(storage), reader(storage.ring) {}
+
+  size_t read(uint8_t *buffer, size_t length) override {
+    storage.lockRing();
+    size_t n = reader.read(buffer, length);
+    storage.unlockRing();
+    return n;
+  }
+
+private:
+  FallbackStorage &storage;
+  FlashRingReader reader;
+};
+
+// the records on the sd card, then those in the ring
+class ChainedReader : public RecordReader {
+public:
+  ChainedReader(RecordReader *first, RecordReader *second)
+      : first(first), second(second) {}
+
+  size_t read(uint8_t *buffer, size_t length) override {
+    size_t n = first ? first->read(buffer, length) : 0;
+    if (n == 0) {
+      first.reset();
+      n = second ? second->read(buffer, length) : 0;
+    }
+    return n;
+  }
+
+private:
+  std::unique_ptr<RecordReader> first;
+  std::unique_ptr<RecordReader> second;
+};
+
+FallbackStorage::FallbackStorage(CardStorage &sd, FlashRing &ring)
+    : sd(sd), ring(ring), ringMutex(nullptr), sdUp(false), sdFull(false),
+      slowUntil(0) {}
+
+bool FallbackStorage::begin(RingFlash &flash) {
+  ringMutex = xSemaphoreCreateMutex();
+  return ring.begin(flash);
+}
+
+bool FallbackStorage::appendRecord(const char *line, size_t length) {
+  // records waiting in the ring go to the card first, and a slow card is
+  // only skipped when there's a ring to skip it for
+  if (sdWritable() && ring.pending() == 0 &&
+      (!ring.isOpen() || esp_timer_get_time() >= slowUntil)) {
+    int64_t start = esp_timer_get_time();
+    if (sd.appendRecord(line, length)) {
+      int64_t took = esp_timer_get_time() - start;
+      if (took > SD_SLOW_APPEND_US) {
+        slowUntil = start + took + SD_SLOW_BACKOFF_US;
+        Serial.printf("[-] SD Card: Append took %lums, storing card data in "
+                      "flash for now\n",
+                      (unsigned long)(took / 1000));
+      }
+      return true;
+    }
+    // full or removed, the firmware finds out which
+    sdFull = true;
+    Serial.println("[-] SD Card: Append failed, storing card data in flash");
+  }
+  return appendToRing(line, length);
+}
+
+bool FallbackStorage::appendToRing(const char *line, size_t length) {
+  if (!ringMutex) {
+    return false;
+  }
+  lockRing();
+  unsigned long dropped = ring.stats().dropped;
+  bool stored = ring.append(line, length);
+  dropped = ring.stats().dropped - dropped;
+  unlockRing();
+  if (dropped > 0) {
+    Serial.printf("[-] Flash: Ring full, %lu oldest records lost\n", dropped);
+  }
+  return stored;
+}
+
+bool FallbackStorage::clearRecords() {
+  // clearing only the ring would leave the card's records to come back
+  if (!sdUp) {
+    return false;
+  }
+  bool cleared = sd.clearRecords();
+  if (cleared) {
+    sdFull = false;
+  }
+  if (ringMutex && ring.isOpen()) {
+    lockRing();
+    cleared = ring.clear() && cleared;
+    unlockRing();
+  }
+  return cleared;
+}
+
+size_t FallbackStorage::recordBytes() {
+  return (sdUp ? sd.recordBytes() : 0) + ring.pendingBytes();
+}
+
+RecordReader *FallbackStorage::openRecords() {
+  return chainRing(sdUp ? sd.openRecords() : nullptr);
+}
+
+RecordReader *FallbackStorage::openRecordsSince(unsigned long since) {
+  return chainRing(sdUp ? sd.openRecordsSince(since) : nullptr);
+}
+
+RecordReader *FallbackStorage::chainRing(RecordReader *sdReader) {
+  if (sdUp && !sdReader) {
+    sdUp = false;
+    Serial.println("[-] SD Card: Failed to open card data, reading flash "
+                   "only");
+  }
+  RecordReader *ringReader = nullptr;
+  if (ringMutex && ring.isOpen()) {
+    // where the ring's records start and end is taken now, with cardDataMutex
+    // held, so none are read twice or missed when migrate() moves them
+    lockRing();
+    ringReader = new (std::nothrow) LockedRingReader(*this);
+    unlockRing();
+  }
+  RecordReader *reader = new (std::nothrow) ChainedReader(sdReader, ringReader);
+  if (!reader) {
+    delete sdReader;
+    delete ringReader;
+  }
+  return reader;
+}
+
+bool FallbackStorage::readSetting(const char *name, char *value,
+                                  size_t size) {
+  return sd.readSetting(name, value, size);
+}
+
+bool FallbackStorage::writeSetting(const char *name, const char *value) {
+  return sd.writeSetting(name, value);
+}
+
+unsigned int FallbackStorage::migrate(unsigned int count) {
+  if (!ringMutex) {
+    return 0;
+  }
+  char line[RECORD_LINE_SIZE];
+  unsigned int moved = 0;
+  while (sdWritable() && moved < count) {
+    RingPosition position;
+    lockRing();
+    size_t n = ring.oldest(position, line, sizeof(line));
+    unlockRing();
+    if (n == 0) {
+      break;
+    }
+    if (!sd.appendRecord(line, n)) {
+      sdFull = true;
+      Serial.println("[-] SD Card: Append failed while moving card data "
+                     "from flash");
+      break;
+    }
+    // a record overwritten while it was copied is on the card already
+    lockRing();
+    ring.markMigrated(position);
+    unlockRing();
+    moved++;
+  }
+  return moved;
+}
+
+void FallbackStorage::reserve() {
+  if (!ringMutex || !ring.isOpen()) {
+    return;
+  }
+  lockRing();
+  unsigned long dropped = ring.stats().dropped;
+  ring.reserve();
+  dropped = ring.stats().dropped - dropped;
+  unlockRing();
+  if (dropped > 0) {
+    Serial.printf("[-] Flash: Ring full, %lu oldest records lost\n", dropped);
+  }
+}
+
+size_t FallbackStorage::newestRingRecord(char *line, size_t size) {
+  if (!ringMutex) {
+    return 0;
+  }
+  lockRing();
+  size_t n = ring.newest(line, size);
+  unlockRing();
+  return n;
+}
+
+FallbackStatus FallbackStorage::status() {
+  FallbackStatus status;
+  status.sdAvailable = sdUp;
+  status.sdFull = isSdFull();
+  if (ringMutex) {
+    lockRing();
+  }
+  status.ringOpen = ring.isOpen();
+  status.ringCapacity = ring.capacity();
+  status.pendingRecords = ring.pending();
+  status.pendingBytes = ring.pendingBytes();
+  status.ring = ring.stats();
+  status.minEraseCount = ring.minEraseCount();
+  status.maxEraseCount = ring.maxEraseCount();
+  if (ringMutex) {
+    unlockRing();
+  }
+  return status;
+}
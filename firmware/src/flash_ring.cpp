@@ -0,0 +1,570 @@
+// vim: ts=2 sw=2 et
+
+#include "flash_ring.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// "TKR1"
+#define SECTOR_MAGIC 0x31524b54
+#define SECTOR_CHECK 0x5a5a5a5a
+#define UNWRITTEN 0xffffffff
+
+// a record length of all ones is free space
+#define FREE_LENGTH 0xffff
+// cleared once the record has been migrated
+#define RECORD_LIVE 0x01
+
+// the magic and erase count are written as soon as the sector is erased, the
+// rest when it is put to use
+struct RingSectorHeader {
+  uint32_t magic;
+  uint32_t eraseCount;
+  uint32_t sequence;
+  uint32_t floor;
+  uint32_t check;
+};
+
+struct RingRecordHeader {
+  uint16_t length;
+  uint8_t flags;
+  uint8_t reserved;
+  uint32_t check;
+};
+
+#define RECORDS_START sizeof(RingSectorHeader)
+
+enum RecordStatus { RECORD_OK, RECORD_FREE, RECORD_BROKEN, RECORD_UNREADABLE };
+
+// records are kept word aligned
+static size_t recordSize(size_t length) {
+  return (sizeof(RingRecordHeader) + length + 3) & ~(size_t)3;
+}
+
+// crc-32 of the length and the line, the flags are left out so they can
+// change
+static uint32_t recordCheck(uint16_t length, const char *line) {
+  uint32_t crc = 0xffffffff;
+  uint8_t lengthBytes[2] = {(uint8_t)(length & 0xff), (uint8_t)(length >> 8)};
+  for (size_t i = 0; i < 2u + length; i++) {
+    crc ^= i < 2 ? lengthBytes[i] : (uint8_t)line[i - 2];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+  }
+  return ~crc;
+}
+
+static bool before(const RingPosition &position, const RingPosition &end) {
+  return position.sequence < end.sequence ||
+         (position.sequence == end.sequence && position.offset < end.offset);
+}
+
+FlashRing::FlashRing()
+    : flash(nullptr), sectorCount(0), floor(0), erasedAhead(false),
+      pendingRecords(0), pendingLength(0) {
+  memset(sequences, 0, sizeof(sequences));
+  memset(eraseCounts, 0, sizeof(eraseCounts));
+  memset(liveRecords, 0, sizeof(liveRecords));
+  memset(liveLengths, 0, sizeof(liveLengths));
+  memset(&head, 0, sizeof(head));
+  memset(&tail, 0, sizeof(tail));
+  memset(&counters, 0, sizeof(counters));
+}
+
+bool FlashRing::begin(RingFlash &ringFlash) {
+  flash = &ringFlash;
+  sectorCount = ringFlash.size() / FLASH_RING_SECTOR_SIZE;
+  if (sectorCount > FLASH_RING_MAX_SECTORS) {
+    sectorCount = FLASH_RING_MAX_SECTORS;
+  }
+  // one sector is always kept free, it needs a couple more to be useful
+  if (sectorCount < 3) {
+    flash = nullptr;
+    return false;
+  }
+
+  floor = 0;
+  pendingRecords = 0;
+  pendingLength = 0;
+  erasedAhead = false;
+  uint32_t newest = 0;
+  unsigned int newestSector = 0;
+  bool formatted[FLASH_RING_MAX_SECTORS];
+  for (unsigned int s = 0; s < sectorCount; s++) {
+    RingSectorHeader header;
+    sequences[s] = 0;
+    eraseCounts[s] = 0;
+    liveRecords[s] = 0;
+    liveLengths[s] = 0;
+    formatted[s] = false;
+    if (!flash->read(sectorOffset(s), &header, sizeof(header))) {
+      flash = nullptr;
+      return false;
+    }
+    if (header.magic != SECTOR_MAGIC) {
+      continue;
+    }
+    eraseCounts[s] = header.eraseCount;
+    formatted[s] = true;
+    if (header.sequence == UNWRITTEN || header.sequence == 0 ||
+        header.check != (header.sequence ^ header.floor ^ SECTOR_CHECK)) {
+      continue;
+    }
+    sequences[s] = header.sequence;
+    if (header.sequence > newest) {
+      newest = header.sequence;
+      newestSector = s;
+      floor = header.floor;
+    }
+  }
+
+  // a sector whose erase was cut short lost its count, sectors are erased in
+  // turn so it's close to the lowest of the others
+  uint32_t lowest = UNWRITTEN;
+  for (unsigned int s = 0; s < sectorCount; s++) {
+    if (formatted[s] && eraseCounts[s] < lowest) {
+      lowest = eraseCounts[s];
+    }
+  }
+  for (unsigned int s = 0; s < sectorCount; s++) {
+    if (!formatted[s] && lowest != UNWRITTEN) {
+      eraseCounts[s] = lowest;
+    }
+  }
+
+  if (newest == 0) {
+    // nothing stored yet, start at the first sector
+    head.sector = sectorCount - 1;
+    head.sequence = 0;
+    head.offset = FLASH_RING_SECTOR_SIZE;
+    tail = head;
+    if (!startSector()) {
+      flash = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  // only the sectors written in turn up to the newest hold records, anything
+  // else is left over from before a clear or a cut short erase
+  bool chained = true;
+  for (unsigned int k = 0; k < sectorCount; k++) {
+    unsigned int s = (newestSector + sectorCount - k) % sectorCount;
+    if (!chained || sequences[s] != newest - k) {
+      chained = false;
+      sequences[s] = 0;
+    }
+  }
+
+  head.sector = newestSector;
+  head.sequence = newest;
+  head.offset = RECORDS_START;
+  bool foundTail = false;
+  bool torn = false;
+  // oldest first, so the tail is the first record still pending
+  for (unsigned int k = sectorCount; k-- > 0;) {
+    unsigned int s = (newestSector + sectorCount - k) % sectorCount;
+    if (sequences[s] == 0 || sequences[s] < floor) {
+      continue;
+    }
+    size_t end;
+    RingPosition firstLive;
+    bool clean = scanSector(s, end, firstLive);
+    pendingRecords += liveRecords[s];
+    pendingLength += liveLengths[s];
+    if (liveRecords[s] > 0 && !foundTail) {
+      tail = firstLive;
+      foundTail = true;
+    }
+    if (s == newestSector) {
+      head.offset = end;
+      torn = !clean;
+    }
+  }
+  if (!foundTail) {
+    tail = head;
+  }
+
+  // the sector after head may already have been erased ahead of time
+  unsigned int next = (head.sector + 1) % sectorCount;
+  RingSectorHeader header;
+  if (sequences[next] == 0 &&
+      flash->read(sectorOffset(next), &header, sizeof(header)) &&
+      header.magic == SECTOR_MAGIC && header.sequence == UNWRITTEN &&
+      header.floor == UNWRITTEN && header.check == UNWRITTEN) {
+    erasedAhead = true;
+    for (size_t offset = RECORDS_START;
+         erasedAhead && offset < FLASH_RING_SECTOR_SIZE;
+         offset += sizeof(scratch)) {
+      size_t n = FLASH_RING_SECTOR_SIZE - offset;
+      if (n > sizeof(scratch)) {
+        n = sizeof(scratch);
+      }
+      if (!flash->read(sectorOffset(next) + offset, scratch, n)) {
+        erasedAhead = false;
+      }
+      for (size_t i = 0; erasedAhead && i < n; i++) {
+        erasedAhead = (uint8_t)scratch[i] == 0xff;
+      }
+    }
+  }
+
+  // a record cut short by a power cut ends its sector, appends carry on in
+  // the next one
+  if (torn && !startSector()) {
+    flash = nullptr;
+    return false;
+  }
+  return true;
+}
+
+// read the record at offset into line
+int FlashRing::readRecord(unsigned int sector, size_t offset,
+                          RingRecordHeader &header, char *line, size_t size) {
+  if (offset + sizeof(RingRecordHeader) > FLASH_RING_SECTOR_SIZE) {
+    return RECORD_BROKEN;
+  }
+  if (!flash->read(sectorOffset(sector) + offset, &header, sizeof(header))) {
+    return RECORD_UNREADABLE;
+  }
+  if (header.length == FREE_LENGTH) {
+    // a header only partly written isn't free space
+    return header.flags == 0xff && header.reserved == 0xff &&
+                   header.check == UNWRITTEN
+               ? RECORD_FREE
+               : RECORD_BROKEN;
+  }
+  if (header.length == 0 || header.length > size ||
+      header.length > RECORD_LINE_SIZE ||
+      offset + recordSize(header.length) > FLASH_RING_SECTOR_SIZE) {
+    return RECORD_BROKEN;
+  }
+  if (!flash->read(sectorOffset(sector) + offset + sizeof(header), line,
+                   header.length)) {
+    return RECORD_UNREADABLE;
+  }
+  if (recordCheck(header.length, line) != header.check) {
+    return RECORD_BROKEN;
+  }
+  return RECORD_OK;
+}
+
+// count the records of a sector that are still pending and find where it
+// ends. false if it ends in a broken record
+bool FlashRing::scanSector(unsigned int sector, size_t &end,
+                           RingPosition &firstLive) {
+  size_t offset = RECORDS_START;
+  bool clean = true;
+  while (true) {
+    RingRecordHeader header;
+    int status = readRecord(sector, offset, header, scratch, sizeof(scratch));
+    if (status != RECORD_OK) {
+      // the free space at the end of a full sector isn't a broken record
+      clean = status == RECORD_FREE ||
+              offset + sizeof(RingRecordHeader) > FLASH_RING_SECTOR_SIZE;
+      break;
+    }
+    if (header.flags & RECORD_LIVE) {
+      if (liveRecords[sector] == 0) {
+        firstLive.sector = sector;
+        firstLive.sequence = sequences[sector];
+        firstLive.offset = offset;
+      }
+      liveRecords[sector]++;
+      liveLengths[sector] += header.length;
+    }
+    offset += recordSize(header.length);
+  }
+  end = offset;
+  return clean;
+}
+
+// read the record at position, moving on to the next sector past the end of
+// one. false once position reaches end
+bool FlashRing::load(RingPosition &position, const RingPosition &end,
+                     RingRecordHeader &header, char *line, size_t size) {
+  while (before(position, end)) {
+    // sectors that have been reused or cleared since hold nothing for us
+    if (position.sequence != 0 &&
+        sequences[position.sector] == position.sequence &&
+        position.sequence >= floor) {
+      int status =
+          readRecord(position.sector, position.offset, header, line, size);
+      if (status == RECORD_OK) {
+        return true;
+      }
+      if (status == RECORD_UNREADABLE) {
+        return false;
+      }
+    }
+    // free space or a broken record ends the sector
+    position.sector = (position.sector + 1) % sectorCount;
+    position.sequence++;
+    position.offset = RECORDS_START;
+  }
+  return false;
+}
+
+// move position on to the next record that hasn't been migrated, head if
+// there are none
+void FlashRing::seekLive(RingPosition &position) {
+  RingRecordHeader header;
+  while (load(position, head, header, scratch, sizeof(scratch))) {
+    if (header.flags & RECORD_LIVE) {
+      return;
+    }
+    position.offset += recordSize(header.length);
+  }
+  position = head;
+}
+
+// erase a sector and leave its header ready to be put to use
+bool FlashRing::eraseSector(unsigned int sector) {
+  // the oldest sector may still hold records that haven't been migrated
+  if (sequences[sector] != 0 && liveRecords[sector] > 0) {
+    counters.dropped += liveRecords[sector];
+    pendingRecords -= liveRecords[sector];
+    pendingLength -= liveLengths[sector];
+  }
+  liveRecords[sector] = 0;
+  liveLengths[sector] = 0;
+  bool hadTail = sequences[sector] != 0 && tail.sector == sector &&
+                 tail.sequence == sequences[sector];
+  sequences[sector] = 0;
+  if (hadTail) {
+    seekLive(tail);
+  }
+
+  if (!flash->erase(sectorOffset(sector))) {
+    return false;
+  }
+  eraseCounts[sector]++;
+  // the count before the magic, so a sector with its magic has its count
+  uint32_t magic = SECTOR_MAGIC;
+  return flash->write(sectorOffset(sector) +
+                          offsetof(RingSectorHeader, eraseCount),
+                      &eraseCounts[sector], sizeof(eraseCounts[sector])) &&
+         flash->write(sectorOffset(sector), &magic, sizeof(magic));
+}
+
+// move head on to the next sector
+bool FlashRing::startSector() {
+  unsigned int next = (head.sector + 1) % sectorCount;
+  if (!erasedAhead && !eraseSector(next)) {
+    return false;
+  }
+  erasedAhead = false;
+
+  RingSectorHeader header;
+  header.sequence = head.sequence + 1;
+  header.floor = floor;
+  header.check = header.sequence ^ header.floor ^ SECTOR_CHECK;
+  if (!flash->write(sectorOffset(next) + offsetof(RingSectorHeader, sequence),
+                    &header.sequence,
+                    sizeof(header) - offsetof(RingSectorHeader, sequence))) {
+    return false;
+  }
+  sequences[next] = header.sequence;
+  head.sector = next;
+  head.sequence = header.sequence;
+  head.offset = RECORDS_START;
+  if (pendingRecords == 0) {
+    tail = head;
+  }
+  return true;
+}
+
+bool FlashRing::append(const char *line, size_t length) {
+  if (!flash || length == 0 || length > RECORD_LINE_SIZE) {
+    return false;
+  }
+  size_t size = recordSize(length);
+  if (head.offset + size > FLASH_RING_SECTOR_SIZE) {
+    if (!erasedAhead) {
+      counters.inlineErases++;
+    }
+    if (!startSector()) {
+      return false;
+    }
+  }
+
+  uint8_t record[sizeof(RingRecordHeader) + RECORD_LINE_SIZE + 3];
+  RingRecordHeader header;
+  header.length = length;
+  header.flags = 0xff;
+  header.reserved = 0xff;
+  header.check = recordCheck(length, line);
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), line, length);
+  memset(record + sizeof(header) + length, 0xff,
+         size - sizeof(header) - length);
+  if (!flash->write(sectorOffset(head.sector) + head.offset, record, size)) {
+    // whatever made it to flash is broken, carry on in the next sector
+    head.offset = FLASH_RING_SECTOR_SIZE;
+    return false;
+  }
+
+  if (pendingRecords == 0) {
+    tail = head;
+  }
+  head.offset += size;
+  liveRecords[head.sector]++;
+  liveLengths[head.sector] += length;
+  pendingRecords++;
+  pendingLength += length;
+  counters.appended++;
+  return true;
+}
+
+bool FlashRing::reserve() {
+  if (!flash) {
+    return false;
+  }
+  if (erasedAhead) {
+    return true;
+  }
+  if (!eraseSector((head.sector + 1) % sectorCount)) {
+    return false;
+  }
+  erasedAhead = true;
+  return true;
+}
+
+bool FlashRing::clear() {
+  if (!flash) {
+    return false;
+  }
+  // sectors numbered below the next one are ignored from now on
+  floor = head.sequence + 1;
+  memset(liveRecords, 0, sizeof(liveRecords));
+  memset(liveLengths, 0, sizeof(liveLengths));
+  pendingRecords = 0;
+  pendingLength = 0;
+  return startSector();
+}
+
+size_t FlashRing::oldest(RingPosition &position, char *line, size_t size) {
+  if (!flash || pendingRecords == 0) {
+    return 0;
+  }
+  RingRecordHeader header;
+  if (!load(tail, head, header, line, size)) {
+    return 0;
+  }
+  position = tail;
+  return header.length;
+}
+
+bool FlashRing::markMigrated(const RingPosition &position) {
+  if (!flash || pendingRecords == 0 || position.sector != tail.sector ||
+      position.sequence != tail.sequence || position.offset != tail.offset) {
+    return false;
+  }
+  RingRecordHeader header;
+  if (!load(tail, head, header, scratch, sizeof(scratch))) {
+    return false;
+  }
+  uint8_t flags = header.flags & ~RECORD_LIVE;
+  if (!flash->write(sectorOffset(tail.sector) + tail.offset +
+                        offsetof(RingRecordHeader, flags),
+                    &flags, 1)) {
+    return false;
+  }
+  liveRecords[tail.sector]--;
+  liveLengths[tail.sector] -= header.length;
+  pendingRecords--;
+  pendingLength -= header.length;
+  counters.migrated++;
+  tail.offset += recordSize(header.length);
+  seekLive(tail);
+  return true;
+}
+
+size_t FlashRing::newest(char *line, size_t size) {
+  if (!flash) {
+    return 0;
+  }
+  // the newest record is in the head sector, or the one before if head was
+  // only just started
+  RingPosition position;
+  position.sector = (head.sector + sectorCount - 1) % sectorCount;
+  position.sequence = head.sequence - 1;
+  position.offset = RECORDS_START;
+  size_t length = 0;
+  RingRecordHeader header;
+  while (load(position, head, header, scratch, sizeof(scratch))) {
+    if (header.length <= size) {
+      memcpy(line, scratch, header.length);
+      length = header.length;
+    }
+    position.offset += recordSize(header.length);
+  }
+  return length;
+}
+
+size_t FlashRing::next(RingPosition &position, const RingPosition &end,
+                       char *line, size_t size) {
+  if (!flash) {
+    return 0;
+  }
+  RingRecordHeader header;
+  if (!load(position, end, header, line, size)) {
+    return 0;
+  }
+  position.offset += recordSize(header.length);
+  return header.length;
+}
+
+size_t FlashRing::capacity() const {
+  if (sectorCount == 0) {
+    return 0;
+  }
+  // one sector is kept erased
+  return (sectorCount - 1) * (FLASH_RING_SECTOR_SIZE - RECORDS_START);
+}
+
+uint32_t FlashRing::minEraseCount() const {
+  uint32_t count = UNWRITTEN;
+  for (unsigned int s = 0; s < sectorCount; s++) {
+    if (eraseCounts[s] < count) {
+      count = eraseCounts[s];
+    }
+  }
+  return sectorCount > 0 ? count : 0;
+}
+
+uint32_t FlashRing::maxEraseCount() const {
+  uint32_t count = 0;
+  for (unsigned int s = 0; s < sectorCount; s++) {
+    if (eraseCounts[s] > count) {
+      count = eraseCounts[s];
+    }
+  }
+  return count;
+}
+
+FlashRingReader::FlashRingReader(FlashRing &ring)
+    : ring(ring), position(ring.begin()), end(ring.end()), lineLength(0),
+      lineOffset(0) {}
+
+size_t FlashRingReader::read(uint8_t *buffer, size_t length) {
+  size_t written = 0;
+  while (written < length) {
+    if (lineOffset == lineLength) {
+      lineLength = ring.next(position, end, line, sizeof(line));
+      lineOffset = 0;
+      if (lineLength == 0) {
+        break;
+      }
+    }
+    size_t n = lineLength - lineOffset;
+    if (n > length - written) {
+      n = length - written;
+    }
+    memcpy(buffer + written, line + lineOffset, n);
+    lineOffset += n;
+    written += n;
+  }
+  return written;
+}
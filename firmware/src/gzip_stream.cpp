@@ -0,0 +1,301 @@
+// vim: ts=2 sw=2 et
+
+#include "gzip_stream.h"
+
+#include <string.h>
+
+// deflate length codes 257..285 (base length and extra bits)
+static const uint16_t lengthBase[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                        1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                        4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+// deflate distance codes 0..29 (base distance and extra bits)
+static const uint16_t distanceBase[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                          4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                          9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// crc32 (ieee 802.3) lookup table, one nibble at a time to keep it small
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+static uint32_t updateCrc(uint32_t crc, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+    crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+  }
+  return crc;
+}
+
+GzipStream::GzipStream() { begin(); }
+
+void GzipStream::begin() {
+  memset(head, 0, sizeof(head));
+  memset(prev, 0, sizeof(prev));
+  fill = 0;
+  strStart = 0;
+  outHead = 0;
+  outTail = 0;
+  bitBuffer = 0;
+  bitCount = 0;
+  crc = 0xFFFFFFFF;
+  inBytes = 0;
+  outBytes = 0;
+  finished = false;
+  trailerWritten = false;
+
+  // gzip member header: magic, deflate, no flags, no mtime, unknown os
+  const uint8_t header[10] = {0x1F, 0x8B, 0x08, 0x00, 0x00,
+                              0x00, 0x00, 0x00, 0x00, 0xFF};
+  for (size_t i = 0; i < sizeof(header); i++) {
+    putByte(header[i]);
+  }
+
+  // a single fixed huffman block holds the whole stream, it is closed by an
+  // empty final block in read() once finish() has been called
+  putBits(0, 1);
+  putBits(1, 2);
+}
+
+size_t GzipStream::write(const uint8_t *data, size_t len) {
+  if (finished) {
+    return 0;
+  }
+
+  size_t consumed = 0;
+  while (consumed < len) {
+    if (fill == 2 * kWindowSize) {
+      // catch up on input left over from a full output buffer first
+      if (!deflate(false)) {
+        break;
+      }
+      slideWindow();
+    }
+
+    size_t n = len - consumed;
+    if (n > 2 * kWindowSize - fill) {
+      n = 2 * kWindowSize - fill;
+    }
+    memcpy(window + fill, data + consumed, n);
+    crc = updateCrc(crc, data + consumed, n);
+    fill += n;
+    consumed += n;
+    inBytes += n;
+
+    if (!deflate(false)) {
+      break;
+    }
+  }
+  return consumed;
+}
+
+void GzipStream::finish() { finished = true; }
+
+size_t GzipStream::read(uint8_t *dst, size_t maxLen) {
+  if (finished && !trailerWritten) {
+    if (deflate(true) && outFree() >= 16) {
+      // end of block, then an empty final block
+      putCode(0, 7);
+      putBits(1, 1);
+      putBits(1, 2);
+      putCode(0, 7);
+      alignToByte();
+
+      uint32_t sum = ~crc;
+      for (int i = 0; i < 4; i++) {
+        putByte((sum >> (i * 8)) & 0xFF);
+      }
+      for (int i = 0; i < 4; i++) {
+        putByte((inBytes >> (i * 8)) & 0xFF);
+      }
+      trailerWritten = true;
+    }
+  }
+
+  size_t n = available();
+  if (n > maxLen) {
+    n = maxLen;
+  }
+  memcpy(dst, out + outHead, n);
+  outHead += n;
+
+  if (outHead == outTail) {
+    outHead = 0;
+    outTail = 0;
+  } else if (outHead > 0) {
+    memmove(out, out + outHead, outTail - outHead);
+    outTail -= outHead;
+    outHead = 0;
+  }
+  return n;
+}
+
+// compress buffered input, keeping enough lookahead for a full length match
+// unless flushing. returns false when the output buffer is full.
+bool GzipStream::deflate(bool flush) {
+  while (true) {
+    size_t lookahead = fill - strStart;
+    if (lookahead == 0 || (!flush && lookahead < kMaxMatch)) {
+      return true;
+    }
+    // the longest symbol (length + distance) needs 31 bits
+    if (outFree() < 8) {
+      return false;
+    }
+
+    size_t matchPos = 0;
+    size_t length = longestMatch(matchPos);
+    if (length >= kMinMatch) {
+      putMatch(length, strStart - matchPos);
+      for (size_t i = 0; i < length; i++) {
+        insertHash(strStart + i);
+      }
+      strStart += length;
+    } else {
+      putLiteral(window[strStart]);
+      insertHash(strStart);
+      strStart++;
+    }
+  }
+}
+
+unsigned int GzipStream::hashAt(size_t pos) const {
+  uint32_t v = (uint32_t)window[pos] << 16 | (uint32_t)window[pos + 1] << 8 |
+               window[pos + 2];
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+void GzipStream::insertHash(size_t pos) {
+  if (pos + kMinMatch > fill) {
+    return;
+  }
+  unsigned int h = hashAt(pos);
+  prev[pos & (kWindowSize - 1)] = head[h];
+  head[h] = pos + 1;
+}
+
+size_t GzipStream::longestMatch(size_t &matchPos) {
+  size_t lookahead = fill - strStart;
+  if (lookahead < kMinMatch) {
+    return 0;
+  }
+  size_t maxLength = kMaxMatch;
+  if (lookahead < maxLength) {
+    maxLength = lookahead;
+  }
+
+  size_t best = 0;
+  unsigned int chain = kMaxChain;
+  uint16_t candidate = head[hashAt(strStart)];
+  const uint8_t *scan = window + strStart;
+
+  while (candidate != 0 && chain-- > 0) {
+    size_t pos = candidate - 1;
+    if (strStart - pos >= kWindowSize) {
+      break;
+    }
+
+    const uint8_t *match = window + pos;
+    size_t length = 0;
+    while (length < maxLength && match[length] == scan[length]) {
+      length++;
+    }
+    if (length > best) {
+      best = length;
+      matchPos = pos;
+      if (length == maxLength) {
+        break;
+      }
+    }
+
+    uint16_t next = prev[pos & (kWindowSize - 1)];
+    if (next == 0 || next - 1u >= pos) {
+      break;
+    }
+    candidate = next;
+  }
+  return best;
+}
+
+void GzipStream::slideWindow() {
+  memmove(window, window + kWindowSize, kWindowSize);
+  fill -= kWindowSize;
+  strStart -= kWindowSize;
+
+  for (size_t i = 0; i < kHashSize; i++) {
+    head[i] = head[i] > kWindowSize ? head[i] - kWindowSize : 0;
+  }
+  for (size_t i = 0; i < kWindowSize; i++) {
+    prev[i] = prev[i] > kWindowSize ? prev[i] - kWindowSize : 0;
+  }
+}
+
+void GzipStream::putBits(uint32_t value, unsigned int count) {
+  bitBuffer |= value << bitCount;
+  bitCount += count;
+  while (bitCount >= 8) {
+    putByte(bitBuffer & 0xFF);
+    bitBuffer >>= 8;
+    bitCount -= 8;
+  }
+}
+
+// huffman codes are packed starting with the most significant bit
+void GzipStream::putCode(uint32_t code, unsigned int count) {
+  uint32_t reversed = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  putBits(reversed, count);
+}
+
+void GzipStream::putLiteral(uint8_t c) {
+  if (c < 144) {
+    putCode(0x30 + c, 8);
+  } else {
+    putCode(0x190 + (c - 144), 9);
+  }
+}
+
+void GzipStream::putMatch(size_t length, size_t distance) {
+  int code = 28;
+  while (lengthBase[code] > length) {
+    code--;
+  }
+  unsigned int symbol = 257 + code;
+  if (symbol < 280) {
+    putCode(symbol - 256, 7);
+  } else {
+    putCode(0xC0 + (symbol - 280), 8);
+  }
+  putBits(length - lengthBase[code], lengthExtra[code]);
+
+  code = 29;
+  while (distanceBase[code] > distance) {
+    code--;
+  }
+  putCode(code, 5);
+  putBits(distance - distanceBase[code], distanceExtra[code]);
+}
+
+void GzipStream::putByte(uint8_t b) {
+  out[outTail++] = b;
+  outBytes++;
+}
+
+void GzipStream::alignToByte() {
+  if (bitCount > 0) {
+    putByte(bitBuffer & 0xFF);
+  }
+  bitBuffer = 0;
+  bitCount = 0;
+}
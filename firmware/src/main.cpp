@@ -2,27 +2,47 @@
 
 #include "ArduinoJson.h"
 #include "AsyncJson.h"
+#include "card_clone.h"
+#include "card_decoder.h"
+#include "card_export.h"
+#include "card_log.h"
+#include "fallback_storage.h"
+#include "request_budget.h"
+#include "sd_storage.h"
+#include "web_api.h"
+#include "wiegand_capture.h"
 #include <Arduino.h>
 #include <ESPAsyncWebServer.h>
 #include <LittleFS.h>
 #include <SD.h>
 #include <SPI.h>
+#include <Ticker.h>
 #include <WiFi.h>
+#include <algorithm>
+#include <driver/gpio.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <hal/gpio_ll.h>
+#include <memory>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+// shown and changed through the web api, including the wifi config from the
+// html form
+DeviceSettings settings;
 
-// wifi config
-// variables to save values from HTML form
-String ssid;
-String password;
-String channel;
-String hidessid;
-
-// file paths on SD card to save wifi values permanently
-const char *ssidPath = "/ssid.txt";
-const char *passwordPath = "/password.txt";
-const char *channelPath = "/channel.txt";
-const char *hidessidPath = "/hidessid.txt";
 const char *jsoncarddataPath = "/cards.jsonl";
 
+// wifi config used until one is saved, or without an sd card
+const char *defaultSsid = "Tusk";
+const char *defaultPassword = "changeme";
+const char *defaultChannel = "1";
+const char *defaultHidessid = "0";
+
 IPAddress local_ip(192, 168, 100, 1);
 IPAddress gateway(192, 168, 100, 1);
 IPAddress subnet(255, 255, 255, 0);
@@ -30,9 +50,20 @@ IPAddress subnet(255, 255, 255, 0);
 // define CS pin for the SD card module
 const int sd_cs = 5;
 
-// general device settings
-bool isCapturing = true;
-String version = "0.1";
+// spi clock for the sd card. the card is mounted at SD_SPI_FREQUENCY, then
+// remounted at the clock saved in sdclock.txt (in kHz) if there is one
+#ifndef SD_SPI_FREQUENCY
+#define SD_SPI_FREQUENCY 4000000
+#endif
+// the card log, exports, the re-decode, settings files and the benchmark
+// can all have a file open
+#define SD_MAX_OPEN_FILES 8
+
+// the device has no rtc, the clock is set by the web interface. anything
+// before this is uptime rather than wall clock time
+#define MIN_VALID_EPOCH 1600000000
+
+bool isClockSet() { return time(nullptr) > MIN_VALID_EPOCH; }
 
 // read file from SD Card
 String readSDFileLF(const char *path) {
@@ -66,65 +97,60 @@ void writeSDFile(const char *path, const char *message) {
   file.close();
 }
 
+// remount the sd card at the clock saved in sdclock.txt, falling back to
+// the default if the card doesn't work at it
+void setupSdClock() {
+  if (!SD.exists(sdClockPath)) {
+    return;
+  }
+  String text = readSDFileLF(sdClockPath);
+  text.trim();
+  char *end;
+  long khz = strtol(text.c_str(), &end, 10);
+  if (end == text.c_str() || *end != '\0') {
+    Serial.println("[-] SD Card: Ignoring unreadable SPI clock setting");
+    return;
+  }
+  khz = std::max<long>(SD_SPI_MIN_KHZ, std::min<long>(khz, SD_SPI_MAX_KHZ));
+  uint32_t frequency = khz * 1000;
+  if (frequency == settings.sdSpiFrequency) {
+    return;
+  }
+  SD.end();
+  if (SD.begin(sd_cs, SPI, frequency, "/sd", SD_MAX_OPEN_FILES)) {
+    settings.sdSpiFrequency = frequency;
+    Serial.printf("[+] SD Card: SPI clock set to %ukHz\n", frequency / 1000);
+    return;
+  }
+  Serial.printf("[-] SD Card: Failed at %ukHz, using the default clock\n",
+                frequency / 1000);
+  SD.begin(sd_cs, SPI, settings.sdSpiFrequency, "/sd", SD_MAX_OPEN_FILES);
+}
+
 // card reader config and variables
 
-// max number of bits
-#define MAX_BITS 100
-// time to wait for another weigand pulse
-#define WEIGAND_WAIT_TIME 3000
+// how long loop() sleeps without a card before re-checking its settings
+#define IDLE_TIMEOUT 1000
+
+// assembles frames from the data line interrupts
+WiegandCapture capture;
+portMUX_TYPE captureMux = portMUX_INITIALIZER_UNLOCKED;
+// woken by the interrupts when a frame starts
+TaskHandle_t loopTaskHandle = NULL;
 
-// stores all of the data bits
-volatile unsigned char databits[MAX_BITS];
-volatile unsigned int bitCount = 0;
+// the frame being processed
+unsigned char databits[MAX_BITS];
+unsigned int bitCount = 0;
 // stores the last written card's data bits
 unsigned char lastWrittenDatabits[MAX_BITS];
 unsigned int lastWrittenBitCount = 0;
 
-// goes low when data is currently being captured
-volatile unsigned char flagDone;
+// the card currently being processed
+CardData currentCard;
 
-// countdown until we assume there are no more bits
-volatile unsigned int weigandCounter;
-
-// card type
-enum CardType {
-  HID,
-  GALLAGHER,
-  UNKNOWN,
-};
-CardType cardType = UNKNOWN;
-
-const char* cardTypeToString(CardType cardType) {
-  switch (cardType) {
-    case HID:
-      return "hid";
-    case GALLAGHER:
-      return "gallagher";
-    case UNKNOWN:
-      return "unknown";
-    default:
-      return "Invalid Card Type";
-  }
-}
-
-// decoded facility code
-unsigned long facilityCode = 0;
-// decoded card code
-unsigned long cardNumber = 0;
-// decoded issuer level
-unsigned long regionCode = 0;
-// decoded card code
-unsigned long issueLevel = 0;
-// hex data string
-String hexCardData;
-// raw data string
-String rawCardData;
-
-// breaking up card value into 2 chunks to create 10 char HEX value
-volatile unsigned long bitHolder1 = 0;
-volatile unsigned long bitHolder2 = 0;
-unsigned long cardChunk1 = 0;
-unsigned long cardChunk2 = 0;
+// serialises access to cards.jsonl between capture, the web server and the
+// re-decode job
+SemaphoreHandle_t cardDataMutex;
 
 // Define reader input pins
 // card reader DATA0
@@ -133,451 +159,1039 @@ unsigned long cardChunk2 = 0;
 #define DATA1 33
 
 // process interupts
-// interrupt that happens when INT0 goes low (0 bit)
-void ISR_INT0() {
-  bitCount++;
-  flagDone = 0;
-
-  if (bitCount < 23) {
-    bitHolder1 = bitHolder1 << 1;
-  } else {
-    bitHolder2 = bitHolder2 << 1;
+// the data line interrupts are level triggered and flipped between low and
+// high on every change, which both catches every edge and lets the same
+// setting wake the cpu from light sleep. they are registered as iram
+// interrupts so they keep running while flash is written or erased (the
+// flash ring) or read (littlefs), which means everything they call has to
+// be in iram too: the gpio registers are used directly and time comes from
+// esp_timer_get_time(), which is the clock micros() reads
+void IRAM_ATTR handleDataEdge(unsigned char line, uint8_t pin,
+                              uint8_t otherPin) {
+  bool lineLow = gpio_ll_get_level(&GPIO, (gpio_num_t)pin) == 0;
+  gpio_ll_set_intr_type(&GPIO, (gpio_num_t)pin,
+                        lineLow ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+  bool otherLow = gpio_ll_get_level(&GPIO, (gpio_num_t)otherPin) == 0;
+
+  portENTER_CRITICAL_ISR(&captureMux);
+  bool firstBit = capture.onEdge(line, lineLow, otherLow,
+                                 (uint32_t)esp_timer_get_time());
+  portEXIT_CRITICAL_ISR(&captureMux);
+
+  if (firstBit) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(loopTaskHandle, &woken);
+    if (woken) {
+      portYIELD_FROM_ISR();
+    }
   }
-  weigandCounter = WEIGAND_WAIT_TIME;
 }
 
-// interrupt that happens when INT1 goes low (1 bit)
-void ISR_INT1() {
-  if (bitCount < MAX_BITS) {
-    databits[bitCount] = 1;
-    bitCount++;
+// interrupt that happens when INT0 changes (0 bit)
+void IRAM_ATTR ISR_INT0(void *arg) { handleDataEdge(0, DATA0, DATA1); }
+
+// interrupt that happens when INT1 changes (1 bit)
+void IRAM_ATTR ISR_INT1(void *arg) { handleDataEdge(1, DATA1, DATA0); }
+
+// attachInterrupt() dispatches through code in flash, so the handlers are
+// added to an iram gpio isr service directly
+void attachDataInterrupt(uint8_t pin, gpio_isr_t handler) {
+  gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_LOW_LEVEL);
+  gpio_isr_handler_add((gpio_num_t)pin, handler, NULL);
+  gpio_intr_enable((gpio_num_t)pin);
+}
+
+/* #####----- Power saving -----##### */
+// cpu frequency scaling and automatic light sleep while idle. the soft-ap
+// stays up, wifi holds the clock up while it needs to. light sleep needs
+// power management and tickless idle in the esp-idf build
+
+// main loop idle accounting
+int64_t loopStatsStart = 0;
+int64_t loopIdleTime = 0;
+int64_t wakeupWindowStart = 0;
+unsigned long wakeupWindowCount = 0;
+unsigned long wakeupsPerMinute = 0;
+
+void setPowerSave(bool enable) {
+  settings.powerSave = enable;
+  settings.lightSleep = false;
+  bool scaling = false;
+
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pm;
+  pm.max_freq_mhz = 240;
+  pm.min_freq_mhz = enable ? 80 : 240;
+  pm.light_sleep_enable = enable;
+  if (esp_pm_configure(&pm) == ESP_OK) {
+    scaling = true;
+    settings.lightSleep = enable;
+  } else {
+    pm.light_sleep_enable = false;
+    scaling = esp_pm_configure(&pm) == ESP_OK;
+  }
+#endif
+  if (!scaling) {
+    // no dynamic scaling, run at the lowest clock wifi works with instead
+    setCpuFrequencyMhz(enable ? 80 : 240);
   }
-  flagDone = 0;
 
-  if (bitCount < 23) {
-    bitHolder1 = bitHolder1 << 1;
-    bitHolder1 |= 1;
+  capture.wakeCompensation = settings.lightSleep;
+  if (settings.lightSleep) {
+    gpio_wakeup_enable((gpio_num_t)DATA0, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)DATA1, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
   } else {
-    bitHolder2 = bitHolder2 << 1;
-    bitHolder2 |= 1;
+    gpio_wakeup_disable((gpio_num_t)DATA0);
+    gpio_wakeup_disable((gpio_num_t)DATA1);
   }
 
-  weigandCounter = WEIGAND_WAIT_TIME;
+  Serial.printf("[+] Tusk: Power saving %s (cpu %uMHz, light sleep %s)\n",
+                enable ? "on" : "off", getCpuFrequencyMhz(),
+                settings.lightSleep ? "on" : "off");
 }
 
-// Print bits to serial (for debugging only)
-void printCardData() {
-  // ranges for "valid" bitCount are a bit larger for debugging
-  if (bitCount > 20 && bitCount < 120) { // ignore data caused by noise
-    Serial.print("[*] Bit length: ");
-    Serial.println(bitCount);
-    Serial.print("[*] Facility code: ");
-    Serial.println(facilityCode);
-    Serial.print("[*] Card number: ");
-    Serial.println(cardNumber);
-    if (cardType == GALLAGHER) {
-      Serial.print("[*] Region Code: ");
-      Serial.println(regionCode);
-      Serial.print("[*] Issue Level: ");
-      Serial.println(issueLevel);
-    }
-    Serial.print("[*] Hex: ");
-    Serial.println(hexCardData);
-    Serial.print("[*] Raw: ");
-    Serial.println(rawCardData);
+// block loop() until the interrupts report a new frame or the timeout
+// passes, counting the time as idle
+void idleWait(TickType_t timeout) {
+  int64_t start = esp_timer_get_time();
+  ulTaskNotifyTake(pdTRUE, timeout);
+  int64_t now = esp_timer_get_time();
+  loopIdleTime += now - start;
+
+  wakeupWindowCount++;
+  if (now - wakeupWindowStart >= 60000000) {
+    wakeupsPerMinute = wakeupWindowCount * 60000000LL /
+                       (now - wakeupWindowStart);
+    wakeupWindowStart = now;
+    wakeupWindowCount = 0;
   }
 }
 
-// Process hid cards
-unsigned long decodeHIDFacilityCode(unsigned int start, unsigned int end) {
-  unsigned long HIDFacilityCode = 0;
-  for (unsigned int i = start; i < end; i++) {
-    HIDFacilityCode = (HIDFacilityCode << 1) | databits[i];
+// Print bits to serial (for debugging only)
+void printCardData(const CardData &card) {
+  char raw[MAX_BITS + 1];
+  formatRawBits(card, raw, sizeof(raw));
+
+  Serial.print("[*] Bit length: ");
+  Serial.println(card.bitCount);
+  Serial.print("[*] Decode status: ");
+  Serial.println(decodeStatusToString(card.status));
+  Serial.print("[*] Facility code: ");
+  Serial.println(card.facilityCode);
+  Serial.print("[*] Card number: ");
+  Serial.println(card.cardNumber);
+  if (card.cardType == GALLAGHER) {
+    Serial.print("[*] Region Code: ");
+    Serial.println(card.regionCode);
+    Serial.print("[*] Issue Level: ");
+    Serial.println(card.issueLevel);
   }
-  return HIDFacilityCode;
+  Serial.print("[*] Hex: ");
+  Serial.println(card.hex);
+  Serial.print("[*] Raw: ");
+  Serial.println(raw);
 }
 
-unsigned long decodeHIDCardNumber(unsigned int start, unsigned int end) {
-  unsigned long HIDCardNumber = 0;
-  for (unsigned int i = start; i < end; i++) {
-    HIDCardNumber = (HIDCardNumber << 1) | databits[i];
+void processCardData() {
+  if (!decodeCard(databits, bitCount, currentCard)) {
+    Serial.printf("[-] Tusk: Card data not decoded - %s\n",
+                  currentCard.error);
   }
-  return HIDCardNumber;
 }
 
-// Card value processing functions
-// Function to append the card value (bitHolder1 and bitHolder2) to the
-// necessary array then translate that to the two chunks for the card value that
-// will be output
-void setCardChunkBits(unsigned int cardChunk1Offset,
-                      unsigned int bitHolderOffset,
-                      unsigned int cardChunk2Offset) {
-  for (int i = 19; i >= 0; i--) {
-    if (i == 13 || i == cardChunk1Offset) {
-      bitWrite(cardChunk1, i, 1);
-    } else if (i > cardChunk1Offset) {
-      bitWrite(cardChunk1, i, 0);
-    } else {
-      bitWrite(cardChunk1, i, bitRead(bitHolder1, i + bitHolderOffset));
-    }
-    if (i < bitHolderOffset) {
-      bitWrite(cardChunk2, i + cardChunk2Offset, bitRead(bitHolder1, i));
-    }
-    if (i < cardChunk2Offset) {
-      bitWrite(cardChunk2, i, bitRead(bitHolder2, i));
+bool cardDataChanged() {
+  // check if the newly read card's bits are the same as the previously
+  // written card's bits
+  unsigned char i;
+  bool different = false;
+
+  if (bitCount == lastWrittenBitCount) {
+    for (i = 0; i < bitCount; i++) {
+      if (databits[i] != lastWrittenDatabits[i]) {
+        different = true;
+        break;
+      }
     }
+  } else {
+    different = true;
   }
+
+  return different;
 }
 
-String prefixPad(const String &in, const char c, const size_t len) {
-  String out = in;
-  while (out.length() < len) {
-    out = c + out;
+void updateLastWrittenCardData() {
+  unsigned char i;
+  lastWrittenBitCount = bitCount;
+  for (i = 0; i < bitCount; i++) {
+    lastWrittenDatabits[i] = databits[i];
   }
-  return out;
 }
 
-void processHIDCard() {
-  // bits to be decoded differently depending on card format length
-  // see http://www.pagemac.com/projects/rfid/hid_data_formats for more info
-  // also specifically: www.brivo.com/app/static_data/js/calculate.js
-  // Example of full card value
-  // |>   preamble   <| |>   Actual card value   <|
-  // 000000100000000001 11 111000100000100100111000
-  // |> write to chunk1 <| |>  write to chunk2   <|
-  cardType = HID;
-
-  unsigned int cardChunk1Offset, bitHolderOffset, cardChunk2Offset;
-
-  switch (bitCount) {
-  case 26:
-    facilityCode = decodeHIDFacilityCode(1, 9);
-    cardNumber = decodeHIDCardNumber(9, 25);
-    cardChunk1Offset = 2;
-    bitHolderOffset = 20;
-    cardChunk2Offset = 4;
-    break;
-
-  case 27:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 27);
-    cardChunk1Offset = 3;
-    bitHolderOffset = 19;
-    cardChunk2Offset = 5;
-    break;
+// reset variables and prepare for the next card read
+void cleanupCardData() { bitCount = 0; }
+
+// fill a cards.jsonl record from a decoded card
+void cardToJson(const CardData &card, JsonDocument &doc) {
+  char raw[MAX_BITS + 1];
+  formatRawBits(card, raw, sizeof(raw));
+
+  doc["card_type"] = cardTypeToString(card.cardType);
+  doc["bit_length"] = card.bitCount;
+  doc["facility_code"] = card.facilityCode;
+  doc["card_number"] = card.cardNumber;
+  if (card.cardType == GALLAGHER) {
+    doc["issue_level"] = card.issueLevel;
+    doc["region_code"] = card.regionCode;
+  }
+  // raw is copied into the document, hex is referenced
+  doc["raw"] = raw;
+  doc["hex"] = (const char *)card.hex;
+  doc["decode_status"] = decodeStatusToString(card.status);
+}
 
-  case 29:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 29);
-    cardChunk1Offset = 5;
-    bitHolderOffset = 17;
-    cardChunk2Offset = 7;
-    break;
+/* #####----- Write to SD card -----##### */
+// cards.jsonl, kept open and preallocated, see card_log.h
+CardLog cardLog;
+// card data goes to a ring in the cardring flash partition when the sd card
+// is missing, full or slow, see fallback_storage.h
+PartitionFlash ringFlash;
+FlashRing flashRing;
+// what the web api and capture store card data and settings through, see
+// card_storage.h
+SdStorage sdStorage(SD, cardLog, jsoncarddataPath);
+FallbackStorage fallbackStorage(sdStorage, flashRing);
+CardStorage &storage = fallbackStorage;
+
+// a saved setting, empty if it isn't there
+String loadSetting(const char *name) {
+  char value[128];
+  if (!storage.readSetting(name, value, sizeof(value))) {
+    Serial.printf("[-] Settings: Failed to read %s\n", name);
+    return String();
+  }
+  return String(value);
+}
 
-  case 30:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 29);
-    cardChunk1Offset = 6;
-    bitHolderOffset = 16;
-    cardChunk2Offset = 8;
-    break;
+// id of the next record written, ids only ever go up while the device runs
+unsigned long nextRecordId = 0;
+// capture takes ids without cardDataMutex while the migration task raises
+// them past a card mounted after boot
+portMUX_TYPE recordIdMux = portMUX_INITIALIZER_UNLOCKED;
+
+unsigned long takeRecordId() {
+  portENTER_CRITICAL(&recordIdMux);
+  unsigned long id = nextRecordId++;
+  portEXIT_CRITICAL(&recordIdMux);
+  return id;
+}
 
-  case 31:
-    facilityCode = decodeHIDFacilityCode(1, 5);
-    cardNumber = decodeHIDCardNumber(5, 28);
-    cardChunk1Offset = 7;
-    bitHolderOffset = 15;
-    cardChunk2Offset = 9;
-    break;
+// continue ids from at least id
+void raiseRecordId(unsigned long id) {
+  portENTER_CRITICAL(&recordIdMux);
+  if (id > nextRecordId) {
+    nextRecordId = id;
+  }
+  portEXIT_CRITICAL(&recordIdMux);
+}
 
-  case 32:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 31);
-    cardChunk1Offset = 8;
-    bitHolderOffset = 14;
-    cardChunk2Offset = 10;
-    break;
+// the id after the last record in the log, 0 if there are none. logs
+// written before records had ids are numbered by line, the same as the web
+// interface does
+unsigned long sdNextRecordId() {
+  File file = SD.open(jsoncarddataPath, FILE_READ);
+  if (!file) {
+    return 0;
+  }
 
-  case 33:
-    facilityCode = decodeHIDFacilityCode(1, 8);
-    cardNumber = decodeHIDCardNumber(8, 32);
-    cardChunk1Offset = 9;
-    bitHolderOffset = 13;
-    cardChunk2Offset = 11;
-    break;
+  // the last record is within the last RECORD_LINE_SIZE bytes before the
+  // preallocated space
+  char tail[RECORD_LINE_SIZE + 1];
+  size_t size = cardLog.size();
+  size_t start = size > RECORD_LINE_SIZE ? size - RECORD_LINE_SIZE : 0;
+  file.seek(start);
+  size_t n = file.read((uint8_t *)tail, size - start);
+  while (n > 0 && tail[n - 1] == '\n') {
+    n--;
+  }
+  tail[n] = '\0';
+  char *last = strrchr(tail, '\n');
+
+  unsigned long id = 0;
+  StaticJsonDocument<768> doc;
+  if (n > 0 && !deserializeJson(doc, last ? last + 1 : tail) &&
+      doc["id"].is<unsigned long>()) {
+    id = doc["id"].as<unsigned long>() + 1;
+  } else {
+    // count the records
+    file.seek(0);
+    uint8_t buffer[512];
+    char previous = '\n';
+    size_t remaining = size;
+    while (remaining > 0) {
+      n = file.read(buffer, remaining < sizeof(buffer) ? remaining
+                                                       : sizeof(buffer));
+      if (n == 0) {
+        break;
+      }
+      remaining -= n;
+      for (size_t i = 0; i < n; i++) {
+        if (buffer[i] == '\n' && previous != '\n') {
+          id++;
+        }
+        previous = buffer[i];
+      }
+    }
+    if (previous != '\n') {
+      id++;
+    }
+  }
+  file.close();
+  return id;
+}
 
-  case 34:
-    facilityCode = decodeHIDFacilityCode(1, 17);
-    cardNumber = decodeHIDCardNumber(17, 33);
-    cardChunk1Offset = 10;
-    bitHolderOffset = 12;
-    cardChunk2Offset = 12;
-    break;
+// continue record ids from the last record stored, records still in flash
+// are newer than any on the sd card
+void initRecordId() {
+  nextRecordId = fallbackStorage.sdAvailable() ? sdNextRecordId() : 0;
+
+  char line[RECORD_LINE_SIZE + 1];
+  size_t n = fallbackStorage.newestRingRecord(line, RECORD_LINE_SIZE);
+  line[n] = '\0';
+  StaticJsonDocument<768> doc;
+  if (n > 0 && !deserializeJson(doc, line) &&
+      doc["id"].is<unsigned long>() &&
+      doc["id"].as<unsigned long>() >= nextRecordId) {
+    nextRecordId = doc["id"].as<unsigned long>() + 1;
+  }
+  Serial.printf("[+] Tusk: Next record id is %lu\n", nextRecordId);
+}
 
-  case 35:
-    facilityCode = decodeHIDFacilityCode(2, 14);
-    cardNumber = decodeHIDCardNumber(14, 34);
-    cardChunk1Offset = 11;
-    bitHolderOffset = 11;
-    cardChunk2Offset = 13;
-    break;
+// how long capture waits for the web server or the re-decode to let go of
+// the card log before storing a record in flash instead
+#define CAPTURE_LOCK_WAIT pdMS_TO_TICKS(10)
 
-  case 36:
-    facilityCode = decodeHIDFacilityCode(21, 33);
-    cardNumber = decodeHIDCardNumber(1, 17);
-    cardChunk1Offset = 12;
-    bitHolderOffset = 10;
-    cardChunk2Offset = 14;
-    break;
+void writeToSD() {
+  DynamicJsonDocument doc(1024);
+  cardToJson(currentCard, doc);
+  doc["id"] = takeRecordId();
+  if (isClockSet()) {
+    doc["timestamp"] = (unsigned long)time(nullptr);
+  }
+  Serial.println("[+] New Card Read: ");
+  serializeJsonPretty(doc, Serial);
 
-  default:
-    Serial.println("[-] Unsupported bitCount for HID card");
+  char line[CARD_LOG_MAX_RECORD];
+  size_t n = measureJson(doc);
+  if (n + 1 > sizeof(line) || serializeJson(doc, line, sizeof(line)) != n) {
+    Serial.println("\n[-] SD Card: Card data record too long");
     return;
   }
+  line[n++] = '\n';
+
+  // without a ring to fall back on there's nothing to do but wait
+  TickType_t wait =
+      fallbackStorage.hasRing() ? CAPTURE_LOCK_WAIT : portMAX_DELAY;
+  bool stored;
+  if (xSemaphoreTake(cardDataMutex, wait) == pdTRUE) {
+    stored = storage.appendRecord(line, n);
+    xSemaphoreGive(cardDataMutex);
+  } else {
+    stored = fallbackStorage.appendToRing(line, n);
+  }
+  if (!stored) {
+    Serial.println("\n[-] Tusk: Failed to store card data");
+  } else if (fallbackStorage.pending() > 0) {
+    Serial.printf("\n[+] Flash: Card data stored, %lu records waiting for "
+                  "the SD card\n",
+                  fallbackStorage.pending());
+  } else {
+    Serial.println("\n[+] SD Card: Data Written to SD Card");
+  }
+}
 
-  setCardChunkBits(cardChunk1Offset, bitHolderOffset, cardChunk2Offset);
-  hexCardData =
-      String(cardChunk1, HEX) + prefixPad(String(cardChunk2, HEX), '0', 6);
+// grow the log ahead of the next card while nothing is being captured, so
+// appends don't have to
+void reserveCardLog() {
+  if (xSemaphoreTake(cardDataMutex, 0) != pdTRUE) {
+    return;
+  }
+  if (!fallbackStorage.sdWritable()) {
+    // a full card still gets its last records synced
+    if (fallbackStorage.sdAvailable()) {
+      cardLog.sync();
+    }
+    xSemaphoreGive(cardDataMutex);
+    return;
+  }
+  size_t allocated = cardLog.allocated();
+  if (!cardLog.reserve()) {
+    Serial.println("[-] SD Card: Failed to grow card data file");
+  } else if (cardLog.allocated() != allocated) {
+    Serial.printf("[+] SD Card: Card data file grown to %u bytes\n",
+                  (unsigned int)cardLog.allocated());
+  }
+  xSemaphoreGive(cardDataMutex);
 }
 
-// gallagher cardholder credential data structure
-struct CardholderCredentials {
-  int region_code;
-  int facility_code;
-  int card_number;
-  int issue_level;
+/* #####----- Re-decode stored card data -----##### */
+// stored raw frames are run through the current decoders into a new segment,
+// which replaces cards.jsonl once complete. runs after a decoder update or on
+// request from the web interface
+const char *redecodeSegmentPath = "/cards.redecode.jsonl";
+const char *redecodeBackupPath = "/cards.old.jsonl";
+const char *decoderVersionPath = "/decoder.txt";
+
+// records processed between yields
+#define REDECODE_BATCH 8
+
+struct RedecodeProgress {
+  volatile bool running;
+  volatile bool cancel;
+  volatile size_t bytesTotal;
+  volatile size_t bytesDone;
+  volatile unsigned long records;
+  volatile unsigned long changed;
+  // reason the last run failed, static string
+  const char *error;
 };
+RedecodeProgress redecodeProgress;
 
-// gallagher descramble function to deobfuscate card data
-byte descramble(byte arr) {
-  byte lut[] = {
-      0x2f, 0x6e, 0xdd, 0xdf, 0x1d, 0x0f, 0xb0, 0x76, 0xad, 0xaf, 0x7f, 0xbb,
-      0x77, 0x85, 0x11, 0x6d, 0xf4, 0xd2, 0x84, 0x42, 0xeb, 0xf7, 0x34, 0x55,
-      0x4a, 0x3a, 0x10, 0x71, 0xe7, 0xa1, 0x62, 0x1a, 0x3e, 0x4c, 0x14, 0xd3,
-      0x5e, 0xb2, 0x7d, 0x56, 0xbc, 0x27, 0x82, 0x60, 0xe3, 0xae, 0x1f, 0x9b,
-      0xaa, 0x2b, 0x95, 0x49, 0x73, 0xe1, 0x92, 0x79, 0x91, 0x38, 0x6c, 0x19,
-      0x0e, 0xa9, 0xe2, 0x8d, 0x66, 0xc7, 0x5a, 0xf5, 0x1c, 0x80, 0x99, 0xbe,
-      0x4e, 0x41, 0xf0, 0xe8, 0xa6, 0x20, 0xab, 0x87, 0xc8, 0x1e, 0xa0, 0x59,
-      0x7b, 0x0c, 0xc3, 0x3c, 0x61, 0xcc, 0x40, 0x9e, 0x06, 0x52, 0x1b, 0x32,
-      0x8c, 0x12, 0x93, 0xbf, 0xef, 0x3b, 0x25, 0x0d, 0xc2, 0x88, 0xd1, 0xe0,
-      0x07, 0x2d, 0x70, 0xc6, 0x29, 0x6a, 0x4d, 0x47, 0x26, 0xa3, 0xe4, 0x8b,
-      0xf6, 0x97, 0x2c, 0x5d, 0x3d, 0xd7, 0x96, 0x28, 0x02, 0x08, 0x30, 0xa7,
-      0x22, 0xc9, 0x65, 0xf8, 0xb7, 0xb4, 0x8a, 0xca, 0xb9, 0xf2, 0xd0, 0x17,
-      0xff, 0x46, 0xfb, 0x9a, 0xba, 0x8f, 0xb6, 0x69, 0x68, 0x8e, 0x21, 0x6f,
-      0xc4, 0xcb, 0xb3, 0xce, 0x51, 0xd4, 0x81, 0x00, 0x2e, 0x9c, 0x74, 0x63,
-      0x45, 0xd9, 0x16, 0x35, 0x5f, 0xed, 0x78, 0x9f, 0x01, 0x48, 0x04, 0xc1,
-      0x33, 0xd6, 0x4f, 0x94, 0xde, 0x31, 0x9d, 0x0a, 0xac, 0x18, 0x4b, 0xcd,
-      0x98, 0xb8, 0x37, 0xa2, 0x83, 0xec, 0x03, 0xd8, 0xda, 0xe5, 0x7a, 0x6b,
-      0x53, 0xd5, 0x15, 0xa4, 0x43, 0xe9, 0x90, 0x67, 0x58, 0xc0, 0xa5, 0xfa,
-      0x2a, 0xb1, 0x75, 0x50, 0x39, 0x5c, 0xe6, 0xdc, 0x89, 0xfc, 0xcf, 0xfe,
-      0xf9, 0x57, 0x54, 0x64, 0xa8, 0xee, 0x23, 0x0b, 0xf1, 0xea, 0xfd, 0xdb,
-      0xbd, 0x09, 0xb5, 0x5b, 0x05, 0x86, 0x13, 0xf3, 0x24, 0xc5, 0x3f, 0x44,
-      0x72, 0x7c, 0x7e, 0x36};
-
-  return lut[arr];
-}
-
-// deobfuscate Gallagher cardholder credentials
-CardholderCredentials deobfuscate_cardholder_credentials(byte *bytes) {
-  byte arr[8];
-  for (int i = 0; i < 8; i++) {
-    arr[i] = descramble(bytes[i]);
-  }
-
-  CardholderCredentials credentials;
-  // 4bit region code
-  credentials.region_code = (arr[3] & 0x1E) >> 1;
-  // 16bit facility code
-  credentials.facility_code =
-      ((arr[5] & 0x0F) << 12) | (arr[1] << 4) | ((arr[7] >> 4) & 0x0F);
-  // 24bit card number
-  credentials.card_number = (arr[0] << 16) | ((arr[4] & 0x1F) << 11) |
-                            (arr[2] << 3) | ((arr[3] & 0xE0) >> 5);
-  // 4bit issue level
-  credentials.issue_level = (arr[7] & 0x0F);
-
-  return credentials;
-}
-
-bool decodeError = false;
-// Function to decode raw Gallagher Cardax 125kHz card data
-byte *decode_cardax_125khz(String data) {
-  String magic_prefix = "01111111111010";
-  int i = data.indexOf(magic_prefix);
-
-  if (i == -1) {
-    Serial.println(
-        "[!] Magic prefix not found - not a valid gallagher cardax card");
-    decodeError = true;
-    return nullptr;
-  }
+// open exports, cards.jsonl isn't replaced while it is being streamed.
+// only changed by the web server, incremented with cardDataMutex held
+volatile int activeCardDataReaders = 0;
 
-  data = data.substring(i + 16);
-  data = data.substring(0, 9 * 8 + 8);
+// re-decode a single cards.jsonl line into segment. records without raw bits
+// (or that can't be parsed) are copied unchanged
+void redecodeRecord(const char *line, File &segment) {
+  StaticJsonDocument<768> doc;
+  unsigned char bits[MAX_BITS];
+  unsigned int count = 0;
 
-  if (data.length() != 9 * 8 + 8) {
-    Serial.println("[!] Invalid gallagher card data length");
-    decodeError = true;
-    return nullptr;
+  if (!deserializeJson(doc, line) && doc["raw"].is<const char *>()) {
+    count = parseRawBits(doc["raw"], bits, MAX_BITS);
+  }
+  if (count == 0) {
+    segment.print(line);
+    segment.print("\n");
+    return;
+  }
+
+  CardData card;
+  decodeCard(bits, count, card);
+  if (card.facilityCode != doc["facility_code"].as<unsigned long>() ||
+      card.cardNumber != doc["card_number"].as<unsigned long>() ||
+      doc["decode_status"] != decodeStatusToString(card.status)) {
+    redecodeProgress.changed++;
   }
 
-  String b = "";
+  StaticJsonDocument<768> updated;
+  cardToJson(card, updated);
+  if (!doc["id"].isNull()) {
+    updated["id"] = doc["id"];
+  }
+  if (!doc["timestamp"].isNull()) {
+    updated["timestamp"] = doc["timestamp"];
+  }
+  serializeJson(updated, segment);
+  segment.print("\n");
+}
 
-  while (b.length() < 64 + 8) {
-    String n = data.substring(9 * b.length() / 8);
-    if (b.length() < 64) {
-      if (n.charAt(7) == n.charAt(8)) {
-        Serial.println("[!] Invalid gallagher data");
-        decodeError = true;
-        return nullptr;
+// process lines from source until the end of its records (bytesTotal) or a
+// batch is done, returns the number of lines processed. a read that gets
+// nowhere (the card was pulled or the log cleared) sets the error
+unsigned int redecodeBatch(File &source, File &segment, unsigned int limit) {
+  char line[RECORD_LINE_SIZE];
+  unsigned int processed = 0;
+  while (processed < limit &&
+         source.position() < redecodeProgress.bytesTotal) {
+    size_t position = source.position();
+    size_t n = source.readBytesUntil('\n', line, sizeof(line) - 1);
+    if (n == 0) {
+      if (source.position() == position) {
+        redecodeProgress.error = "Failed to read card data";
+        break;
       }
+      // padding
+      continue;
     }
-    b += n.substring(0, 8);
+    line[n] = '\0';
+    redecodeRecord(line, segment);
+    redecodeProgress.records++;
+    processed++;
   }
+  redecodeProgress.bytesDone = source.position();
+  return processed;
+}
 
-  uint64_t n = strtoull(b.substring(0, 64).c_str(), NULL, 2);
+// rename the finished segment to cards.jsonl
+bool swapInSegment() {
+  // keep the old log until the new one is in place
+  if (!SD.rename(jsoncarddataPath, redecodeBackupPath)) {
+    redecodeProgress.error = "Failed to replace card data";
+    return false;
+  }
+  if (!SD.rename(redecodeSegmentPath, jsoncarddataPath)) {
+    SD.rename(redecodeBackupPath, jsoncarddataPath);
+    redecodeProgress.error = "Failed to replace card data";
+    return false;
+  }
+  SD.remove(redecodeBackupPath);
+  writeSDFile(decoderVersionPath, String(DECODER_VERSION).c_str());
+  return true;
+}
 
-  /*
-  TODO: the checksum always fails
-  byte check_sum = 0x2C;
-  byte xcc[] = {0x7, 0xE, 0x1C, 0x38, 0x70, 0xE0, 0xC7, 0x89};
+// swap the finished segment in, called with cardDataMutex held
+bool replaceCardData(File &source, File &segment) {
+  // pick up records appended since the log was opened, a new handle is
+  // needed to see what was written through the log's own
+  size_t position = source.position();
+  source.close();
+  cardLog.sync();
+  source = SD.open(jsoncarddataPath, FILE_READ);
+  if (!source || !source.seek(position)) {
+    redecodeProgress.error = "Failed to reopen card data";
+    return false;
+  }
+  redecodeProgress.bytesTotal = cardLog.size();
+  while (redecodeBatch(source, segment, REDECODE_BATCH) > 0) {
+  }
+  source.close();
+  segment.close();
+  if (redecodeProgress.error) {
+    return false;
+  }
 
-  for (int c = 0; c < 8; c++) {
-    byte ncs = check_sum ^ ((byte*)&n)[c];
-    check_sum = ncs;
-    for (int i = 0; i < 8; i++) {
-      if (ncs & (1 << i)) {
-        check_sum ^= xcc[i];
-      }
-    }
+  // the log is held open for appending, it has to be closed to be replaced.
+  // the segment has no preallocated space, it is grown once idle again
+  cardLog.end();
+  bool replaced = swapInSegment();
+  if (!cardLog.begin(SD, jsoncarddataPath)) {
+    Serial.println("[-] SD Card: Failed to reopen card data");
   }
+  return replaced;
+}
 
-  if (strtoull(b.substring(0, 64).c_str(), NULL, 2) != check_sum) {
-    Serial.println("[-] Checksum did not match");
-    decodeError = true;
-    return nullptr;
+void runRedecode() {
+  File source = SD.open(jsoncarddataPath, FILE_READ);
+  File segment = SD.open(redecodeSegmentPath, FILE_WRITE);
+  if (!source || !segment) {
+    redecodeProgress.error = "Failed to open card data";
+    return;
   }
-  */
+  xSemaphoreTake(cardDataMutex, portMAX_DELAY);
+  redecodeProgress.bytesTotal = cardLog.size();
+  xSemaphoreGive(cardDataMutex);
+
+  while (true) {
+    if (redecodeProgress.cancel) {
+      break;
+    }
+    if (redecodeBatch(source, segment, REDECODE_BATCH) > 0) {
+      // let capture and the web server run
+      vTaskDelay(1);
+      continue;
+    }
+    if (redecodeProgress.error) {
+      break;
+    }
 
-  static byte byteArr[8];
-  for (int i = 0; i < 8; i++) {
-    byteArr[i] = (n >> (56 - i * 8)) & 0xFF;
+    xSemaphoreTake(cardDataMutex, portMAX_DELAY);
+    if (activeCardDataReaders > 0) {
+      xSemaphoreGive(cardDataMutex);
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    bool replaced = !redecodeProgress.cancel && replaceCardData(source, segment);
+    xSemaphoreGive(cardDataMutex);
+    if (replaced) {
+      Serial.printf("[+] Tusk: Re-decoded %lu records, %lu changed\n",
+                    redecodeProgress.records, redecodeProgress.changed);
+      return;
+    }
+    break;
   }
 
-  return byteArr;
+  // cancelled (card data deleted) or failed, drop the partial segment. the
+  // card may be gone, in which case there's nothing to drop
+  source.close();
+  segment.close();
+  SD.remove(redecodeSegmentPath);
 }
 
-void processGallagherCard() {
-  cardType = GALLAGHER;
-  byte *hex = decode_cardax_125khz(rawCardData);
-  if (decodeError) {
-    Serial.println("[!] Error occurred during gallagher (cardax) decoding.");
-  } else {
-    for (int i = 0; i < 8; i++) {
-      hexCardData += String(hex[i], HEX);
-    }
-    CardholderCredentials credentials = deobfuscate_cardholder_credentials(hex);
-    regionCode = credentials.region_code;
-    facilityCode = credentials.facility_code;
-    cardNumber = credentials.card_number;
-    issueLevel = credentials.issue_level;
+void redecodeTaskMain(void *parameter) {
+  Serial.println("[*] Tusk: Re-decoding stored card data");
+  runRedecode();
+  if (redecodeProgress.error) {
+    Serial.printf("[-] Tusk: Re-decode failed - %s\n", redecodeProgress.error);
   }
+  redecodeProgress.running = false;
+  vTaskDelete(NULL);
 }
 
-void processCardData() {
-  rawCardData = "";
-  for (unsigned int i = 0; i < bitCount; i++) {
-    rawCardData += String(databits[i]);
+// called with cardDataMutex held, so a run can't start while the sd card is
+// being remounted
+bool startRedecode() {
+  if (redecodeProgress.running || !fallbackStorage.sdAvailable()) {
+    return false;
+  }
+  redecodeProgress.running = true;
+  redecodeProgress.cancel = false;
+  redecodeProgress.bytesTotal = 0;
+  redecodeProgress.bytesDone = 0;
+  redecodeProgress.records = 0;
+  redecodeProgress.changed = 0;
+  redecodeProgress.error = nullptr;
+
+  // low priority on the core that doesn't run loop(), so capture isn't
+  // delayed by it
+  if (xTaskCreatePinnedToCore(redecodeTaskMain, "redecode", 8192, NULL, 1,
+                              NULL, 0) != pdPASS) {
+    redecodeProgress.error = "Failed to start re-decode task";
+    redecodeProgress.running = false;
+    return false;
   }
+  return true;
+}
+
+/* #####----- SD card append benchmark -----##### */
+// times appends the way older firmware made them (open in append mode,
+// write, close) against the preallocated card log, on scratch files
+const char *benchAppendPath = "/bench.append.jsonl";
+const char *benchLogPath = "/bench.log.jsonl";
+
+#define SD_BENCH_RECORDS 200
+#define SD_BENCH_MAX_RECORDS 2000
+
+struct AppendLatency {
+  uint32_t mean;
+  uint32_t p50;
+  uint32_t p90;
+  uint32_t p99;
+  uint32_t max;
+};
 
-  if (bitCount >= 26 && bitCount <= 36) {
-    processHIDCard();
+struct SdBenchProgress {
+  volatile bool running;
+  unsigned int records;
+  AppendLatency append;
+  AppendLatency preallocated;
+  // reason the last run failed, static string
+  const char *error;
+};
+SdBenchProgress sdBench;
+
+// samples are in microseconds, sorted in place
+void summariseLatency(uint32_t *samples, unsigned int count,
+                      AppendLatency &latency) {
+  std::sort(samples, samples + count);
+  uint64_t total = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    total += samples[i];
   }
+  latency.mean = total / count;
+  latency.p50 = samples[count * 50 / 100];
+  latency.p90 = samples[count * 90 / 100];
+  latency.p99 = samples[count * 99 / 100];
+  latency.max = samples[count - 1];
+}
+
+// a record the size of a typical 26 bit card
+size_t benchRecord(char *line, size_t length, unsigned int id) {
+  return snprintf(line, length,
+                  "{\"card_type\":\"hid\",\"bit_length\":26,"
+                  "\"facility_code\":%u,\"card_number\":%u,"
+                  "\"raw\":\"10010110100000110010101011\","
+                  "\"hex\":\"25a0caab\",\"decode_status\":\"ok\","
+                  "\"id\":%u,\"timestamp\":%lu}\n",
+                  id % 256, id * 7 % 65536, id, 1700000000UL + id);
+}
 
-  if (bitCount == 96) {
-    processGallagherCard();
+bool benchAppend(uint32_t *samples) {
+  writeSDFile(benchAppendPath, "");
+  char line[CARD_LOG_MAX_RECORD];
+  for (unsigned int i = 0; i < sdBench.records; i++) {
+    size_t n = benchRecord(line, sizeof(line), i);
+    int64_t start = esp_timer_get_time();
+    File file = SD.open(benchAppendPath, FILE_APPEND);
+    bool written = file && file.write((const uint8_t *)line, n) == n;
+    file.close();
+    samples[i] = esp_timer_get_time() - start;
+    if (!written) {
+      return false;
+    }
   }
+  return true;
 }
 
-bool cardDataChanged() {
-  // check if the newly read card's bits are the same as the previously
-  // written card's bits
-  unsigned char i;
-  bool different = false;
+bool benchPreallocated(uint32_t *samples) {
+  writeSDFile(benchLogPath, "");
+  std::unique_ptr<CardLog> log(new (std::nothrow) CardLog());
+  if (!log || !log->begin(SD, benchLogPath)) {
+    return false;
+  }
+  char line[CARD_LOG_MAX_RECORD];
+  for (unsigned int i = 0; i < sdBench.records; i++) {
+    // the log is grown between cards, as loop() does while idle
+    if (!log->reserve()) {
+      return false;
+    }
+    size_t n = benchRecord(line, sizeof(line), i);
+    int64_t start = esp_timer_get_time();
+    bool written = log->append(line, n);
+    samples[i] = esp_timer_get_time() - start;
+    if (!written) {
+      return false;
+    }
+  }
+  log->end();
+  return true;
+}
 
-  if (bitCount == lastWrittenBitCount) {
-    for (i = 0; i < bitCount; i++) {
-      if (databits[i] != lastWrittenDatabits[i]) {
-        different = true;
-        break;
-      }
+void sdBenchTaskMain(void *parameter) {
+  Serial.printf("[*] SD Card: Benchmarking %u appends\n", sdBench.records);
+  uint32_t *samples =
+      (uint32_t *)malloc(sdBench.records * sizeof(uint32_t));
+  if (!samples) {
+    sdBench.error = "Not enough memory for benchmark";
+  } else if (!benchAppend(samples)) {
+    sdBench.error = "Failed to append to benchmark file";
+  } else {
+    summariseLatency(samples, sdBench.records, sdBench.append);
+    if (!benchPreallocated(samples)) {
+      sdBench.error = "Failed to append to benchmark log";
+    } else {
+      summariseLatency(samples, sdBench.records, sdBench.preallocated);
     }
+  }
+  free(samples);
+  SD.remove(benchAppendPath);
+  SD.remove(benchLogPath);
+
+  if (sdBench.error) {
+    Serial.printf("[-] SD Card: Benchmark failed - %s\n", sdBench.error);
   } else {
-    different = true;
+    Serial.printf("[+] SD Card: Append p99 %uus, preallocated p99 %uus\n",
+                  sdBench.append.p99, sdBench.preallocated.p99);
   }
+  sdBench.running = false;
+  vTaskDelete(NULL);
+}
 
-  return different;
+bool startSdBench(unsigned int records) {
+  if (sdBench.running) {
+    return false;
+  }
+  sdBench.running = true;
+  sdBench.records = records;
+  sdBench.append = AppendLatency();
+  sdBench.preallocated = AppendLatency();
+  sdBench.error = nullptr;
+
+  // alongside the re-decode, away from capture
+  if (xTaskCreatePinnedToCore(sdBenchTaskMain, "sdbench", 4096, NULL, 1, NULL,
+                              0) != pdPASS) {
+    sdBench.error = "Failed to start benchmark task";
+    sdBench.running = false;
+    return false;
+  }
+  return true;
 }
 
-void updateLastWrittenCardData() {
-  unsigned char i;
-  lastWrittenBitCount = bitCount;
-  for (i = 0; i < bitCount; i++) {
-    lastWrittenDatabits[i] = databits[i];
+/* #####----- Move card data from flash to the SD card -----##### */
+// records captured while the sd card was missing, full or slow are moved to
+// it in the background, and a missing card is looked for every so often
+// while nothing has files open on it
+
+// how often a missing sd card is looked for
+#define SD_RETRY_INTERVAL 30000
+// records moved each time cardDataMutex is taken
+#define MIGRATE_BATCH 8
+
+// mount the sd card again and reopen the log, called with cardDataMutex held
+bool remountSd() {
+  cardLog.end();
+  SD.end();
+  if (!SD.begin(sd_cs, SPI, settings.sdSpiFrequency, "/sd",
+                SD_MAX_OPEN_FILES)) {
+    return false;
+  }
+  if (!SD.exists(jsoncarddataPath)) {
+    writeSDFile(jsoncarddataPath, "");
   }
+  return cardLog.begin(SD, jsoncarddataPath);
 }
 
-void clearDatabits() {
-  for (unsigned char i = 0; i < MAX_BITS; i++) {
-    databits[i] = 0;
+// whether the card still answers, reading the log from the card rather than
+// from what the filesystem has cached. called with cardDataMutex held
+bool sdResponds() {
+  File file = SD.open(jsoncarddataPath, FILE_READ);
+  if (!file) {
+    return false;
   }
+  bool responds = file.size() == 0 || file.read() >= 0;
+  file.close();
+  return responds;
 }
 
-// reset variables and prepare for the next card read
-void cleanupCardData() {
-  cardType = UNKNOWN;
-  rawCardData = "";
-  hexCardData = "";
-  bitCount = 0;
-  facilityCode = 0;
-  cardNumber = 0;
-  regionCode = 0;
-  issueLevel = 0;
-  bitHolder1 = 0;
-  bitHolder2 = 0;
-  cardChunk1 = 0;
-  cardChunk2 = 0;
+// files open on the card, remounting it would leave them dangling. called
+// with cardDataMutex held
+bool sdFilesOpen() {
+  return activeCardDataReaders > 0 || redecodeProgress.running ||
+         sdBench.running;
 }
 
-/* #####----- Write to SD card -----##### */
-void writeToSD() {
-  File SDFile = SD.open("/cards.jsonl", FILE_APPEND);
-  if (SDFile) {
-    DynamicJsonDocument doc(1024);
-    doc["card_type"] = cardTypeToString(cardType);
-    doc["bit_length"] = bitCount;
-    doc["facility_code"] = facilityCode;
-    doc["card_number"] = cardNumber;
-    if (cardType == GALLAGHER) {
-      doc["issue_level"] = issueLevel;
-      doc["region_code"] = regionCode;
+// no room left for records: the log's preallocated space is used up and
+// the card can't take another extent. called with cardDataMutex held
+bool sdOutOfSpace() {
+  if (cardLog.allocated() - cardLog.size() >= CARD_LOG_MAX_RECORD) {
+    return false;
+  }
+  uint64_t total = SD.totalBytes();
+  uint64_t used = SD.usedBytes();
+  return used >= total || total - used < CARD_LOG_EXTENT_SIZE;
+}
+
+void migrateTaskMain(void *parameter) {
+  uint32_t lastRetry = millis();
+  bool fullChecked = false;
+  while (true) {
+    if (fallbackStorage.isSdFull()) {
+      // an append failed. a card that has gone is looked for again, one
+      // that is out of space is left alone until it has some, and any other
+      // failure is taken as a glitch and the card written to again. checked
+      // now and every SD_RETRY_INTERVAL after
+      if (fullChecked && millis() - lastRetry < SD_RETRY_INTERVAL) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        continue;
+      }
+      lastRetry = millis();
+      xSemaphoreTake(cardDataMutex, portMAX_DELAY);
+      bool present = sdResponds();
+      bool full = present && sdOutOfSpace();
+      if (!present) {
+        fallbackStorage.setSdAvailable(false);
+      } else if (!full) {
+        fallbackStorage.resumeSd();
+      }
+      xSemaphoreGive(cardDataMutex);
+      if (!present) {
+        Serial.println("[-] SD Card: Card removed");
+      } else if (!full) {
+        Serial.println("[*] SD Card: Card has space, writing to it again");
+      } else if (!fullChecked) {
+        Serial.println("[-] SD Card: Card full, storing card data in flash "
+                       "until it has space");
+      }
+      fullChecked = full;
+      continue;
     }
-    doc["raw"] = rawCardData;
-    doc["hex"] = hexCardData;
-    Serial.println("[+] New Card Read: ");
-    serializeJsonPretty(doc, Serial);
-    if (serializeJson(doc, SDFile) == 0) {
-      Serial.println("[-] SD Card: Failed to write json card data to file");
+    fullChecked = false;
+
+    if (!fallbackStorage.sdAvailable()) {
+      if (millis() - lastRetry < SD_RETRY_INTERVAL) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        continue;
+      }
+      lastRetry = millis();
+      xSemaphoreTake(cardDataMutex, portMAX_DELAY);
+      bool mounted = !sdFilesOpen() && remountSd();
+      fallbackStorage.setSdAvailable(mounted);
+      // ids taken while the card was away started from the ring's, new ones
+      // carry on after the card's before anything is moved to it
+      if (mounted) {
+        raiseRecordId(sdNextRecordId());
+      }
+      xSemaphoreGive(cardDataMutex);
+      if (mounted) {
+        Serial.printf("[+] SD Card: Mounted, moving %lu records from flash\n",
+                      fallbackStorage.pending());
+      }
+      continue;
     }
-    SDFile.print("\n");
-    SDFile.close();
-    Serial.println("\n[+] SD Card: Data Written to SD Card");
+
+    if (fallbackStorage.pending() == 0) {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+    xSemaphoreTake(cardDataMutex, portMAX_DELAY);
+    unsigned int moved = fallbackStorage.migrate(MIGRATE_BATCH);
+    xSemaphoreGive(cardDataMutex);
+    if (moved > 0 && fallbackStorage.pending() == 0) {
+      Serial.println("[+] SD Card: Card data moved from flash");
+    }
+    // let capture and the web server run
+    vTaskDelay(moved > 0 ? 1 : pdMS_TO_TICKS(1000));
   }
 }
 
+bool startMigration() {
+  // low priority on the core that doesn't run loop(), like the re-decode
+  return xTaskCreatePinnedToCore(migrateTaskMain, "migrate", 4096, NULL, 1,
+                                 NULL, 0) == pdPASS;
+}
+
 // webserver setup and config
 AsyncWebServer server(80);
 
+// limits how many requests are worked on at once, see request_budget.h
+RequestBudget requestBudget;
+
+// how long a handler waits for cardDataMutex before giving up, handlers run
+// on the web server's task and must not block it
+#define HANDLER_LOCK_WAIT pdMS_TO_TICKS(50)
+
+Ticker rebootTimer;
+
+// the async web server's requests as the web api handlers see them
+class AsyncApiRequest : public ApiRequest {
+public:
+  explicit AsyncApiRequest(AsyncWebServerRequest *request)
+      : request(request) {}
+
+  const char *param(const char *name, bool post) override {
+    AsyncWebParameter *p = request->getParam(name, post);
+    return p ? p->value().c_str() : nullptr;
+  }
+  size_t formFieldCount() override {
+    size_t count = 0;
+    for (int i = 0; i < request->params(); i++) {
+      if (request->getParam(i)->isPost()) {
+        count++;
+      }
+    }
+    return count;
+  }
+  const char *formFieldName(size_t i) override {
+    return formField(i)->name().c_str();
+  }
+  const char *formFieldValue(size_t i) override {
+    return formField(i)->value().c_str();
+  }
+  const char *header(const char *name) override {
+    AsyncWebHeader *h = request->getHeader(name);
+    return h ? h->value().c_str() : nullptr;
+  }
+
+  void addHeader(const char *name, const char *value) override {
+    headers.push_back(std::make_pair(String(name), String(value)));
+  }
+  void send(int status, const char *contentType,
+            const std::string &body) override {
+    sendWithHeaders(request->beginResponse(status, contentType, body.c_str()));
+  }
+  void sendStream(const char *contentType,
+                  std::function<size_t(uint8_t *, size_t)> fill) override {
+    sendWithHeaders(request->beginChunkedResponse(
+        contentType,
+        [fill](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+          return fill(buffer, maxLen);
+        }));
+  }
+  void onDisconnect(std::function<void()> callback) override {
+    request->onDisconnect(callback);
+  }
+
+private:
+  // the i-th post parameter, form fields are only asked for below the count
+  AsyncWebParameter *formField(size_t i) {
+    for (int j = 0; j < request->params(); j++) {
+      AsyncWebParameter *p = request->getParam(j);
+      if (p->isPost() && i-- == 0) {
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  void sendWithHeaders(AsyncWebServerResponse *response) {
+    for (const std::pair<String, String> &header : headers) {
+      response->addHeader(header.first, header.second);
+    }
+    request->send(response);
+  }
+
+  AsyncWebServerRequest *request;
+  std::vector<std::pair<String, String>> headers;
+};
+
+// an export of the card log, the re-decode doesn't replace the log while
+// any are open
+struct SdCardDataExport : CardDataExport {
+  SdCardDataExport() { activeCardDataReaders++; }
+  // fewer readers never lets the re-decode replace the log early, so this
+  // doesn't need the mutex
+  ~SdCardDataExport() { activeCardDataReaders--; }
+};
+
+// picked at boot, so the card data version changes when the device restarts
+uint32_t cardDataBootId = 0;
+
+// the web api on the sd card log (and the flash ring behind it), guarded by
+// cardDataMutex, logging to the serial port
+class DeviceWebApi : public WebApi {
+public:
+  DeviceWebApi() : WebApi(storage, requestBudget, capture, settings) {}
+
+  bool lockCardData() override {
+    return xSemaphoreTake(cardDataMutex, HANDLER_LOCK_WAIT) == pdTRUE;
+  }
+  void unlockCardData() override { xSemaphoreGive(cardDataMutex); }
+
+protected:
+  std::shared_ptr<CardDataExport> newExport() override {
+    return std::shared_ptr<CardDataExport>(new (std::nothrow)
+                                               SdCardDataExport());
+  }
+
+  // changes when the log is cleared, re-decoded or remounted, when the card
+  // goes missing and after a reboot
+  std::string cardDataVersion() override {
+    char version[32];
+    snprintf(version, sizeof(version), "%08x.%lu%s",
+             (unsigned int)cardDataBootId, cardLog.opens(),
+             fallbackStorage.sdAvailable() ? "" : ".flash");
+    return version;
+  }
+
+  void setPowerSave(bool enable) override { ::setPowerSave(enable); }
+
+  void log(const char *format, ...) override {
+    char line[160];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    Serial.print(line);
+  }
+};
+
+DeviceWebApi webApi;
+
+// wrap a handler in admission control. admitted requests hold their slot
+// until the client disconnects, which for streamed responses is after the
+// last chunk
+ArRequestHandlerFunction admit(RequestPriority priority,
+                               ArRequestHandlerFunction handler) {
+  return [priority, handler](AsyncWebServerRequest *request) {
+    AsyncApiRequest api(request);
+    if (webApi.admit(priority, api)) {
+      handler(request);
+    }
+  };
+}
+
+// take cardDataMutex for a handler, or answer 503 if capture or the
+// re-decode has it for too long
+bool lockCardData(AsyncWebServerRequest *request) {
+  if (!webApi.lockCardData()) {
+    AsyncApiRequest api(request);
+    WebApi::sendBusy(api, RETRY_AFTER_SECONDS);
+    return false;
+  }
+  return true;
+}
+
 void logRequest(const String &url) {
   Serial.println("[*] Webserver: Requested url: " + url);
   Serial.println("[*] Webserver: Serving gzipped file: " + url + ".gz");
@@ -621,71 +1235,72 @@ void sendJsonResponse(AsyncWebServerRequest *request,
   request->send(response);
 }
 
-void handleGeneralSettingsGet(AsyncWebServerRequest *request) {
-  DynamicJsonDocument json(200);
-  json["capturing"] = isCapturing;
-  json["version"] = version;
+void handleCaptureStatsGet(AsyncWebServerRequest *request) {
+  DynamicJsonDocument json(384);
+  json["frames_accepted"] = capture.stats.framesAccepted;
+  json["frames_too_short"] = capture.stats.framesTooShort;
+  json["frames_too_long"] = capture.stats.framesTooLong;
+  json["pulses_too_short"] = capture.stats.pulsesTooShort;
+  json["pulses_too_long"] = capture.stats.pulsesTooLong;
+  json["both_lines_low"] = capture.stats.bothLinesLow;
+
+  int64_t elapsed = esp_timer_get_time() - loopStatsStart;
+  json["idle_percent"] = elapsed > 0 ? loopIdleTime * 100 / elapsed : 0;
+  json["wakeups_per_minute"] = wakeupsPerMinute;
   sendJsonResponse(request, json);
 }
 
-void handleGeneralSettingsPost(AsyncWebServerRequest *request) {
-  int params = request->params();
-  for (int i = 0; i < params; i++) {
-    AsyncWebParameter *p = request->getParam(i);
-    if (p->isPost()) {
-      if (p->name() == "capturing") {
-        String newCapturingState = p->value().c_str();
-        if (newCapturingState == "true") {
-          isCapturing = true;
-        } else if (newCapturingState == "false") {
-          isCapturing = false;
-        }
-      }
-      Serial.printf("[+] Webserver: FormData - [%s]: %s\n", p->name().c_str(),
-                    p->value().c_str());
-    }
-  }
-  request->send(200, "text/plain", "General settings updated");
-}
-
 void handleJsonFileResponse(AsyncWebServerRequest *request,
                             const String &path) {
-  AsyncResponseStream *response =
-      request->beginResponseStream("application/json");
   DynamicJsonDocument json(512);
 
   if (path == "littlefsinfo") {
     json["totalBytes"] = LittleFS.totalBytes();
     json["usedBytes"] = LittleFS.usedBytes();
   } else if (path == "sdcardinfo") {
+    if (!lockCardData(request)) {
+      return;
+    }
     json["totalBytes"] = SD.totalBytes();
     json["usedBytes"] = SD.usedBytes();
+    json["cardDataBytes"] = cardLog.size();
+    json["cardDataAllocatedBytes"] = cardLog.allocated();
+    json["spiFrequency"] = settings.sdSpiFrequency;
+    FallbackStatus fallback = fallbackStorage.status();
+    json["available"] = fallback.sdAvailable;
+    json["full"] = fallback.sdFull;
+    json["flashRingBytes"] = fallback.ringCapacity;
+    json["flashRingPendingRecords"] = fallback.pendingRecords;
+    json["flashRingPendingBytes"] = fallback.pendingBytes;
+    json["flashRingDroppedRecords"] = fallback.ring.dropped;
+    json["flashRingEraseCycles"] = fallback.maxEraseCount;
+    xSemaphoreGive(cardDataMutex);
   }
 
+  AsyncResponseStream *response =
+      request->beginResponseStream("application/json");
   serializeJson(json, *response);
   request->send(response);
 }
 
-void handleCardDataGet(AsyncWebServerRequest *request) {
-  File SDFile = SD.open("/cards.jsonl", FILE_READ);
-  String cardData;
-
-  if (SDFile) {
-    while (SDFile.available()) {
-      cardData = SDFile.readString();
-    }
-    SDFile.close();
-  } else {
-    Serial.println("[-] SD Card: error opening json data");
-  }
-
-  AsyncWebServerResponse *response =
-      request->beginResponse(200, "application/x-ndjson", cardData);
-  request->send(response);
-}
-
 void handleCardDataPost(AsyncWebServerRequest *request) {
-  writeSDFile(jsoncarddataPath, "");
+  if (!lockCardData(request)) {
+    return;
+  }
+  if (!fallbackStorage.sdAvailable()) {
+    xSemaphoreGive(cardDataMutex);
+    request->send(503, "text/plain", "SD card not available");
+    return;
+  }
+  // a running re-decode would bring the deleted records back
+  redecodeProgress.cancel = true;
+  bool cleared = storage.clearRecords();
+  xSemaphoreGive(cardDataMutex);
+  if (!cleared) {
+    Serial.println("[-] SD Card: Failed to clear card data");
+    request->send(500, "text/plain", "Failed to delete card data");
+    return;
+  }
   lastWrittenBitCount = 0;
   for (unsigned char i = 0; i < MAX_BITS; i++) {
     lastWrittenDatabits[i] = 0;
@@ -696,116 +1311,267 @@ void handleCardDataPost(AsyncWebServerRequest *request) {
   request->send(response);
 }
 
-void handleWiFiConfigGet(AsyncWebServerRequest *request) {
-  AsyncResponseStream *response =
-      request->beginResponseStream("application/json");
-  DynamicJsonDocument json(512);
-  json["ssid"] = ssid;
-  json["password"] = password;
-  json["channel"] = channel;
-  json["hidessid"] = hidessid;
-  serializeJson(json, *response);
-  request->send(response);
+void handleRedecodeGet(AsyncWebServerRequest *request) {
+  DynamicJsonDocument json(256);
+  json["running"] = redecodeProgress.running;
+  json["decoder_version"] = DECODER_VERSION;
+  json["bytes_total"] = redecodeProgress.bytesTotal;
+  json["bytes_done"] = redecodeProgress.bytesDone;
+  json["records"] = redecodeProgress.records;
+  json["changed"] = redecodeProgress.changed;
+  if (redecodeProgress.error) {
+    json["error"] = redecodeProgress.error;
+  }
+  sendJsonResponse(request, json);
+}
+
+void handleRedecodePost(AsyncWebServerRequest *request) {
+  if (!lockCardData(request)) {
+    return;
+  }
+  bool started = startRedecode();
+  bool available = fallbackStorage.sdAvailable();
+  xSemaphoreGive(cardDataMutex);
+  if (started) {
+    request->send(200, "text/plain", "Re-decoding card data");
+  } else if (redecodeProgress.running) {
+    request->send(409, "text/plain", "Re-decode already running");
+  } else if (!available) {
+    request->send(503, "text/plain", "SD card not available");
+  } else {
+    request->send(500, "text/plain", "Failed to start re-decode");
+  }
 }
 
-void handleWifiConfigPost(AsyncWebServerRequest *request) {
-  int params = request->params();
+static unsigned long cloneParam(AsyncWebServerRequest *request,
+                                const char *name) {
+  if (!request->hasParam(name)) {
+    return 0;
+  }
+  return strtoul(request->getParam(name)->value().c_str(), NULL, 10);
+}
 
-  for (int i = 0; i < params; i++) {
-    AsyncWebParameter *p = request->getParam(i);
-    if (p->isPost()) {
-      if (p->name() == "ssid") {
-        ssid = p->value().c_str();
-        writeSDFile(ssidPath, ssid.c_str());
-      }
-      if (p->name() == "password") {
-        password = p->value().c_str();
-        writeSDFile(passwordPath, password.c_str());
-      }
-      if (p->name() == "channel") {
-        channel = p->value().c_str();
-        writeSDFile(channelPath, channel.c_str());
-      }
-      if (p->name() == "hidessid") {
-        hidessid = p->value().c_str();
-        if (hidessid == "on") {
-          writeSDFile(hidessidPath, "1");
-        } else {
-          writeSDFile(hidessidPath, "0");
-        }
+// clone data for a card, given as a raw frame (raw=0101...) or as values
+// (card_type, bit_length, facility_code, card_number, region_code,
+// issue_level) which are encoded into a frame first
+void handleCardDataCloneGet(AsyncWebServerRequest *request) {
+  CardData card;
+  bool decoded;
+  if (request->hasParam("raw")) {
+    String raw = request->getParam("raw")->value();
+    if (raw.length() == 0 || raw.length() > MAX_BITS) {
+      request->send(400, "text/plain", "Invalid raw frame");
+      return;
+    }
+    unsigned char bits[MAX_BITS];
+    for (unsigned int i = 0; i < raw.length(); i++) {
+      if (raw[i] != '0' && raw[i] != '1') {
+        request->send(400, "text/plain", "Invalid raw frame");
+        return;
       }
-      Serial.printf("[+] Webserver: FormData - [%s]: %s\n", p->name().c_str(),
-                    p->value().c_str());
+      bits[i] = raw[i] - '0';
+    }
+    decoded = decodeCard(bits, raw.length(), card);
+  } else {
+    String type = request->hasParam("card_type")
+                      ? request->getParam("card_type")->value()
+                      : String("hid");
+    if (type == "hid") {
+      card.cardType = HID;
+      card.bitCount = request->hasParam("bit_length")
+                          ? cloneParam(request, "bit_length")
+                          : 26;
+    } else if (type == "gallagher") {
+      card.cardType = GALLAGHER;
+      card.bitCount = 96;
+    } else {
+      request->send(400, "text/plain", "Unsupported card type");
+      return;
     }
-    request->send(200, "text/plain", "WiFi config updated. Rebooting now");
+    card.facilityCode = cloneParam(request, "facility_code");
+    card.cardNumber = cloneParam(request, "card_number");
+    card.regionCode = cloneParam(request, "region_code");
+    card.issueLevel = cloneParam(request, "issue_level");
+    decoded = encodeCard(card);
+  }
+
+  T5577Clone clone;
+  if (!decoded || !cloneToT5577(card, clone)) {
+    request->send(422, "text/plain", "Card can't be cloned");
+    return;
+  }
+
+  DynamicJsonDocument json(768);
+  cardToJson(card, json);
+  JsonObject t5577 = json.createNestedObject("t5577");
+  JsonArray blocks = t5577.createNestedArray("blocks");
+  for (int i = 0; i < T5577_CLONE_BLOCKS; i++) {
+    char block[9];
+    snprintf(block, sizeof(block), "%08lX", (unsigned long)clone.blocks[i]);
+    blocks.add(block);
+  }
+  t5577["proxmark"] = clone.proxmark;
+  sendJsonResponse(request, json);
+}
+
+void handleTimePost(AsyncWebServerRequest *request) {
+  if (!request->hasParam("epoch", true)) {
+    request->send(400, "text/plain", "Missing epoch");
+    return;
   }
+  struct timeval tv;
+  tv.tv_sec = strtoul(request->getParam("epoch", true)->value().c_str(), NULL,
+                      10);
+  tv.tv_usec = 0;
+  if (tv.tv_sec <= MIN_VALID_EPOCH) {
+    request->send(400, "text/plain", "Invalid epoch");
+    return;
+  }
+  settimeofday(&tv, NULL);
+  Serial.printf("[+] Tusk: Clock set to %lu\n", (unsigned long)tv.tv_sec);
+  request->send(200, "text/plain", "Clock updated");
 }
 
 void handleReboot(AsyncWebServerRequest *request) {
   AsyncWebServerResponse *response =
       request->beginResponse(200, "text/plain", "Rebooting device");
   request->send(response);
-  delay(5000);
-  Serial.println("[*] Rebooting...");
-  ESP.restart();
-}
-
-void setupWebServer() {
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    handleGzippedFile(request, "/index.html", "text/html");
+  // give the response time to go out
+  rebootTimer.once(5, []() {
+    Serial.println("[*] Rebooting...");
+    ESP.restart();
   });
+}
 
-  server.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
-    handleGzippedFile(request, "/favicon.ico", "image/png");
-  });
+void latencyToJson(const AppendLatency &latency, JsonObject json) {
+  json["mean_us"] = latency.mean;
+  json["p50_us"] = latency.p50;
+  json["p90_us"] = latency.p90;
+  json["p99_us"] = latency.p99;
+  json["max_us"] = latency.max;
+}
 
-  server.on("/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
-    handleGzippedFile(request, "/index.html", "text/html");
-  });
+void handleSdBenchGet(AsyncWebServerRequest *request) {
+  DynamicJsonDocument json(512);
+  json["running"] = sdBench.running;
+  json["records"] = sdBench.records;
+  json["spi_khz"] = settings.sdSpiFrequency / 1000;
+  if (!sdBench.running && sdBench.records > 0 && !sdBench.error) {
+    latencyToJson(sdBench.append, json.createNestedObject("append"));
+    latencyToJson(sdBench.preallocated,
+                  json.createNestedObject("preallocated"));
+  }
+  if (sdBench.error) {
+    json["error"] = sdBench.error;
+  }
+  sendJsonResponse(request, json);
+}
 
-  server.on("/assets/*", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String url = request->url();
-    String contentType = getUrlExtension(url);
+void handleSdBenchPost(AsyncWebServerRequest *request) {
+  unsigned int records = SD_BENCH_RECORDS;
+  if (request->hasParam("records", true)) {
+    records = request->getParam("records", true)->value().toInt();
+  }
+  if (records < 1 || records > SD_BENCH_MAX_RECORDS) {
+    request->send(400, "text/plain", "Invalid record count");
+    return;
+  }
+  if (startSdBench(records)) {
+    request->send(200, "text/plain", "Benchmarking SD card appends");
+  } else if (sdBench.running) {
+    request->send(409, "text/plain", "Benchmark already running");
+  } else {
+    request->send(500, "text/plain", "Failed to start benchmark");
+  }
+}
 
-    handleGzippedFile(request, url.c_str(), contentType.c_str());
-  });
+void setupWebServer() {
+  // interface files
+  server.on("/", HTTP_GET,
+            admit(PRIORITY_NORMAL, [](AsyncWebServerRequest *request) {
+              handleGzippedFile(request, "/index.html", "text/html");
+            }));
+
+  server.on("/favicon.ico", HTTP_GET,
+            admit(PRIORITY_NORMAL, [](AsyncWebServerRequest *request) {
+              handleGzippedFile(request, "/favicon.ico", "image/png");
+            }));
+
+  server.on("/settings", HTTP_GET,
+            admit(PRIORITY_NORMAL, [](AsyncWebServerRequest *request) {
+              handleGzippedFile(request, "/index.html", "text/html");
+            }));
+
+  server.on("/assets/*", HTTP_GET,
+            admit(PRIORITY_NORMAL, [](AsyncWebServerRequest *request) {
+              String url = request->url();
+              String contentType = getUrlExtension(url);
+
+              handleGzippedFile(request, url.c_str(), contentType.c_str());
+            }));
 
   server.on("/api/device/littlefsinfo", HTTP_GET,
-            [](AsyncWebServerRequest *request) {
+            admit(PRIORITY_LIVE, [](AsyncWebServerRequest *request) {
               handleJsonFileResponse(request, "littlefsinfo");
-            });
+            }));
 
   server.on("/api/device/sdcardinfo", HTTP_GET,
-            [](AsyncWebServerRequest *request) {
+            admit(PRIORITY_NORMAL, [](AsyncWebServerRequest *request) {
               handleJsonFileResponse(request, "sdcardinfo");
-            });
-
-  server.on("/api/device/settings/general", HTTP_GET, handleGeneralSettingsGet);
-  server.on("/api/device/settings/general", HTTP_POST,
-            handleGeneralSettingsPost);
-
-  server.on("/api/carddata", HTTP_GET, handleCardDataGet);
-  server.on("/api/carddata", HTTP_POST, handleCardDataPost);
-
-  server.on("/api/device/wificonfig", HTTP_GET, handleWiFiConfigGet);
-  server.on("/api/device/wificonfig", HTTP_POST, handleWifiConfigPost);
-
-  server.on("/api/device/reboot", HTTP_POST, handleReboot);
+            }));
+
+  server.on("/api/carddata/clone", HTTP_GET,
+            admit(PRIORITY_LIVE, handleCardDataCloneGet));
+  server.on("/api/carddata/redecode", HTTP_GET,
+            admit(PRIORITY_LIVE, handleRedecodeGet));
+  server.on("/api/carddata/redecode", HTTP_POST,
+            admit(PRIORITY_LIVE, handleRedecodePost));
+  server.on("/api/carddata", HTTP_POST,
+            admit(PRIORITY_NORMAL, handleCardDataPost));
+
+  server.on("/api/device/capturestats", HTTP_GET,
+            admit(PRIORITY_LIVE, handleCaptureStatsGet));
+  server.on("/api/device/sdbench", HTTP_GET,
+            admit(PRIORITY_LIVE, handleSdBenchGet));
+  server.on("/api/device/sdbench", HTTP_POST,
+            admit(PRIORITY_LIVE, handleSdBenchPost));
+  server.on("/api/device/time", HTTP_POST,
+            admit(PRIORITY_LIVE, handleTimePost));
+  server.on("/api/device/reboot", HTTP_POST,
+            admit(PRIORITY_LIVE, handleReboot));
+
+  // settings, wifi config, stats and card data (web_api.h). registered last,
+  // /api/carddata also matches the paths under it
+  for (size_t i = 0; i < apiRouteCount; i++) {
+    const ApiRoute &route = apiRoutes[i];
+    server.on(route.path, route.post ? HTTP_POST : HTTP_GET,
+              [&route](AsyncWebServerRequest *request) {
+                AsyncApiRequest api(request);
+                webApi.handle(route, api);
+              });
+  }
 
   server.onNotFound([](AsyncWebServerRequest *request) { request->send(404); });
 }
 
 void setup() {
   Serial.begin(115200);
+  cardDataMutex = xSemaphoreCreateMutex();
+  cardDataBootId = esp_random();
+  settings.sdSpiFrequency = SD_SPI_FREQUENCY;
 
   // initialize SD card
   pinMode(sd_cs, OUTPUT);
   delay(3000);
-  if (!SD.begin(sd_cs)) {
+  bool sdMounted =
+      SD.begin(sd_cs, SPI, SD_SPI_FREQUENCY, "/sd", SD_MAX_OPEN_FILES);
+  if (!sdMounted) {
     Serial.println("[-] SD Card: An error occurred while initializing");
-    Serial.println("[-] SD Card: Fix & Power Cycle");
+    Serial.println("[*] SD Card: Card data is stored in flash until a card "
+                   "is inserted");
   } else {
     Serial.println("[+] SD Card: Initialized successfully");
+    setupSdClock();
   }
 
   // initialize LittleFS
@@ -816,15 +1582,31 @@ void setup() {
     Serial.println("[+] LittleFS: Mounted successfully");
   }
 
+  // initialize the flash ring
+  if (!ringFlash.begin()) {
+    Serial.println("[-] Flash: No cardring partition, card data is only "
+                   "stored on the SD card");
+  } else if (!fallbackStorage.begin(ringFlash)) {
+    Serial.println("[-] Flash: Failed to open the card ring");
+  } else {
+    FallbackStatus fallback = fallbackStorage.status();
+    Serial.printf("[+] Flash: Card ring holds %u bytes, %lu records waiting "
+                  "for the SD card\n",
+                  (unsigned int)fallback.ringCapacity,
+                  fallback.pendingRecords);
+  }
+
   // Check if ssid.txt file exists on SD card
   delay(3000);
-  if (!SD.exists(ssidPath)) {
+  if (!sdMounted) {
+    Serial.println("[-] WiFi Config: No SD card, using the default config");
+  } else if (!SD.exists(ssidPath)) {
     Serial.println("[-] WiFi Config: ssid.txt file not found");
     // If file doesn't exist, create wifi config files
-    writeSDFile(ssidPath, "Tusk");
-    writeSDFile(passwordPath, "changeme");
-    writeSDFile(channelPath, "1");
-    writeSDFile(hidessidPath, "0");
+    webApi.saveSetting(ssidPath, defaultSsid);
+    webApi.saveSetting(passwordPath, defaultPassword);
+    webApi.saveSetting(channelPath, defaultChannel);
+    webApi.saveSetting(hidessidPath, defaultHidessid);
     Serial.println("[+] WiFi Config: WiFi config files created");
     Serial.println("[*] WiFi Config: Rebooting...");
     delay(3000);
@@ -834,20 +1616,27 @@ void setup() {
                    "config files exist >.>");
   }
 
-  ssid = readSDFileLF(ssidPath);
-  password = readSDFileLF(passwordPath);
-  channel = readSDFileLF(channelPath);
-  hidessid = readSDFileLF(hidessidPath);
+  if (sdMounted) {
+    settings.ssid = loadSetting(ssidPath).c_str();
+    settings.password = loadSetting(passwordPath).c_str();
+    settings.channel = loadSetting(channelPath).c_str();
+    settings.hidessid = loadSetting(hidessidPath).c_str();
+  } else {
+    settings.ssid = defaultSsid;
+    settings.password = defaultPassword;
+    settings.channel = defaultChannel;
+    settings.hidessid = defaultHidessid;
+  }
 
   // initialize wifi
   WiFi.disconnect();
   WiFi.mode(WIFI_OFF);
   WiFi.mode(WIFI_AP);
   WiFi.softAPConfig(local_ip, gateway, subnet);
-  WiFi.softAP(ssid.c_str(), password.c_str(), channel.toInt(),
-              hidessid.toInt());
+  WiFi.softAP(settings.ssid.c_str(), settings.password.c_str(),
+              atoi(settings.channel.c_str()), atoi(settings.hidessid.c_str()));
   Serial.print("[+] WiFi: Creating access point: ");
-  Serial.println(ssid);
+  Serial.println(settings.ssid.c_str());
   Serial.print("[+] WiFi: Gateway IP address: ");
   Serial.println(local_ip);
 
@@ -855,14 +1644,18 @@ void setup() {
   pinMode(DATA0, INPUT); // DATA0 (INT0)
   pinMode(DATA1, INPUT); // DATA1 (INT1)
 
-  // binds the ISR functions to the falling edge of INT0 and INT1
-  attachInterrupt(DATA0, ISR_INT0, FALLING);
-  attachInterrupt(DATA1, ISR_INT1, FALLING);
-  weigandCounter = WEIGAND_WAIT_TIME;
+  // binds the ISR functions to INT0 and INT1 going low, the ISRs then flip
+  // between low and high to catch both edges of every pulse
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+  attachDataInterrupt(DATA0, ISR_INT0);
+  attachDataInterrupt(DATA1, ISR_INT1);
 
   // check for cards.jsonl on SD card
   delay(3000);
-  if (!SD.exists("/cards.jsonl")) {
+  if (!sdMounted) {
+    Serial.println("[-] SD Card: Not mounted, looking for it every 30s");
+  } else if (!SD.exists("/cards.jsonl")) {
     Serial.println("[-] SD Card: File cards.jsonl not found");
     Serial.println(
         "[*] SD Card: Created cards.jsonl and performing software reset");
@@ -875,6 +1668,25 @@ void setup() {
   } else {
     Serial.println("[+] SD Card: Found cards.jsonl");
   }
+  if (sdMounted && !cardLog.begin(SD, jsoncarddataPath)) {
+    Serial.println("[-] SD Card: Failed to open cards.jsonl");
+  }
+  fallbackStorage.setSdAvailable(cardLog.isOpen());
+  initRecordId();
+
+  // records stored by older firmware are re-decoded in the background
+  if (cardLog.isOpen() &&
+      readSDFileLF(decoderVersionPath).toInt() != DECODER_VERSION) {
+    Serial.println("[*] Tusk: Decoders updated since card data was stored");
+    xSemaphoreTake(cardDataMutex, portMAX_DELAY);
+    startRedecode();
+    xSemaphoreGive(cardDataMutex);
+  }
+
+  // records in flash go to the sd card once it's there
+  if (!startMigration()) {
+    Serial.println("[-] Tusk: Failed to start the flash migration task");
+  }
 
   setupWebServer();
 
@@ -885,46 +1697,48 @@ void setup() {
   for (unsigned char i = 0; i < MAX_BITS; i++) {
     lastWrittenDatabits[i] = 0;
   }
+
+  loopStatsStart = esp_timer_get_time();
+  wakeupWindowStart = loopStatsStart;
 }
 
 void loop() {
-  if (isCapturing) {
+  if (settings.capturing) {
+
+    // nothing to do until the interrupts see the first bit of a frame
+    if (!capture.hasBits()) {
+      reserveCardLog();
+      fallbackStorage.reserve();
+      idleWait(pdMS_TO_TICKS(IDLE_TIMEOUT));
+      return;
+    }
 
-    if (!flagDone) {
-      if (--weigandCounter == 0)
-        flagDone = 1;
+    // wait for the rest of the frame
+    if (!capture.frameComplete(micros())) {
+      idleWait(pdMS_TO_TICKS(FRAME_GAP / 1000));
+      return;
     }
 
-    // if there are bits and the weigand counter went out
-    if (bitCount > 0 && flagDone) {
-
-      // Check if card data has changed
-      if (cardDataChanged()) {
-        processCardData();
-        printCardData();
-
-        // check if card data is valid before writing to SD card
-        // bitCount either within HID range or equal to Gallagher
-        if (bitCount >= 26 && bitCount <= 36 || bitCount == 96) {
-          if (facilityCode != 0 || cardNumber != 0) {
-            writeToSD();
-            updateLastWrittenCardData();
-          } else {
-            Serial.println("[-] Tusk: Invalid card data detected - blank "
-                           "facility code or card number");
-          }
-        } else {
-          Serial.println("[-] Tusk: Invalid card data detected - bitCount not "
-                         "within valid range");
-        }
-      }
+    // frames that are too short or long are dropped by takeFrame
+    portENTER_CRITICAL(&captureMux);
+    bitCount = capture.takeFrame(databits);
+    portEXIT_CRITICAL(&captureMux);
+
+    // Check if card data has changed
+    if (bitCount > 0 && cardDataChanged()) {
+      processCardData();
+      printCardData(currentCard);
 
-      cleanupCardData();
-      clearDatabits();
+      // raw frames are stored even when they couldn't be decoded, so they
+      // can be re-decoded by newer firmware
+      writeToSD();
+      updateLastWrittenCardData();
     }
+
+    cleanupCardData();
   } else {
     // not capturing data - do nothing
     Serial.println("[-] Tusk: Not capturing data");
     delay(60000);
   }
-}
\ No newline at end of file
+}
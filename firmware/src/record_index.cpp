@@ -0,0 +1,93 @@
+// vim: ts=2 sw=2 et
+
+#include "record_index.h"
+
+#include <string.h>
+
+RecordIndex::RecordIndex() : count(0), next(0) {}
+
+void RecordIndex::reset() {
+  count = 0;
+  next = 0;
+}
+
+void RecordIndex::add(size_t offset, unsigned long id) {
+  if (count > 0) {
+    const Mark &newest = marks[(next + RECORD_INDEX_SIZE - 1) %
+                               RECORD_INDEX_SIZE];
+    if (id < newest.id || offset < newest.offset) {
+      reset();
+    }
+  }
+  marks[next].offset = offset;
+  marks[next].id = id;
+  next = (next + 1) % RECORD_INDEX_SIZE;
+  if (count < RECORD_INDEX_SIZE) {
+    count++;
+  }
+}
+
+void RecordIndex::addTail(const char *tail, size_t length, size_t end) {
+  size_t start = end - length;
+  size_t i = 0;
+  // the first line was cut short unless the tail is the whole log
+  if (start > 0) {
+    const char *newline = (const char *)memchr(tail, '\n', length);
+    if (!newline) {
+      return;
+    }
+    i = newline - tail + 1;
+  }
+  bool found = false;
+  unsigned long id = 0;
+  while (i < length) {
+    const char *line = tail + i;
+    const char *newline = (const char *)memchr(line, '\n', length - i);
+    size_t n = newline ? newline - line : length - i;
+    unsigned long lineId;
+    if (n > 0 && recordLineId(line, n, lineId)) {
+      add(start + i, lineId);
+      found = true;
+      id = lineId;
+    }
+    i += n + 1;
+  }
+  // records stored after the tail carry on from its last id
+  if (found) {
+    add(end, id + 1);
+  }
+}
+
+size_t RecordIndex::start(unsigned long since) const {
+  // the newest mark whose records are all wanted, everything before it has
+  // a lower id
+  for (unsigned int i = 1; i <= count; i++) {
+    const Mark &mark = marks[(next + RECORD_INDEX_SIZE - i) %
+                             RECORD_INDEX_SIZE];
+    if (mark.id <= since + 1) {
+      return mark.offset;
+    }
+  }
+  return 0;
+}
+
+bool recordLineId(const char *line, size_t length, unsigned long &id) {
+  static const char key[] = "\"id\":";
+  const size_t keyLength = sizeof(key) - 1;
+  for (size_t i = 0; i + keyLength < length; i++) {
+    if (memcmp(line + i, key, keyLength) != 0) {
+      continue;
+    }
+    size_t j = i + keyLength;
+    if (line[j] < '0' || line[j] > '9') {
+      return false;
+    }
+    id = 0;
+    while (j < length && line[j] >= '0' && line[j] <= '9') {
+      id = id * 10 + (line[j] - '0');
+      j++;
+    }
+    return true;
+  }
+  return false;
+}
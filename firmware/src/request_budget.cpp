@@ -0,0 +1,58 @@
+// vim: ts=2 sw=2 et
+
+#include "request_budget.h"
+
+RequestBudget::RequestBudget() : total(0), counters() {
+  for (int i = 0; i < PRIORITY_COUNT; i++) {
+    active[i] = 0;
+  }
+}
+
+bool RequestBudget::tryAcquire(RequestPriority priority) {
+  unsigned int limit = MAX_CONCURRENT_REQUESTS;
+  if (priority != PRIORITY_LIVE) {
+    limit -= LIVE_RESERVED_REQUESTS;
+  }
+
+  bool admit = total < limit;
+  if (priority == PRIORITY_BULK) {
+    admit = admit && active[PRIORITY_BULK] < MAX_BULK_REQUESTS;
+  }
+  if (!admit) {
+    counters.rejected[priority]++;
+    return false;
+  }
+
+  total++;
+  active[priority]++;
+  counters.admitted[priority]++;
+  if (total > counters.inFlightPeak) {
+    counters.inFlightPeak = total;
+  }
+  return true;
+}
+
+void RequestBudget::release(RequestPriority priority) {
+  if (active[priority] > 0) {
+    active[priority]--;
+    total--;
+  }
+}
+
+unsigned int RequestBudget::retryAfter(RequestPriority priority) const {
+  return priority == PRIORITY_BULK ? BULK_RETRY_AFTER_SECONDS
+                                   : RETRY_AFTER_SECONDS;
+}
+
+const char *requestPriorityToString(RequestPriority priority) {
+  switch (priority) {
+    case PRIORITY_LIVE:
+      return "live";
+    case PRIORITY_NORMAL:
+      return "normal";
+    case PRIORITY_BULK:
+      return "bulk";
+    default:
+      return "unknown";
+  }
+}
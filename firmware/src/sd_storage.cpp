@@ -0,0 +1,110 @@
+// vim: ts=2 sw=2 et
+
+#include "sd_storage.h"
+
+#include <new>
+#include <string.h>
+
+// reads the log up to its logical end when opened, the preallocated space
+// after it isn't sent
+class SdRecordReader : public RecordReader {
+public:
+  SdRecordReader(File file, size_t start, size_t end)
+      : file(file), remaining(end - start) {
+    if (!this->file.seek(start)) {
+      remaining = 0;
+    }
+  }
+
+  size_t read(uint8_t *buffer, size_t length) override {
+    if (length > remaining) {
+      length = remaining;
+    }
+    size_t n = length > 0 ? file.read(buffer, length) : 0;
+    remaining -= n;
+    return n;
+  }
+
+private:
+  File file;
+  size_t remaining;
+};
+
+SdStorage::SdStorage(fs::FS &fs, CardLog &log, const char *logPath)
+    : fs(fs), log(log), logPath(logPath), indexedOpens(0) {}
+
+// start the index again once the log has been reopened (cleared, replaced by
+// a re-decode or remounted), from the last record in it
+void SdStorage::updateIndex() {
+  if (indexedOpens == log.opens()) {
+    return;
+  }
+  indexedOpens = log.opens();
+  index.reset();
+  size_t end = log.size();
+  if (end == 0) {
+    return;
+  }
+  log.sync();
+  File file = fs.open(logPath, FILE_READ);
+  char tail[RECORD_LINE_SIZE];
+  size_t start = end > sizeof(tail) ? end - sizeof(tail) : 0;
+  if (file && file.seek(start)) {
+    size_t n = file.read((uint8_t *)tail, end - start);
+    index.addTail(tail, n, end);
+  }
+}
+
+bool SdStorage::appendRecord(const char *line, size_t length) {
+  updateIndex();
+  size_t offset = log.size();
+  if (!log.append(line, length)) {
+    return false;
+  }
+  unsigned long id;
+  if (recordLineId(line, length, id)) {
+    index.add(offset, id);
+  }
+  return true;
+}
+
+bool SdStorage::clearRecords() { return log.clear(); }
+
+RecordReader *SdStorage::openFrom(size_t offset) {
+  // records still waiting to be synced aren't seen through a new handle
+  log.sync();
+  File file = fs.open(logPath, FILE_READ);
+  if (!file) {
+    return nullptr;
+  }
+  return new (std::nothrow) SdRecordReader(file, offset, log.size());
+}
+
+RecordReader *SdStorage::openRecords() { return openFrom(0); }
+
+RecordReader *SdStorage::openRecordsSince(unsigned long since) {
+  updateIndex();
+  return openFrom(index.start(since));
+}
+
+bool SdStorage::readSetting(const char *name, char *value, size_t size) {
+  File file = fs.open(name, FILE_READ);
+  if (!file || file.isDirectory() || size == 0) {
+    return false;
+  }
+  // the first line
+  size_t n = file.readBytesUntil('\n', value, size - 1);
+  value[n] = '\0';
+  file.close();
+  return true;
+}
+
+bool SdStorage::writeSetting(const char *name, const char *value) {
+  File file = fs.open(name, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  bool written = file.print(value) == strlen(value);
+  file.close();
+  return written;
+}
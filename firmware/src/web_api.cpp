@@ -0,0 +1,366 @@
+// vim: ts=2 sw=2 et
+
+#include "web_api.h"
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *ssidPath = "/ssid.txt";
+const char *passwordPath = "/password.txt";
+const char *channelPath = "/channel.txt";
+const char *hidessidPath = "/hidessid.txt";
+const char *sdClockPath = "/sdclock.txt";
+
+const ApiRoute apiRoutes[] = {
+    {"/api/carddata/export", false, PRIORITY_BULK, &WebApi::cardDataExport},
+    {"/api/carddata", false, PRIORITY_BULK, &WebApi::cardDataGet},
+    {"/api/device/settings/general", false, PRIORITY_LIVE,
+     &WebApi::generalSettingsGet},
+    {"/api/device/settings/general", true, PRIORITY_LIVE,
+     &WebApi::generalSettingsPost},
+    {"/api/device/wificonfig", false, PRIORITY_LIVE, &WebApi::wifiConfigGet},
+    {"/api/device/wificonfig", true, PRIORITY_NORMAL, &WebApi::wifiConfigPost},
+    {"/api/device/webstats", false, PRIORITY_LIVE, &WebApi::webStatsGet},
+};
+const size_t apiRouteCount = sizeof(apiRoutes) / sizeof(apiRoutes[0]);
+
+// value as a json string
+static std::string jsonString(const std::string &value) {
+  std::string json = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if ((unsigned char)c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+      json += escape;
+    } else {
+      json += c;
+    }
+  }
+  return json + "\"";
+}
+
+static const char *jsonBool(bool value) { return value ? "true" : "false"; }
+
+// a whole number setting within min and max, false if it isn't one
+static bool parseSetting(const char *value, long min, long max,
+                         long &result) {
+  char *end;
+  result = strtol(value, &end, 10);
+  return end != value && *end == '\0' && result >= min && result <= max;
+}
+
+WebApi::WebApi(CardStorage &storage, RequestBudget &budget,
+               WiegandCapture &capture, DeviceSettings &settings)
+    : storage(storage), budget(budget), capture(capture), settings(settings) {}
+
+void WebApi::handle(const ApiRoute &route, ApiRequest &request) {
+  // polls for the newest records only read those, not the whole log
+  RequestPriority priority = route.priority;
+  if (route.handler == &WebApi::cardDataGet && request.param("since")) {
+    priority = PRIORITY_NORMAL;
+  }
+  if (admit(priority, request)) {
+    (this->*route.handler)(request);
+  }
+}
+
+bool WebApi::admit(RequestPriority priority, ApiRequest &request) {
+  if (!budget.tryAcquire(priority)) {
+    sendBusy(request, budget.retryAfter(priority));
+    return false;
+  }
+  request.onDisconnect([this, priority]() { budget.release(priority); });
+  return true;
+}
+
+void WebApi::sendBusy(ApiRequest &request, unsigned int retryAfter) {
+  request.addHeader("Retry-After", std::to_string(retryAfter).c_str());
+  request.send(503, "text/plain", "Busy, try again shortly");
+}
+
+bool WebApi::saveSetting(const char *name, const char *value) {
+  bool saved = storage.writeSetting(name, value);
+  if (saved) {
+    log("[+] Settings: Saved %s\n", name);
+  } else {
+    log("[-] Settings: Failed to save %s\n", name);
+  }
+  return saved;
+}
+
+std::shared_ptr<CardDataExport> WebApi::newExport() {
+  return std::shared_ptr<CardDataExport>(new (std::nothrow) CardDataExport());
+}
+
+// open the card log for a response, from the records with an id above since
+// when filterSince is set. answers the request and returns nothing on
+// failure
+std::shared_ptr<CardDataExport> WebApi::openExport(ApiRequest &request,
+                                                   bool filterSince,
+                                                   unsigned long since,
+                                                   std::string *version) {
+  if (!lockCardData()) {
+    sendBusy(request, RETRY_AFTER_SECONDS);
+    return nullptr;
+  }
+  std::shared_ptr<CardDataExport> exp = newExport();
+  RecordReader *reader = nullptr;
+  if (exp) {
+    reader = filterSince ? storage.openRecordsSince(since)
+                         : storage.openRecords();
+    if (version) {
+      *version = cardDataVersion();
+    }
+  }
+  unlockCardData();
+
+  if (!exp) {
+    request.send(503, "text/plain", "Not enough memory for export");
+    return nullptr;
+  }
+  if (!reader) {
+    log("[-] SD Card: error opening json data\n");
+    request.send(500, "text/plain", "Failed to open card data");
+    return nullptr;
+  }
+  exp->begin(reader);
+  exp->filterSince = filterSince;
+  exp->since = since;
+  return exp;
+}
+
+void WebApi::sendCardData(ApiRequest &request,
+                          std::shared_ptr<CardDataExport> exp) {
+  const char *contentType = "application/x-ndjson";
+  if (exp->msgpack) {
+    contentType = "application/x-msgpack";
+  } else if (exp->csv) {
+    contentType = "text/csv";
+  }
+  if (exp->compress) {
+    request.addHeader("Content-Encoding", "gzip");
+  }
+  request.sendStream(contentType, [this, exp](uint8_t *buffer,
+                                              size_t maxLen) -> size_t {
+    size_t n = exp->fill(buffer, maxLen);
+    if (n == 0 && exp->compress) {
+      log("[+] Webserver: Export done, %u bytes compressed to %u\n",
+          (unsigned int)exp->bytesIn(), (unsigned int)exp->bytesOut());
+    }
+    return n;
+  });
+}
+
+void WebApi::cardDataExport(ApiRequest &request) {
+  std::shared_ptr<CardDataExport> exp =
+      openExport(request, false, 0, nullptr);
+  if (!exp) {
+    return;
+  }
+
+  const char *format = request.param("format");
+  if (format) {
+    exp->csv = strcmp(format, "csv") == 0;
+    exp->msgpack = strcmp(format, "msgpack") == 0;
+  }
+  const char *gzip = request.param("gzip");
+  if (gzip) {
+    exp->compress = strcmp(gzip, "0") != 0;
+  }
+  const char *from = request.param("from");
+  if (from) {
+    exp->filterTime = true;
+    exp->from = strtoul(from, NULL, 10);
+  }
+  const char *to = request.param("to");
+  if (to) {
+    exp->filterTime = true;
+    exp->to = strtoul(to, NULL, 10);
+  }
+
+  const char *disposition = "attachment; filename=cards.jsonl";
+  if (exp->msgpack) {
+    disposition = "attachment; filename=cards.msgpack";
+  } else if (exp->csv) {
+    disposition = "attachment; filename=cards.csv";
+  }
+  request.addHeader("Content-Disposition", disposition);
+  sendCardData(request, exp);
+}
+
+// the whole log, streamed as stored or as msgpack when asked for with
+// ?format=msgpack or an Accept header
+void WebApi::cardDataGet(ApiRequest &request) {
+  // the web interface polls for records added since the newest it has, which
+  // are read from near the end of the log
+  const char *sinceParam = request.param("since");
+  unsigned long since = sinceParam ? strtoul(sinceParam, NULL, 10) : 0;
+  std::string version;
+  std::shared_ptr<CardDataExport> exp =
+      openExport(request, sinceParam != nullptr, since, &version);
+  if (!exp) {
+    return;
+  }
+  exp->compress = false;
+  const char *format = request.param("format");
+  const char *accept = request.header("Accept");
+  if (format) {
+    exp->msgpack = strcmp(format, "msgpack") == 0;
+  } else {
+    exp->msgpack = accept && strstr(accept, "msgpack");
+  }
+  if (!version.empty()) {
+    request.addHeader("X-Card-Data-Version", version.c_str());
+  }
+  sendCardData(request, exp);
+}
+
+void WebApi::generalSettingsGet(ApiRequest &request) {
+  char json[256];
+  snprintf(json, sizeof(json),
+           "{\"capturing\":%s,\"version\":%s,\"pulse_min_us\":%lu,"
+           "\"pulse_max_us\":%lu,\"min_frame_bits\":%u,\"power_save\":%s,"
+           "\"light_sleep\":%s,\"sd_spi_khz\":%lu}",
+           jsonBool(settings.capturing),
+           jsonString(settings.version).c_str(),
+           (unsigned long)capture.minPulseWidth,
+           (unsigned long)capture.maxPulseWidth, capture.minFrameBits,
+           jsonBool(settings.powerSave), jsonBool(settings.lightSleep),
+           (unsigned long)(settings.sdSpiFrequency / 1000));
+  request.send(200, "application/json", json);
+}
+
+void WebApi::generalSettingsPost(ApiRequest &request) {
+  // the capture settings are checked together before any are changed, a bad
+  // one would stop every card being captured
+  long pulseMin = capture.minPulseWidth;
+  long pulseMax = capture.maxPulseWidth;
+  long frameBits = capture.minFrameBits;
+  long khz = 0;
+  bool saveKhz = false;
+  size_t fields = request.formFieldCount();
+  for (size_t i = 0; i < fields; i++) {
+    const char *name = request.formFieldName(i);
+    const char *value = request.formFieldValue(i);
+    bool valid = true;
+    if (strcmp(name, "pulse_min_us") == 0) {
+      valid = parseSetting(value, 1, FRAME_GAP, pulseMin);
+    } else if (strcmp(name, "pulse_max_us") == 0) {
+      valid = parseSetting(value, 1, FRAME_GAP, pulseMax);
+    } else if (strcmp(name, "min_frame_bits") == 0) {
+      valid = parseSetting(value, 1, MAX_BITS - 1, frameBits);
+    } else if (strcmp(name, "sd_spi_khz") == 0) {
+      valid = parseSetting(value, SD_SPI_MIN_KHZ, SD_SPI_MAX_KHZ, khz);
+      saveKhz = true;
+    }
+    if (!valid) {
+      request.send(400, "text/plain", std::string("Invalid ") + name);
+      return;
+    }
+  }
+  if (pulseMin > pulseMax) {
+    request.send(400, "text/plain",
+                 "pulse_min_us must not be above pulse_max_us");
+    return;
+  }
+  // the clock is saved on the card, which the firmware may be remounting
+  if (saveKhz && !lockCardData()) {
+    sendBusy(request, RETRY_AFTER_SECONDS);
+    return;
+  }
+
+  for (size_t i = 0; i < fields; i++) {
+    const char *name = request.formFieldName(i);
+    const char *value = request.formFieldValue(i);
+    if (strcmp(name, "capturing") == 0) {
+      if (strcmp(value, "true") == 0) {
+        settings.capturing = true;
+      } else if (strcmp(value, "false") == 0) {
+        settings.capturing = false;
+      }
+    }
+    if (strcmp(name, "power_save") == 0) {
+      setPowerSave(strcmp(value, "true") == 0);
+    }
+    // the card is only remounted at boot
+    if (strcmp(name, "sd_spi_khz") == 0) {
+      saveSetting(sdClockPath, std::to_string(khz).c_str());
+    }
+    log("[+] Webserver: FormData - [%s]: %s\n", name, value);
+  }
+  if (saveKhz) {
+    unlockCardData();
+  }
+  capture.minPulseWidth = pulseMin;
+  capture.maxPulseWidth = pulseMax;
+  capture.minFrameBits = frameBits;
+  request.send(200, "text/plain", "General settings updated");
+}
+
+void WebApi::wifiConfigGet(ApiRequest &request) {
+  request.send(200, "application/json",
+               "{\"ssid\":" + jsonString(settings.ssid) +
+                   ",\"password\":" + jsonString(settings.password) +
+                   ",\"channel\":" + jsonString(settings.channel) +
+                   ",\"hidessid\":" + jsonString(settings.hidessid) + "}");
+}
+
+void WebApi::wifiConfigPost(ApiRequest &request) {
+  // the settings are saved on the card, which the firmware may be
+  // remounting
+  if (!lockCardData()) {
+    sendBusy(request, RETRY_AFTER_SECONDS);
+    return;
+  }
+  size_t fields = request.formFieldCount();
+  for (size_t i = 0; i < fields; i++) {
+    const char *name = request.formFieldName(i);
+    const char *value = request.formFieldValue(i);
+    if (strcmp(name, "ssid") == 0) {
+      settings.ssid = value;
+      saveSetting(ssidPath, value);
+    }
+    if (strcmp(name, "password") == 0) {
+      settings.password = value;
+      saveSetting(passwordPath, value);
+    }
+    if (strcmp(name, "channel") == 0) {
+      settings.channel = value;
+      saveSetting(channelPath, value);
+    }
+    if (strcmp(name, "hidessid") == 0) {
+      settings.hidessid = value;
+      saveSetting(hidessidPath, strcmp(value, "on") == 0 ? "1" : "0");
+    }
+    log("[+] Webserver: FormData - [%s]: %s\n", name, value);
+  }
+  unlockCardData();
+  request.send(200, "text/plain", "WiFi config updated. Rebooting now");
+}
+
+void WebApi::webStatsGet(ApiRequest &request) {
+  const RequestStats &stats = budget.stats();
+  char json[512];
+  size_t n = snprintf(json, sizeof(json),
+                      "{\"in_flight\":%u,\"in_flight_peak\":%u,"
+                      "\"max_concurrent\":%d",
+                      budget.inFlight(), stats.inFlightPeak,
+                      MAX_CONCURRENT_REQUESTS);
+  for (int i = 0; i < PRIORITY_COUNT && n < sizeof(json); i++) {
+    RequestPriority priority = (RequestPriority)i;
+    n += snprintf(json + n, sizeof(json) - n,
+                  ",\"%s\":{\"in_flight\":%u,\"admitted\":%lu,"
+                  "\"rejected\":%lu}",
+                  requestPriorityToString(priority), budget.inFlight(priority),
+                  stats.admitted[i], stats.rejected[i]);
+  }
+  if (n < sizeof(json)) {
+    snprintf(json + n, sizeof(json) - n, "}");
+  }
+  request.send(200, "application/json", json);
+}
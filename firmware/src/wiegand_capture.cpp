@@ -0,0 +1,92 @@
+// vim: ts=2 sw=2 et
+
+#include "wiegand_capture.h"
+
+WiegandCapture::WiegandCapture()
+    : minPulseWidth(MIN_PULSE_WIDTH), maxPulseWidth(MAX_PULSE_WIDTH),
+      minFrameBits(MIN_FRAME_BITS), wakeCompensation(false), stats(),
+      bitCount(0), overflow(false), lastBitTime(0) {
+  for (int i = 0; i < 2; i++) {
+    pulseStart[i] = 0;
+    pulseActive[i] = false;
+    pulseRejected[i] = false;
+  }
+}
+
+// a bit is only taken once its pulse has ended (line back high) and its
+// width is within the glitch filter window
+bool IRAM_ATTR WiegandCapture::onEdge(unsigned char line, bool lineLow,
+                                      bool otherLow, uint32_t now) {
+  if (lineLow) {
+    pulseStart[line] = now;
+    pulseActive[line] = true;
+    pulseRejected[line] = false;
+    // both lines low is never valid weigand, drop both pulses
+    if (otherLow) {
+      pulseRejected[0] = true;
+      pulseRejected[1] = true;
+      stats.bothLinesLow++;
+    }
+    return false;
+  }
+
+  bool measured = pulseActive[line];
+  pulseActive[line] = false;
+  if (pulseRejected[line]) {
+    pulseRejected[line] = false;
+    return false;
+  }
+
+  bool firstBit = bitCount == 0 && !overflow;
+  bool compensate = firstBit && wakeCompensation;
+  if (!measured && !compensate) {
+    // the line went high without us seeing it go low
+    stats.pulsesTooShort++;
+    return false;
+  }
+  if (measured) {
+    uint32_t width = now - pulseStart[line];
+    if (width < minPulseWidth && !compensate) {
+      stats.pulsesTooShort++;
+      return false;
+    }
+    if (width > maxPulseWidth) {
+      stats.pulsesTooLong++;
+      return false;
+    }
+  }
+
+  if (bitCount < MAX_BITS) {
+    bits[bitCount] = line;
+    bitCount++;
+  } else {
+    overflow = true;
+  }
+  lastBitTime = now;
+  return firstBit;
+}
+
+bool WiegandCapture::frameComplete(uint32_t now) const {
+  return (bitCount > 0 || overflow) && now - lastBitTime >= FRAME_GAP;
+}
+
+unsigned int WiegandCapture::takeFrame(unsigned char *frame) {
+  unsigned int count = bitCount;
+  bool overflowed = overflow;
+  for (unsigned int i = 0; i < count; i++) {
+    frame[i] = bits[i];
+  }
+  bitCount = 0;
+  overflow = false;
+
+  if (overflowed) {
+    stats.framesTooLong++;
+    return 0;
+  }
+  if (count < minFrameBits) {
+    stats.framesTooShort++;
+    return 0;
+  }
+  stats.framesAccepted++;
+  return count;
+}
@@ -0,0 +1,752 @@
+// vim: ts=2 sw=2 et
+
+// merge and summarise cards.jsonl logs from several devices
+//
+// usage: analyze_logs [-j threads] [-o merged.jsonl] [-v | -q] <cards.jsonl>...
+//
+// every log is memory mapped and split into chunks that worker threads take
+// from their own queue, stealing from the others once it runs dry. raw bits
+// are re-decoded with the firmware's decoders (once per distinct frame per
+// thread), and credentials are de-duplicated across all logs by their raw
+// bits. prints per-format and per-facility-code summaries, and with -o
+// writes every distinct credential sorted by type, facility code and card
+// number, with how often, when and by which devices it was seen.
+//
+// the busiest facility codes are listed, -v lists all of them and -q only
+// prints the totals. a log's device name is its file name without
+// extension, or the name of the directory it is in for logs called
+// cards.jsonl.
+
+#include "card_decoder.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// logs are split into chunks of about this size
+static const size_t kChunkSize = 1 << 20;
+// per-thread results are sharded by the top 6 bits of the key's hash so
+// they can be merged in parallel
+static const unsigned int kShardBits = 6;
+static const unsigned int kShards = 1 << kShardBits;
+// facility codes listed without -v
+static const size_t kFacilitiesShown = 20;
+// devices are tracked in a 64 bit mask
+static const size_t kMaxLogs = 64;
+
+struct LogFile {
+  std::string path;
+  std::string device;
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+// a range of whole lines in one log
+struct Chunk {
+  unsigned int log;
+  size_t begin;
+  size_t end;
+};
+
+// raw frame bits, packed
+struct RawKey {
+  uint64_t words[2];
+  uint8_t length;
+
+  bool operator==(const RawKey &other) const {
+    return length == other.length && words[0] == other.words[0] &&
+           words[1] == other.words[1];
+  }
+  bool operator<(const RawKey &other) const {
+    if (length != other.length) {
+      return length < other.length;
+    }
+    if (words[0] != other.words[0]) {
+      return words[0] < other.words[0];
+    }
+    return words[1] < other.words[1];
+  }
+};
+
+struct RawKeyHash {
+  size_t operator()(const RawKey &key) const {
+    // short frames only use the top bits of words[0], so mix the high bits
+    // all the way down (murmur3 finaliser)
+    uint64_t h = key.words[0] ^ (key.words[1] * 0x9e3779b97f4a7c15ull) ^
+                 key.length;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+};
+
+// what the decoders made of a frame
+struct Decoded {
+  CardType cardType;
+  DecodeStatus status;
+  unsigned long facilityCode;
+  unsigned long cardNumber;
+  unsigned long regionCode;
+  unsigned long issueLevel;
+  char hex[24];
+};
+
+// how often, when and by which devices a frame was seen
+struct Sightings {
+  uint64_t count = 0;
+  // 0 when no sighting had a timestamp
+  uint32_t firstSeen = 0;
+  uint32_t lastSeen = 0;
+  uint64_t devices = 0;
+
+  void add(uint32_t timestamp, unsigned int log) {
+    count++;
+    devices |= 1ull << log;
+    if (timestamp != 0) {
+      if (firstSeen == 0 || timestamp < firstSeen) {
+        firstSeen = timestamp;
+      }
+      if (timestamp > lastSeen) {
+        lastSeen = timestamp;
+      }
+    }
+  }
+
+  void merge(const Sightings &other) {
+    count += other.count;
+    devices |= other.devices;
+    if (other.firstSeen != 0 &&
+        (firstSeen == 0 || other.firstSeen < firstSeen)) {
+      firstSeen = other.firstSeen;
+    }
+    if (other.lastSeen > lastSeen) {
+      lastSeen = other.lastSeen;
+    }
+  }
+};
+
+// a distinct frame. everything touched per record is in here, the decoded
+// fields are only needed once per frame and are kept aside
+struct Credential {
+  RawKey key;
+  uint32_t decoded;
+  Sightings seen;
+};
+
+// open addressing hash table of credentials, a lookup is one cache miss
+// rather than the two or three of a node based map. empty slots have a key
+// length of 0, which no frame has
+class CredentialTable {
+public:
+  CredentialTable() : slots(16), used(0) {}
+
+  // the credential for key, added with a decoded index of UINT32_MAX if it
+  // wasn't there
+  Credential &lookup(const RawKey &key, size_t hash) {
+    if ((used + 1) * 4 > slots.size() * 3) {
+      grow();
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Credential &slot = slots[i];
+      if (slot.key.length == 0) {
+        slot.key = key;
+        slot.decoded = UINT32_MAX;
+        used++;
+        return slot;
+      }
+      if (slot.key == key) {
+        return slot;
+      }
+    }
+  }
+
+  size_t size() const { return used; }
+
+  template <typename F> void forEach(F f) const {
+    for (const Credential &slot : slots) {
+      if (slot.key.length != 0) {
+        f(slot);
+      }
+    }
+  }
+
+  void clear() {
+    std::vector<Credential>().swap(slots);
+    std::vector<Decoded>().swap(decoded);
+    used = 0;
+  }
+
+  std::vector<Decoded> decoded;
+
+private:
+  void grow() {
+    std::vector<Credential> old(slots.size() * 2);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (const Credential &entry : old) {
+      if (entry.key.length == 0) {
+        continue;
+      }
+      size_t i = RawKeyHash()(entry.key) & mask;
+      while (slots[i].key.length != 0) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = entry;
+    }
+  }
+
+  std::vector<Credential> slots;
+  size_t used;
+};
+
+struct WorkerResult {
+  CredentialTable shards[kShards];
+  uint64_t records = 0;
+  uint64_t withoutRaw = 0;
+  uint64_t unreadable = 0;
+  uint64_t chunks = 0;
+  uint64_t stolen = 0;
+};
+
+// per-thread chunk queues. owners take from the back, thieves from the front
+class WorkQueues {
+public:
+  explicit WorkQueues(size_t count) : queues(count) {}
+
+  void push(size_t queue, const Chunk &chunk) {
+    queues[queue].chunks.push_back(chunk);
+  }
+
+  bool take(size_t self, Chunk &chunk, bool &stolen) {
+    if (popBack(queues[self], chunk)) {
+      stolen = false;
+      return true;
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+      if (popFront(queues[(self + i) % queues.size()], chunk)) {
+        stolen = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<Chunk> chunks;
+  };
+
+  static bool popBack(Queue &queue, Chunk &chunk) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.chunks.empty()) {
+      return false;
+    }
+    chunk = queue.chunks.back();
+    queue.chunks.pop_back();
+    return true;
+  }
+
+  static bool popFront(Queue &queue, Chunk &chunk) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.chunks.empty()) {
+      return false;
+    }
+    chunk = queue.chunks.front();
+    queue.chunks.pop_front();
+    return true;
+  }
+
+  std::vector<Queue> queues;
+};
+
+static std::string deviceName(const std::string &path) {
+  size_t slash = path.find_last_of('/');
+  std::string file = slash == std::string::npos ? path : path.substr(slash + 1);
+  std::string stem = file.substr(0, file.find('.'));
+  if (stem == "cards" && slash != std::string::npos && slash > 0) {
+    std::string dir = path.substr(0, slash);
+    size_t parent = dir.find_last_of('/');
+    return parent == std::string::npos ? dir : dir.substr(parent + 1);
+  }
+  return stem;
+}
+
+static bool mapLog(LogFile &log) {
+  int fd = open(log.path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  log.size = st.st_size;
+  if (log.size > 0) {
+    void *data = mmap(nullptr, log.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(data, log.size, MADV_SEQUENTIAL);
+    log.data = (const char *)data;
+  }
+  close(fd);
+  return true;
+}
+
+// find "key": in a record line and return where its value starts
+static const char *findValue(const char *line, const char *end,
+                             const char *key, size_t keyLength) {
+  for (const char *p = line; p + keyLength + 3 <= end; p++) {
+    p = (const char *)memchr(p, '"', end - p);
+    if (!p || p + keyLength + 3 > end) {
+      return nullptr;
+    }
+    if (memcmp(p + 1, key, keyLength) == 0 && p[keyLength + 1] == '"' &&
+        p[keyLength + 2] == ':') {
+      return p + keyLength + 3;
+    }
+  }
+  return nullptr;
+}
+
+static void processLine(const char *line, const char *end, unsigned int log,
+                        WorkerResult &result) {
+  result.records++;
+
+  const char *raw = findValue(line, end, "raw", 3);
+  if (!raw || *raw != '"') {
+    result.withoutRaw++;
+    return;
+  }
+  raw++;
+  const char *rawEnd = (const char *)memchr(raw, '"', end - raw);
+  if (!rawEnd || rawEnd == raw || rawEnd - raw > MAX_BITS) {
+    result.unreadable++;
+    return;
+  }
+
+  RawKey key = {{0, 0}, (uint8_t)(rawEnd - raw)};
+  for (unsigned int i = 0; i < key.length; i++) {
+    if (raw[i] != '0' && raw[i] != '1') {
+      result.unreadable++;
+      return;
+    }
+    if (raw[i] == '1') {
+      key.words[i / 64] |= 1ull << (63 - i % 64);
+    }
+  }
+
+  uint32_t timestamp = 0;
+  // the firmware writes the timestamp after the raw bits
+  const char *ts = findValue(rawEnd, end, "timestamp", 9);
+  if (!ts) {
+    ts = findValue(line, rawEnd, "timestamp", 9);
+  }
+  if (ts) {
+    timestamp = strtoul(ts, nullptr, 10);
+  }
+
+  // the top bits pick the shard, the low bits the slot within it
+  size_t hash = RawKeyHash()(key);
+  CredentialTable &shard = result.shards[hash >> (64 - kShardBits)];
+  Credential &credential = shard.lookup(key, hash);
+  if (credential.decoded == UINT32_MAX) {
+    // first time this thread sees the frame, run the decoders
+    unsigned char bits[MAX_BITS];
+    for (unsigned int i = 0; i < key.length; i++) {
+      bits[i] = raw[i] - '0';
+    }
+    CardData card;
+    decodeCard(bits, key.length, card);
+
+    Decoded decoded;
+    decoded.cardType = card.cardType;
+    decoded.status = card.status;
+    decoded.facilityCode = card.facilityCode;
+    decoded.cardNumber = card.cardNumber;
+    decoded.regionCode = card.regionCode;
+    decoded.issueLevel = card.issueLevel;
+    memcpy(decoded.hex, card.hex, sizeof(decoded.hex));
+    credential.decoded = shard.decoded.size();
+    shard.decoded.push_back(decoded);
+  }
+  credential.seen.add(timestamp, log);
+}
+
+static void processChunk(const LogFile &log, const Chunk &chunk,
+                         WorkerResult &result) {
+  const char *p = log.data + chunk.begin;
+  const char *end = log.data + chunk.end;
+  while (p < end) {
+    const char *newline = (const char *)memchr(p, '\n', end - p);
+    const char *lineEnd = newline ? newline : end;
+    if (lineEnd > p && *p == '{') {
+      processLine(p, lineEnd, chunk.log, result);
+    } else if (lineEnd > p) {
+      result.unreadable++;
+    }
+    p = lineEnd + 1;
+  }
+}
+
+// chunks end at a newline, so no line is split between threads
+static void splitLog(const std::vector<LogFile> &logs, unsigned int index,
+                     std::vector<Chunk> &chunks) {
+  const LogFile &log = logs[index];
+  size_t begin = 0;
+  while (begin < log.size) {
+    size_t end = std::min(log.size, begin + kChunkSize);
+    if (end < log.size) {
+      const char *newline =
+          (const char *)memchr(log.data + end, '\n', log.size - end);
+      end = newline ? newline - log.data + 1 : log.size;
+    }
+    chunks.push_back({index, begin, end});
+    begin = end;
+  }
+}
+
+struct FormatKey {
+  CardType cardType;
+  unsigned int bitLength;
+  DecodeStatus status;
+
+  bool operator<(const FormatKey &other) const {
+    if (cardType != other.cardType) {
+      return cardType < other.cardType;
+    }
+    if (bitLength != other.bitLength) {
+      return bitLength < other.bitLength;
+    }
+    return status < other.status;
+  }
+};
+
+struct FacilityKey {
+  CardType cardType;
+  unsigned long regionCode;
+  unsigned long facilityCode;
+
+  bool operator<(const FacilityKey &other) const {
+    if (cardType != other.cardType) {
+      return cardType < other.cardType;
+    }
+    if (regionCode != other.regionCode) {
+      return regionCode < other.regionCode;
+    }
+    return facilityCode < other.facilityCode;
+  }
+};
+
+struct Summary {
+  uint64_t unique = 0;
+  uint64_t sightings = 0;
+  uint64_t devices = 0;
+};
+
+static int deviceCount(uint64_t devices) {
+  return __builtin_popcountll(devices);
+}
+
+typedef std::pair<const Credential *, const Decoded *> SortedCredential;
+
+static bool credentialOrder(const SortedCredential &a,
+                            const SortedCredential &b) {
+  const Decoded &x = *a.second;
+  const Decoded &y = *b.second;
+  if (x.cardType != y.cardType) {
+    return x.cardType < y.cardType;
+  }
+  if (x.facilityCode != y.facilityCode) {
+    return x.facilityCode < y.facilityCode;
+  }
+  if (x.cardNumber != y.cardNumber) {
+    return x.cardNumber < y.cardNumber;
+  }
+  return a.first->key < b.first->key;
+}
+
+static void writeMerged(FILE *out, const std::vector<SortedCredential> &sorted,
+                        const std::vector<LogFile> &logs) {
+  std::vector<char> buffer(1 << 16);
+  setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+  for (const SortedCredential &entry : sorted) {
+    const RawKey &key = entry.first->key;
+    const Sightings &seen = entry.first->seen;
+    const Decoded &c = *entry.second;
+    char raw[MAX_BITS + 1];
+    for (unsigned int i = 0; i < key.length; i++) {
+      raw[i] = (key.words[i / 64] >> (63 - i % 64)) & 1 ? '1' : '0';
+    }
+    raw[key.length] = '\0';
+
+    fprintf(out,
+            "{\"card_type\":\"%s\",\"bit_length\":%u,\"facility_code\":%lu,"
+            "\"card_number\":%lu",
+            cardTypeToString(c.cardType), key.length, c.facilityCode,
+            c.cardNumber);
+    if (c.cardType == GALLAGHER) {
+      fprintf(out, ",\"issue_level\":%lu,\"region_code\":%lu", c.issueLevel,
+              c.regionCode);
+    }
+    fprintf(out,
+            ",\"raw\":\"%s\",\"hex\":\"%s\",\"decode_status\":\"%s\","
+            "\"sightings\":%llu",
+            raw, c.hex, decodeStatusToString(c.status),
+            (unsigned long long)seen.count);
+    if (seen.firstSeen != 0) {
+      fprintf(out, ",\"first_seen\":%u,\"last_seen\":%u", seen.firstSeen,
+              seen.lastSeen);
+    }
+    fputs(",\"devices\":[", out);
+    bool first = true;
+    for (size_t i = 0; i < logs.size(); i++) {
+      if (seen.devices & (1ull << i)) {
+        fprintf(out, "%s\"%s\"", first ? "" : ",", logs[i].device.c_str());
+        first = false;
+      }
+    }
+    fputs("]}\n", out);
+  }
+  fflush(out);
+}
+
+int main(int argc, char **argv) {
+  unsigned int threads = std::thread::hardware_concurrency();
+  const char *outputPath = nullptr;
+  bool quiet = false;
+  bool verbose = false;
+  std::vector<LogFile> logs;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (strcmp(argv[i], "-q") == 0) {
+      quiet = true;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else {
+      LogFile log;
+      log.path = argv[i];
+      log.device = deviceName(log.path);
+      logs.push_back(log);
+    }
+  }
+  if (logs.empty() || threads < 1) {
+    fprintf(stderr,
+            "usage: %s [-j threads] [-o merged.jsonl] [-v | -q] "
+            "<cards.jsonl>...\n",
+            argv[0]);
+    return 1;
+  }
+  if (logs.size() > kMaxLogs) {
+    fprintf(stderr, "[-] at most %zu logs can be merged at once\n", kMaxLogs);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t totalBytes = 0;
+  std::vector<Chunk> chunks;
+  for (unsigned int i = 0; i < logs.size(); i++) {
+    if (!mapLog(logs[i])) {
+      fprintf(stderr, "[-] failed to open %s\n", logs[i].path.c_str());
+      return 1;
+    }
+    totalBytes += logs[i].size;
+    splitLog(logs, i, chunks);
+  }
+
+  // deal the chunks out round robin, stealing evens out the rest
+  WorkQueues queues(threads);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    queues.push(i % threads, chunks[i]);
+  }
+
+  std::vector<WorkerResult> results(threads);
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      Chunk chunk;
+      bool stolen;
+      while (queues.take(t, chunk, stolen)) {
+        processChunk(logs[chunk.log], chunk, results[t]);
+        results[t].chunks++;
+        results[t].stolen += stolen;
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  auto parsed = std::chrono::steady_clock::now();
+
+  // merge shard by shard, each shard on whichever thread is free
+  std::atomic<unsigned int> nextShard(0);
+  workers.clear();
+  for (unsigned int t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      unsigned int shard;
+      while ((shard = nextShard++) < kShards) {
+        CredentialTable &merged = results[0].shards[shard];
+        for (unsigned int r = 1; r < threads; r++) {
+          CredentialTable &other = results[r].shards[shard];
+          other.forEach([&](const Credential &entry) {
+            Credential &credential =
+                merged.lookup(entry.key, RawKeyHash()(entry.key));
+            if (credential.decoded == UINT32_MAX) {
+              credential.decoded = merged.decoded.size();
+              merged.decoded.push_back(other.decoded[entry.decoded]);
+            }
+            credential.seen.merge(entry.seen);
+          });
+          other.clear();
+        }
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  uint64_t records = 0;
+  uint64_t withoutRaw = 0;
+  uint64_t unreadable = 0;
+  uint64_t stolen = 0;
+  for (const WorkerResult &result : results) {
+    records += result.records;
+    withoutRaw += result.withoutRaw;
+    unreadable += result.unreadable;
+    stolen += result.stolen;
+  }
+
+  std::map<FormatKey, Summary> formats;
+  std::map<FacilityKey, Summary> facilities;
+  std::vector<SortedCredential> sorted;
+  for (unsigned int shard = 0; shard < kShards; shard++) {
+    const CredentialTable &table = results[0].shards[shard];
+    table.forEach([&](const Credential &entry) {
+      const Decoded &c = table.decoded[entry.decoded];
+      Summary &format = formats[{c.cardType, entry.key.length, c.status}];
+      format.unique++;
+      format.sightings += entry.seen.count;
+      format.devices |= entry.seen.devices;
+      if (c.status == DECODE_OK) {
+        Summary &facility =
+            facilities[{c.cardType, c.regionCode, c.facilityCode}];
+        facility.unique++;
+        facility.sightings += entry.seen.count;
+        facility.devices |= entry.seen.devices;
+      }
+      if (outputPath) {
+        sorted.push_back({&entry, &c});
+      }
+    });
+  }
+
+  if (outputPath) {
+    std::sort(sorted.begin(), sorted.end(), credentialOrder);
+    FILE *out = fopen(outputPath, "w");
+    if (!out) {
+      fprintf(stderr, "[-] failed to open %s\n", outputPath);
+      return 1;
+    }
+    writeMerged(out, sorted, logs);
+    fclose(out);
+  }
+  auto finished = std::chrono::steady_clock::now();
+
+  uint64_t unique = 0;
+  for (const auto &entry : formats) {
+    unique += entry.second.unique;
+  }
+
+  if (!quiet) {
+    printf("%-10s %6s  %-12s %12s %10s %8s\n", "type", "bits", "status",
+           "records", "unique", "devices");
+    for (const auto &entry : formats) {
+      printf("%-10s %6u  %-12s %12llu %10llu %8d\n",
+             cardTypeToString(entry.first.cardType), entry.first.bitLength,
+             decodeStatusToString(entry.first.status),
+             (unsigned long long)entry.second.sightings,
+             (unsigned long long)entry.second.unique,
+             deviceCount(entry.second.devices));
+    }
+    // busiest first
+    std::vector<std::pair<FacilityKey, Summary>> busiest(facilities.begin(),
+                                                          facilities.end());
+    std::stable_sort(busiest.begin(), busiest.end(),
+                     [](const std::pair<FacilityKey, Summary> &a,
+                        const std::pair<FacilityKey, Summary> &b) {
+                       return a.second.sightings > b.second.sightings;
+                     });
+    size_t shown = verbose ? busiest.size()
+                           : std::min(busiest.size(), kFacilitiesShown);
+
+    printf("\n%-10s %6s %10s %12s %10s %8s\n", "type", "region", "facility",
+           "records", "unique", "devices");
+    for (size_t i = 0; i < shown; i++) {
+      const std::pair<FacilityKey, Summary> &entry = busiest[i];
+      printf("%-10s %6lu %10lu %12llu %10llu %8d\n",
+             cardTypeToString(entry.first.cardType), entry.first.regionCode,
+             entry.first.facilityCode,
+             (unsigned long long)entry.second.sightings,
+             (unsigned long long)entry.second.unique,
+             deviceCount(entry.second.devices));
+    }
+    if (shown < busiest.size()) {
+      printf("(%zu more facility codes, -v lists all)\n",
+             busiest.size() - shown);
+    }
+    printf("\n");
+  }
+
+  double parseSeconds = std::chrono::duration<double>(parsed - start).count();
+  double totalSeconds =
+      std::chrono::duration<double>(finished - start).count();
+  printf("[*] logs:        %zu (%.1f MB, %zu chunks, %llu stolen)\n",
+         logs.size(), totalBytes / (1024.0 * 1024.0), chunks.size(),
+         (unsigned long long)stolen);
+  printf("[*] records:     %llu (%llu without raw bits, %llu unreadable)\n",
+         (unsigned long long)records, (unsigned long long)withoutRaw,
+         (unsigned long long)unreadable);
+  printf("[*] credentials: %llu distinct\n", (unsigned long long)unique);
+  printf("[*] threads:     %u\n", threads);
+  printf("[*] ingest:      %.3fs, %.1f M records/s, %.0f MB/s\n", parseSeconds,
+         records / parseSeconds / 1e6,
+         totalBytes / parseSeconds / (1024.0 * 1024.0));
+  printf("[*] total:       %.3fs, %.3fs cpu\n", totalSeconds,
+         (double)std::clock() / CLOCKS_PER_SEC);
+
+  for (LogFile &log : logs) {
+    if (log.data) {
+      munmap((void *)log.data, log.size);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,979 @@
+// vim: ts=2 sw=2 et
+
+// host load test of the web api's card data and settings endpoints
+//
+// usage: bench_api [-r records,...] [-c clients,...] [-d seconds]
+//                  [-k sd_kbps] [-a sd_access_us] [-w capture_ms]
+//                  [-p max_live_p99_ms] [dir]
+//
+// serves the api from a local directory standing in for the sd card, with
+// the firmware's handlers (web_api.cpp) behind a socket server standing in
+// for the async web server, and a capture thread storing a card every
+// capture_ms. for every log size (default 1000,4000,16000 records) and
+// client count (default 1,2,4,8), clients request a mix of endpoints like
+// the web interface for the given time and the p50/p99 latency and
+// throughput of each endpoint is reported, along with the capture thread's
+// capture to persist latency.
+//
+// like the async web server, one thread handles every request, and the
+// storage is slowed down to roughly an sd card on a 4MHz spi bus (sd_kbps,
+// default 300, plus sd_access_us per access, default 1000), which the
+// capture thread shares. cpu time on the host is much cheaper than on the
+// esp32, so compression and msgpack conversion cost next to nothing.
+//
+// exits non-zero if a response is malformed, a request gets anything but
+// 200 or 503, or (with -p) a live endpoint's p99 latency is above the limit.
+
+#include "card_decoder.h"
+#include "card_export.h"
+#include "card_storage.h"
+#include "record_index.h"
+#include "request_budget.h"
+#include "web_api.h"
+#include "wiegand_capture.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// how long handlers wait for the card data lock, HANDLER_LOCK_WAIT in the
+// firmware
+static const std::chrono::milliseconds kLockWait(50);
+// how long capture waits for it before storing the card in the flash ring,
+// CAPTURE_LOCK_WAIT in the firmware
+static const std::chrono::milliseconds kCaptureLockWait(10);
+// most a streamed response is filled with at once, lwip's send buffer in the
+// arduino core
+static const size_t kChunkSize = 5744;
+// the sd card's spi clock, SD_SPI_FREQUENCY in the firmware
+static const uint32_t kSdSpiFrequency = 4000000;
+
+static uint64_t seed = 1;
+
+static uint32_t random32() {
+  seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+  return seed >> 32;
+}
+
+/* #####----- Storage -----##### */
+
+// an sd card on a slow spi bus: every access holds the bus for the access
+// time plus the transfer
+class SlowBus {
+public:
+  unsigned long bytesPerSecond = 300 * 1000;
+  unsigned long accessMicros = 1000;
+
+  void access(size_t bytes) {
+    std::lock_guard<std::mutex> lock(bus);
+    auto cost = std::chrono::microseconds(
+        accessMicros + (uint64_t)bytes * 1000000 / bytesPerSecond);
+    std::this_thread::sleep_for(cost);
+  }
+
+private:
+  std::mutex bus;
+};
+
+class DirRecordReader : public RecordReader {
+public:
+  DirRecordReader(FILE *file, size_t start, size_t end, SlowBus &bus)
+      : file(file), remaining(end - start), bus(bus) {
+    if (fseek(file, start, SEEK_SET) != 0) {
+      remaining = 0;
+    }
+  }
+  ~DirRecordReader() override { fclose(file); }
+
+  size_t read(uint8_t *buffer, size_t length) override {
+    if (length > remaining) {
+      length = remaining;
+    }
+    if (length == 0) {
+      return 0;
+    }
+    bus.access(length);
+    size_t n = fread(buffer, 1, length, file);
+    remaining -= n;
+    return n;
+  }
+
+private:
+  FILE *file;
+  size_t remaining;
+  SlowBus &bus;
+};
+
+// the sd card stand-in: cards.jsonl and one file per setting in a directory
+class DirStorage : public CardStorage {
+public:
+  SlowBus bus;
+
+  bool begin(const std::string &dir) {
+    this->dir = dir;
+    mkdir(dir.c_str(), 0755);
+    logPath = dir + "/cards.jsonl";
+    log = fopen(logPath.c_str(), "ab");
+    if (!log) {
+      return false;
+    }
+    fseek(log, 0, SEEK_END);
+    bytes = ftell(log);
+    // SdStorage starts its index from the last record in the log
+    index.reset();
+    FILE *file = fopen(logPath.c_str(), "rb");
+    if (file) {
+      char tail[RECORD_LINE_SIZE];
+      size_t start = bytes > sizeof(tail) ? bytes - sizeof(tail) : 0;
+      fseek(file, start, SEEK_SET);
+      size_t n = fread(tail, 1, bytes - start, file);
+      index.addTail(tail, n, bytes);
+      fclose(file);
+    }
+    return true;
+  }
+
+  ~DirStorage() override {
+    if (log) {
+      fclose(log);
+    }
+  }
+
+  bool appendRecord(const char *line, size_t length) override {
+    bus.access(length);
+    if (fwrite(line, 1, length, log) != length || fflush(log) != 0) {
+      return false;
+    }
+    unsigned long id;
+    if (recordLineId(line, length, id)) {
+      index.add(bytes, id);
+    }
+    bytes += length;
+    return true;
+  }
+
+  bool clearRecords() override {
+    bus.access(0);
+    FILE *empty = freopen(logPath.c_str(), "wb", log);
+    if (!empty) {
+      return false;
+    }
+    log = empty;
+    bytes = 0;
+    index.reset();
+    return true;
+  }
+
+  size_t recordBytes() override { return bytes; }
+
+  RecordReader *openRecords() override { return openFrom(0); }
+
+  RecordReader *openRecordsSince(unsigned long since) override {
+    return openFrom(index.start(since));
+  }
+
+  bool readSetting(const char *name, char *value, size_t size) override {
+    if (size == 0) {
+      return false;
+    }
+    bus.access(size);
+    FILE *file = fopen((dir + name).c_str(), "rb");
+    if (!file) {
+      return false;
+    }
+    if (!fgets(value, size, file)) {
+      value[0] = '\0';
+    }
+    value[strcspn(value, "\n")] = '\0';
+    fclose(file);
+    return true;
+  }
+
+  bool writeSetting(const char *name, const char *value) override {
+    bus.access(strlen(value));
+    FILE *file = fopen((dir + name).c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+    bool written = fputs(value, file) >= 0;
+    return fclose(file) == 0 && written;
+  }
+
+private:
+  RecordReader *openFrom(size_t offset) {
+    bus.access(0);
+    FILE *file = fopen(logPath.c_str(), "rb");
+    return file ? new DirRecordReader(file, offset, bytes, bus) : nullptr;
+  }
+
+  std::string dir;
+  std::string logPath;
+  FILE *log = nullptr;
+  size_t bytes = 0;
+  RecordIndex index;
+};
+
+// a cards.jsonl record as writeToSD() stores it
+static std::string randomRecord(unsigned long id) {
+  CardData card;
+  if (random32() % 5 == 0) {
+    card.cardType = GALLAGHER;
+    card.bitCount = 96;
+    card.regionCode = random32() % 16;
+    card.issueLevel = random32() % 16;
+    card.facilityCode = random32() % 65536;
+    card.cardNumber = random32() % 0x1000000;
+  } else {
+    card.cardType = HID;
+    card.bitCount = 26;
+    card.facilityCode = random32() % 256;
+    card.cardNumber = random32() % 65536;
+  }
+  // a blank card stores the same way
+  encodeCard(card);
+
+  char raw[MAX_BITS + 1];
+  formatRawBits(card, raw, sizeof(raw));
+  char line[RECORD_LINE_SIZE];
+  int n = snprintf(line, sizeof(line),
+                   "{\"card_type\":\"%s\",\"bit_length\":%u,"
+                   "\"facility_code\":%lu,\"card_number\":%lu,",
+                   cardTypeToString(card.cardType), card.bitCount,
+                   card.facilityCode, card.cardNumber);
+  if (card.cardType == GALLAGHER) {
+    n += snprintf(line + n, sizeof(line) - n,
+                  "\"issue_level\":%lu,\"region_code\":%lu,", card.issueLevel,
+                  card.regionCode);
+  }
+  snprintf(line + n, sizeof(line) - n,
+           "\"raw\":\"%s\",\"hex\":\"%s\",\"decode_status\":\"%s\","
+           "\"id\":%lu,\"timestamp\":%lu}\n",
+           raw, card.hex, decodeStatusToString(card.status), id,
+           1760000000ul + id * 37);
+  return line;
+}
+
+static bool writeLog(const std::string &dir, unsigned long records) {
+  mkdir(dir.c_str(), 0755);
+  FILE *file = fopen((dir + "/cards.jsonl").c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  for (unsigned long id = 0; id < records; id++) {
+    std::string line = randomRecord(id);
+    fwrite(line.data(), 1, line.size(), file);
+  }
+  return fclose(file) == 0;
+}
+
+/* #####----- Server -----##### */
+
+enum Endpoint {
+  CARD_DATA,
+  CARD_DATA_MSGPACK,
+  CARD_DATA_SINCE,
+  CARD_DATA_EXPORT,
+  SETTINGS_GET,
+  SETTINGS_POST,
+  WIFI_CONFIG_GET,
+  WEB_STATS,
+  ENDPOINT_COUNT
+};
+
+struct EndpointInfo {
+  const char *name;
+  const char *method;
+  const char *path;
+  const char *body;
+  RequestPriority priority;
+  // share of the requests clients make
+  unsigned int weight;
+};
+
+static const EndpointInfo endpoints[ENDPOINT_COUNT] = {
+    {"carddata", "GET", "/api/carddata", nullptr, PRIORITY_BULK, 5},
+    {"carddata msgpack", "GET", "/api/carddata?format=msgpack", nullptr,
+     PRIORITY_BULK, 10},
+    // the web interface polling for the records after the newest it has
+    {"carddata since", "GET", "/api/carddata?format=msgpack&since=", nullptr,
+     PRIORITY_NORMAL, 10},
+    {"carddata/export", "GET", "/api/carddata/export", nullptr, PRIORITY_BULK,
+     5},
+    {"settings/general", "GET", "/api/device/settings/general", nullptr,
+     PRIORITY_LIVE, 35},
+    {"settings/general post", "POST", "/api/device/settings/general",
+     "sd_spi_khz=4000", PRIORITY_LIVE, 10},
+    {"wificonfig", "GET", "/api/device/wificonfig", nullptr, PRIORITY_LIVE,
+     15},
+    {"webstats", "GET", "/api/device/webstats", nullptr, PRIORITY_LIVE, 20},
+};
+
+struct Connection {
+  int fd;
+  std::string in;
+  std::string out;
+  size_t outOffset = 0;
+  // the chunked response filler of a streamed response
+  std::function<size_t(uint8_t *, size_t)> stream;
+  std::function<void()> onDisconnect;
+  bool responded = false;
+};
+
+// "a=1&b=2" as names and values, nothing is url decoded
+static std::vector<std::pair<std::string, std::string>>
+splitFields(const std::string &text) {
+  std::vector<std::pair<std::string, std::string>> fields;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('&', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string field = text.substr(start, end - start);
+    size_t equals = field.find('=');
+    if (equals == std::string::npos) {
+      fields.emplace_back(field, "");
+    } else {
+      fields.emplace_back(field.substr(0, equals), field.substr(equals + 1));
+    }
+    start = end + 1;
+  }
+  return fields;
+}
+
+// a request on the socket server as the web api handlers see it, the
+// response goes to the connection
+class BenchRequest : public ApiRequest {
+public:
+  BenchRequest(Connection &connection, const std::string &query,
+               const std::string &headers, const std::string &body)
+      : connection(connection), query(splitFields(query)),
+        form(splitFields(body)), headers(headers) {}
+
+  const char *param(const char *name, bool post) override {
+    for (const auto &field : post ? form : query) {
+      if (field.first == name) {
+        return field.second.c_str();
+      }
+    }
+    return nullptr;
+  }
+  size_t formFieldCount() override { return form.size(); }
+  const char *formFieldName(size_t i) override {
+    return form[i].first.c_str();
+  }
+  const char *formFieldValue(size_t i) override {
+    return form[i].second.c_str();
+  }
+  const char *header(const char *name) override {
+    std::string prefix = std::string("\r\n") + name + ": ";
+    size_t start = headers.find(prefix);
+    if (start == std::string::npos) {
+      return nullptr;
+    }
+    start += prefix.size();
+    headerValue = headers.substr(start, headers.find("\r\n", start) - start);
+    return headerValue.c_str();
+  }
+
+  void addHeader(const char *name, const char *value) override {
+    extraHeaders += std::string(name) + ": " + value + "\r\n";
+  }
+  void send(int status, const char *contentType,
+            const std::string &body) override {
+    char header[256];
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+             "Content-Length: %zu\r\n",
+             status, status == 200 ? "OK" : "Error", contentType,
+             body.size());
+    connection.out =
+        header + extraHeaders + "Connection: close\r\n\r\n" + body;
+  }
+  void sendStream(const char *contentType,
+                  std::function<size_t(uint8_t *, size_t)> fill) override {
+    connection.out = std::string("HTTP/1.1 200 OK\r\nContent-Type: ") +
+                     contentType + "\r\n" + extraHeaders +
+                     "Connection: close\r\n\r\n";
+    connection.stream = fill;
+  }
+  void onDisconnect(std::function<void()> callback) override {
+    connection.onDisconnect = callback;
+  }
+
+private:
+  Connection &connection;
+  std::vector<std::pair<std::string, std::string>> query;
+  std::vector<std::pair<std::string, std::string>> form;
+  std::string headers;
+  std::string headerValue;
+  std::string extraHeaders;
+};
+
+// the firmware's web api on the directory storage, with a timed mutex
+// standing in for cardDataMutex
+class BenchWebApi : public WebApi {
+public:
+  BenchWebApi(DirStorage &storage, RequestBudget &budget,
+              WiegandCapture &capture, DeviceSettings &settings,
+              std::timed_mutex &cardDataMutex)
+      : WebApi(storage, budget, capture, settings),
+        cardDataMutex(cardDataMutex) {}
+
+  bool lockCardData() override {
+    return cardDataMutex.try_lock_for(kLockWait);
+  }
+  void unlockCardData() override { cardDataMutex.unlock(); }
+
+private:
+  std::timed_mutex &cardDataMutex;
+};
+
+// the web server: one thread runs every handler, as the async web server's
+// task does
+class Server {
+public:
+  Server(DirStorage &storage, std::timed_mutex &cardDataMutex)
+      : storage(storage),
+        api(storage, requestBudget, capture, settings, cardDataMutex) {}
+
+  bool begin() {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listenFd, 64) != 0) {
+      return false;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(listenFd, (sockaddr *)&address, &length);
+    port = ntohs(address.sin_port);
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+    // setup() in the firmware
+    settings.sdSpiFrequency = kSdSpiFrequency;
+    settings.ssid = loadSetting(ssidPath, "Tusk");
+    settings.password = loadSetting(passwordPath, "changeme");
+    settings.channel = loadSetting(channelPath, "1");
+    settings.hidessid = loadSetting(hidessidPath, "0");
+    running = true;
+    thread = std::thread(&Server::run, this);
+    return true;
+  }
+
+  void end() {
+    running = false;
+    thread.join();
+    for (Connection &connection : connections) {
+      close(connection.fd);
+    }
+    close(listenFd);
+  }
+
+  uint16_t port = 0;
+  RequestBudget requestBudget;
+
+private:
+  std::string loadSetting(const char *path, const char *fallback) {
+    char value[64];
+    return storage.readSetting(path, value, sizeof(value)) ? value : fallback;
+  }
+
+  void run() {
+    while (running) {
+      std::vector<pollfd> fds;
+      fds.push_back({listenFd, POLLIN, 0});
+      for (Connection &connection : connections) {
+        short events = connection.responded ? POLLOUT : POLLIN;
+        fds.push_back({connection.fd, events, 0});
+      }
+      if (poll(fds.data(), fds.size(), 10) <= 0) {
+        continue;
+      }
+
+      for (size_t i = 1; i < fds.size(); i++) {
+        Connection &connection = connections[i - 1];
+        if (fds[i].revents & (POLLERR | POLLHUP)) {
+          finish(connection);
+        } else if (fds[i].revents & POLLIN) {
+          receive(connection);
+        } else if (fds[i].revents & POLLOUT) {
+          send(connection);
+        }
+      }
+      connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                       [](const Connection &connection) {
+                                         return connection.fd < 0;
+                                       }),
+                        connections.end());
+
+      if (fds[0].revents & POLLIN) {
+        int fd;
+        while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+          fcntl(fd, F_SETFL, O_NONBLOCK);
+          int on = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+          Connection connection;
+          connection.fd = fd;
+          connections.push_back(std::move(connection));
+        }
+      }
+    }
+  }
+
+  // the client disconnecting releases the request's slot
+  void finish(Connection &connection) {
+    if (connection.onDisconnect) {
+      connection.onDisconnect();
+      connection.onDisconnect = nullptr;
+    }
+    close(connection.fd);
+    connection.fd = -1;
+    connection.stream = nullptr;
+  }
+
+  void receive(Connection &connection) {
+    char buffer[2048];
+    ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      finish(connection);
+      return;
+    }
+    connection.in.append(buffer, n);
+
+    size_t headerEnd = connection.in.find("\r\n\r\n");
+    if (headerEnd == std::string::npos) {
+      return;
+    }
+    size_t contentLength = 0;
+    size_t header = connection.in.find("Content-Length: ");
+    if (header != std::string::npos && header < headerEnd) {
+      contentLength = strtoul(connection.in.c_str() + header + 16, nullptr, 10);
+    }
+    if (connection.in.size() < headerEnd + 4 + contentLength) {
+      return;
+    }
+    // "GET /path?query HTTP/1.1"
+    size_t methodEnd = connection.in.find(' ');
+    size_t urlEnd = connection.in.find(' ', methodEnd + 1);
+    handle(connection, connection.in.substr(0, methodEnd),
+           connection.in.substr(methodEnd + 1, urlEnd - methodEnd - 1),
+           connection.in.substr(0, headerEnd + 2),
+           connection.in.substr(headerEnd + 4, contentLength));
+    connection.responded = true;
+  }
+
+  // the firmware registers apiRoutes with the async web server
+  void handle(Connection &connection, const std::string &method,
+              const std::string &url, const std::string &headers,
+              const std::string &body) {
+    size_t query = url.find('?');
+    std::string path = url.substr(0, query);
+    BenchRequest request(
+        connection, query == std::string::npos ? "" : url.substr(query + 1),
+        headers, body);
+    for (size_t i = 0; i < apiRouteCount; i++) {
+      const ApiRoute &route = apiRoutes[i];
+      if (path == route.path && route.post == (method == "POST")) {
+        api.handle(route, request);
+        return;
+      }
+    }
+    request.send(404, "text/plain", "");
+  }
+
+  void send(Connection &connection) {
+    if (connection.outOffset == connection.out.size() && connection.stream) {
+      // the chunked response filler
+      uint8_t chunk[kChunkSize];
+      size_t n = connection.stream(chunk, sizeof(chunk));
+      connection.out.assign((const char *)chunk, n);
+      connection.outOffset = 0;
+      if (n == 0) {
+        connection.stream = nullptr;
+      }
+    }
+    if (connection.outOffset == connection.out.size()) {
+      // everything sent, the client reads to the end
+      shutdown(connection.fd, SHUT_WR);
+      finish(connection);
+      return;
+    }
+    ssize_t n = ::send(connection.fd, connection.out.data() + connection.outOffset,
+                       connection.out.size() - connection.outOffset,
+                       MSG_NOSIGNAL);
+    if (n < 0) {
+      finish(connection);
+      return;
+    }
+    connection.outOffset += n;
+  }
+
+  DirStorage &storage;
+  WiegandCapture capture;
+  DeviceSettings settings;
+  BenchWebApi api;
+  int listenFd = -1;
+  std::vector<Connection> connections;
+  std::atomic<bool> running{false};
+  std::thread thread;
+};
+
+/* #####----- Clients -----##### */
+
+struct Result {
+  int status = 0;
+  std::string body;
+};
+
+// paths ending in since= are given the id since
+static bool request(uint16_t port, const EndpointInfo &endpoint,
+                    unsigned long since, Result &result) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  std::string path = endpoint.path;
+  if (path.size() > 6 && path.compare(path.size() - 6, 6, "since=") == 0) {
+    path += std::to_string(since);
+  }
+  std::string text = std::string(endpoint.method) + " " + path +
+                     " HTTP/1.1\r\nHost: 192.168.100.1\r\n";
+  if (endpoint.body) {
+    text += "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: " +
+            std::to_string(strlen(endpoint.body)) + "\r\n\r\n" + endpoint.body;
+  } else {
+    text += "\r\n";
+  }
+  ::send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+
+  std::string response;
+  char buffer[16384];
+  ssize_t n;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, n);
+  }
+  close(fd);
+
+  size_t headerEnd = response.find("\r\n\r\n");
+  if (response.compare(0, 9, "HTTP/1.1 ") != 0 ||
+      headerEnd == std::string::npos) {
+    return false;
+  }
+  result.status = atoi(response.c_str() + 9);
+  result.body = response.substr(headerEnd + 4);
+  return true;
+}
+
+// is a 200 response what the endpoint should send for a log of at least
+// records records, or for a since poll at most records records
+static bool validBody(Endpoint endpoint, const std::string &body,
+                      unsigned long records) {
+  switch (endpoint) {
+  case CARD_DATA:
+    return (unsigned long)std::count(body.begin(), body.end(), '\n') >=
+               records &&
+           (body.empty() || body.back() == '\n');
+  case CARD_DATA_MSGPACK:
+    // an array of 11 fields per record
+    return records == 0 || (!body.empty() && (uint8_t)body[0] == 0x9b);
+  case CARD_DATA_SINCE:
+    // only the records captured since
+    return body.empty() || ((uint8_t)body[0] == 0x9b &&
+                            body.size() <= records * RECORD_LINE_SIZE);
+  case CARD_DATA_EXPORT:
+    return body.size() >= 18 && (uint8_t)body[0] == 0x1f &&
+           (uint8_t)body[1] == 0x8b;
+  default:
+    return !body.empty() && (body[0] == '{' || isalpha(body[0]));
+  }
+}
+
+struct EndpointStats {
+  std::vector<double> latencies;
+  unsigned long busy = 0;
+  unsigned long failed = 0;
+  uint64_t bytes = 0;
+};
+
+// an endpoint at random by weight, clients each have their own state
+static Endpoint pickEndpoint(uint64_t &state) {
+  state = state * 6364136223846793005ull + 1442695040888963407ull;
+  unsigned int total = 0;
+  for (const EndpointInfo &info : endpoints) {
+    total += info.weight;
+  }
+  unsigned int pick = (state >> 32) % total;
+  int e = 0;
+  while (pick >= endpoints[e].weight) {
+    pick -= endpoints[e++].weight;
+  }
+  return (Endpoint)e;
+}
+
+static double percentile(std::vector<double> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+  return values[index];
+}
+
+/* #####----- Benchmark -----##### */
+
+struct Options {
+  std::vector<unsigned long> records = {1000, 4000, 16000};
+  std::vector<unsigned int> clients = {1, 2, 4, 8};
+  double seconds = 5;
+  unsigned long sdKbps = 300;
+  unsigned long sdAccessMicros = 1000;
+  unsigned long captureMillis = 500;
+  double maxLiveP99 = 0;
+  std::string dir = "build/bench_api";
+};
+
+// run one log size and client count, false if anything failed
+static bool runLoad(const Options &options, unsigned long records,
+                    unsigned int clientCount) {
+  std::string dir = options.dir + "/" + std::to_string(records);
+  if (!writeLog(dir, records)) {
+    fprintf(stderr, "[-] Failed to write %s\n", dir.c_str());
+    return false;
+  }
+
+  DirStorage storage;
+  storage.bus.bytesPerSecond = options.sdKbps * 1000;
+  storage.bus.accessMicros = options.sdAccessMicros;
+  std::timed_mutex cardDataMutex;
+  if (!storage.begin(dir) || !storage.writeSetting("/ssid.txt", "Tusk")) {
+    fprintf(stderr, "[-] Failed to open %s\n", dir.c_str());
+    return false;
+  }
+  Server server(storage, cardDataMutex);
+  if (!server.begin()) {
+    fprintf(stderr, "[-] Failed to start the server\n");
+    return false;
+  }
+
+  std::atomic<bool> stop{false};
+  // the capture loop, writeToSD() stores a card holding the lock, or in the
+  // flash ring if the web server holds it for too long. the time from the
+  // frame being taken to the card being stored is the persist latency
+  unsigned long captured = 0;
+  unsigned long toFlash = 0;
+  std::vector<double> persist;
+  std::atomic<unsigned long> nextId{records};
+  std::thread capture([&]() {
+    while (!stop) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(options.captureMillis));
+      Clock::time_point taken = Clock::now();
+      std::string line = randomRecord(nextId);
+      nextId++;
+      if (cardDataMutex.try_lock_for(kCaptureLockWait)) {
+        if (storage.appendRecord(line.data(), line.size())) {
+          captured++;
+        }
+        cardDataMutex.unlock();
+      } else {
+        // the ring isn't modelled, its append is quick next to the wait
+        toFlash++;
+      }
+      persist.push_back(
+          std::chrono::duration<double, std::milli>(Clock::now() - taken)
+              .count());
+    }
+  });
+
+  std::vector<std::vector<EndpointStats>> stats(
+      clientCount, std::vector<EndpointStats>(ENDPOINT_COUNT));
+  std::vector<std::thread> clients;
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(options.seconds));
+  for (unsigned int c = 0; c < clientCount; c++) {
+    uint32_t clientSeed = random32();
+    clients.emplace_back([&, c, clientSeed]() {
+      uint64_t state = clientSeed;
+      // like the web interface, clients have the whole log and poll for the
+      // records after the newest they have
+      unsigned long newest = records > 0 ? records - 1 : 0;
+      while (Clock::now() < deadline) {
+        Endpoint e = pickEndpoint(state);
+        EndpointStats &endpoint = stats[c][e];
+        Result result;
+        Clock::time_point sent = Clock::now();
+        unsigned long stored = nextId;
+        bool ok = request(server.port, endpoints[e], newest, result);
+        double millis =
+            std::chrono::duration<double, std::milli>(Clock::now() - sent)
+                .count();
+        if (ok && result.status == 503) {
+          endpoint.busy++;
+          // clients back off for a moment rather than the Retry-After
+          // seconds, to keep the pressure on
+          std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        } else if (ok && result.status == 200 &&
+                   validBody(e, result.body,
+                             e == CARD_DATA_SINCE ? nextId - newest
+                                                  : records)) {
+          endpoint.latencies.push_back(millis);
+          endpoint.bytes += result.body.size();
+          if (e == CARD_DATA_SINCE && stored > 0) {
+            newest = stored - 1;
+          }
+        } else {
+          endpoint.failed++;
+        }
+      }
+    });
+  }
+  for (std::thread &client : clients) {
+    client.join();
+  }
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  stop = true;
+  capture.join();
+  server.end();
+
+  bool ok = true;
+  printf("\n[*] %lu records, %u client%s, %.1fs, %lu cards captured\n",
+         records, clientCount, clientCount == 1 ? "" : "s", elapsed,
+         captured + toFlash);
+  printf("    capture to persist p50 %.1fms, p99 %.1fms, max %.1fms, %lu of "
+         "%zu to flash\n",
+         percentile(persist, 0.5), percentile(persist, 0.99),
+         percentile(persist, 1), toFlash, persist.size());
+  printf("    %-22s %7s %6s %6s %9s %9s %8s\n", "endpoint", "ok", "busy",
+         "failed", "p50 ms", "p99 ms", "req/s");
+  EndpointStats all;
+  for (int e = 0; e < ENDPOINT_COUNT; e++) {
+    EndpointStats merged;
+    for (unsigned int c = 0; c < clientCount; c++) {
+      EndpointStats &s = stats[c][e];
+      merged.latencies.insert(merged.latencies.end(), s.latencies.begin(),
+                              s.latencies.end());
+      merged.busy += s.busy;
+      merged.failed += s.failed;
+    }
+    all.latencies.insert(all.latencies.end(), merged.latencies.begin(),
+                         merged.latencies.end());
+    all.busy += merged.busy;
+    all.failed += merged.failed;
+
+    size_t count = merged.latencies.size();
+    double p50 = percentile(merged.latencies, 0.5);
+    double p99 = percentile(merged.latencies, 0.99);
+    printf("    %-22s %7zu %6lu %6lu %9.1f %9.1f %8.1f\n", endpoints[e].name,
+           count, merged.busy, merged.failed, p50, p99, count / elapsed);
+    if (merged.failed > 0) {
+      ok = false;
+    }
+    if (options.maxLiveP99 > 0 && endpoints[e].priority == PRIORITY_LIVE &&
+        p99 > options.maxLiveP99) {
+      printf("[-] %s p99 %.1fms is over %.1fms\n", endpoints[e].name, p99,
+             options.maxLiveP99);
+      ok = false;
+    }
+  }
+  size_t count = all.latencies.size();
+  printf("    %-22s %7zu %6lu %6lu %9.1f %9.1f %8.1f\n", "all", count,
+         all.busy, all.failed, percentile(all.latencies, 0.5),
+         percentile(all.latencies, 0.99), count / elapsed);
+  return ok;
+}
+
+template <typename T>
+static std::vector<T> parseList(const char *text) {
+  std::vector<T> values;
+  char *end;
+  while (*text) {
+    values.push_back(strtoul(text, &end, 10));
+    text = *end == ',' ? end + 1 : end;
+    if (end == text && *text) {
+      break;
+    }
+  }
+  return values;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      options.records = parseList<unsigned long>(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      options.clients = parseList<unsigned int>(argv[++i]);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      options.seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      options.sdKbps = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+      options.sdAccessMicros = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      options.captureMillis = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      options.maxLiveP99 = atof(argv[++i]);
+    } else if (argv[i][0] != '-') {
+      options.dir = argv[i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [-r records,...] [-c clients,...] [-d seconds]\n"
+              "       [-k sd_kbps] [-a sd_access_us] [-w capture_ms]\n"
+              "       [-p max_live_p99_ms] [dir]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (options.records.empty() || options.clients.empty() ||
+      options.sdKbps == 0 || options.captureMillis == 0) {
+    fprintf(stderr, "[-] Invalid options\n");
+    return 2;
+  }
+  mkdir(options.dir.c_str(), 0755);
+
+  printf("[*] sd card: %lu kB/s, %lu us per access, a card every %lu ms\n",
+         options.sdKbps, options.sdAccessMicros, options.captureMillis);
+  bool ok = true;
+  for (unsigned long records : options.records) {
+    for (unsigned int clients : options.clients) {
+      ok = runLoad(options, records, clients) && ok;
+    }
+  }
+  return ok ? 0 : 1;
+}
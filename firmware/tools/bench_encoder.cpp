@@ -0,0 +1,245 @@
+// vim: ts=2 sw=2 et
+
+// round trips every supported card format through the encoder, decoder and
+// t5577 clone data
+//
+// usage: bench_encoder
+//
+// every facility code and every card number of each format is encoded,
+// decoded again and turned into clone data, which is checked against the
+// card (hid prox blocks are manchester decoded, gallagher blocks run back
+// through the decoder). formats small enough are covered exhaustively. hid
+// 26 bit parity is checked against the usual h10301 layout. exits non-zero
+// on any mismatch, and reports round trips per second.
+
+#include "card_clone.h"
+#include "card_decoder.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// formats with at most this many facility code / card number pairs are
+// checked exhaustively
+static const uint64_t kExhaustiveLimit = 1ull << 24;
+
+static uint64_t seed = 1;
+
+static uint32_t random32() {
+  seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+  return seed >> 32;
+}
+
+struct Sweep {
+  const char *name;
+  uint64_t roundTrips = 0;
+  uint64_t failures = 0;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  explicit Sweep(const char *name) : name(name) {}
+
+  void fail(const CardData &card, const char *what) {
+    if (failures++ < 5) {
+      fprintf(stderr,
+              "[-] %s: %s (fc %lu, cn %lu, region %lu, issue %lu, %u bits)\n",
+              name, what, card.facilityCode, card.cardNumber,
+              card.regionCode, card.issueLevel, card.bitCount);
+    }
+  }
+
+  bool report() const {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    printf("[%c] %-26s %10llu round trips  %6.2f M/s\n",
+           failures ? '-' : '+', name, (unsigned long long)roundTrips,
+           roundTrips / seconds / 1e6);
+    if (failures) {
+      printf("    %llu failures\n", (unsigned long long)failures);
+    }
+    return failures == 0;
+  }
+};
+
+// h10301: even parity over bits 1-12, odd over 13-24
+static bool h10301ParityOk(const CardData &card) {
+  int even = 0;
+  int odd = 1;
+  for (int i = 0; i < 13; i++) {
+    even ^= card.bits[i];
+  }
+  for (int i = 13; i < 26; i++) {
+    odd ^= card.bits[i];
+  }
+  return even == 0 && odd == 0;
+}
+
+static bool cloneMatches(const CardData &card) {
+  T5577Clone clone;
+  if (!cloneToT5577(card, clone)) {
+    return false;
+  }
+  if (card.cardType == HID) {
+    uint64_t value;
+    return hidProxValue(clone, value) &&
+           value == strtoull(card.hex, nullptr, 16);
+  }
+
+  unsigned char bits[96];
+  for (int i = 0; i < 96; i++) {
+    bits[i] = (clone.blocks[1 + i / 32] >> (31 - i % 32)) & 1;
+  }
+  CardData decoded;
+  return clone.blocks[0] == T5577_CONFIG_GALLAGHER &&
+         decodeCard(bits, 96, decoded) &&
+         decoded.facilityCode == card.facilityCode &&
+         decoded.cardNumber == card.cardNumber &&
+         decoded.regionCode == card.regionCode &&
+         decoded.issueLevel == card.issueLevel;
+}
+
+static void roundTrip(Sweep &sweep, CardType type, unsigned int bitCount,
+                      unsigned long facilityCode, unsigned long cardNumber,
+                      unsigned long regionCode = 0,
+                      unsigned long issueLevel = 0) {
+  CardData card;
+  card.cardType = type;
+  card.bitCount = bitCount;
+  card.facilityCode = facilityCode;
+  card.cardNumber = cardNumber;
+  card.regionCode = regionCode;
+  card.issueLevel = issueLevel;
+  sweep.roundTrips++;
+
+  bool encoded = encodeCard(card);
+  // blank cards don't decode
+  if (facilityCode == 0 && cardNumber == 0) {
+    if (encoded || card.status != DECODE_ERROR) {
+      sweep.fail(card, "blank card decoded");
+    }
+    return;
+  }
+  if (!encoded) {
+    sweep.fail(card, "encode failed");
+    return;
+  }
+  if (card.cardType != type || card.facilityCode != facilityCode ||
+      card.cardNumber != cardNumber || card.regionCode != regionCode ||
+      card.issueLevel != issueLevel) {
+    sweep.fail(card, "decoded values differ");
+    return;
+  }
+  if (bitCount == 26 && !h10301ParityOk(card)) {
+    sweep.fail(card, "bad parity");
+    return;
+  }
+  if (!cloneMatches(card)) {
+    sweep.fail(card, "clone data differs");
+  }
+}
+
+static void rejects(Sweep &sweep, CardType type, unsigned int bitCount,
+                    unsigned long facilityCode, unsigned long cardNumber,
+                    unsigned long regionCode = 0,
+                    unsigned long issueLevel = 0) {
+  CardData card;
+  card.cardType = type;
+  card.bitCount = bitCount;
+  card.facilityCode = facilityCode;
+  card.cardNumber = cardNumber;
+  card.regionCode = regionCode;
+  card.issueLevel = issueLevel;
+  if (encodeCard(card)) {
+    sweep.fail(card, "out of range value encoded");
+  }
+}
+
+// field widths of the hid formats, found by decoding a frame of all ones
+static void hidFieldBits(unsigned int bitCount, unsigned int &facilityBits,
+                         unsigned int &numberBits) {
+  unsigned char bits[MAX_BITS];
+  memset(bits, 1, bitCount);
+  CardData card;
+  decodeCard(bits, bitCount, card);
+  facilityBits = 0;
+  while (card.facilityCode >> facilityBits) {
+    facilityBits++;
+  }
+  numberBits = 0;
+  while (card.cardNumber >> numberBits) {
+    numberBits++;
+  }
+}
+
+static bool sweepHID(unsigned int bitCount) {
+  char name[32];
+  snprintf(name, sizeof(name), "hid %u bit", bitCount);
+  Sweep sweep(name);
+
+  unsigned int facilityBits, numberBits;
+  hidFieldBits(bitCount, facilityBits, numberBits);
+  unsigned long facilityCodes = 1ul << facilityBits;
+  unsigned long cardNumbers = 1ul << numberBits;
+
+  if ((uint64_t)facilityCodes * cardNumbers <= kExhaustiveLimit) {
+    for (unsigned long fc = 0; fc < facilityCodes; fc++) {
+      for (unsigned long cn = 0; cn < cardNumbers; cn++) {
+        roundTrip(sweep, HID, bitCount, fc, cn);
+      }
+    }
+  } else {
+    // every value of each field, with the other random
+    for (unsigned long fc = 0; fc < facilityCodes; fc++) {
+      roundTrip(sweep, HID, bitCount, fc, random32() % cardNumbers);
+    }
+    for (unsigned long cn = 0; cn < cardNumbers; cn++) {
+      roundTrip(sweep, HID, bitCount, random32() % facilityCodes, cn);
+    }
+  }
+  rejects(sweep, HID, bitCount, facilityCodes, 1);
+  rejects(sweep, HID, bitCount, 1, cardNumbers);
+  return sweep.report();
+}
+
+static bool sweepGallagher() {
+  bool ok = true;
+  {
+    // every region code, issue level and facility code
+    Sweep sweep("gallagher rc/il/fc");
+    for (unsigned long rc = 0; rc < 16; rc++) {
+      for (unsigned long il = 0; il < 16; il++) {
+        for (unsigned long fc = 0; fc < 65536; fc++) {
+          roundTrip(sweep, GALLAGHER, 96, fc, random32() % 0x1000000, rc,
+                    il);
+        }
+      }
+    }
+    rejects(sweep, GALLAGHER, 96, 65536, 1);
+    rejects(sweep, GALLAGHER, 96, 1, 1, 16);
+    rejects(sweep, GALLAGHER, 96, 1, 1, 0, 16);
+    ok = sweep.report() && ok;
+  }
+  {
+    Sweep sweep("gallagher cn");
+    for (unsigned long cn = 0; cn < 0x1000000; cn++) {
+      roundTrip(sweep, GALLAGHER, 96, random32() % 65536, cn,
+                random32() % 16, random32() % 16);
+    }
+    rejects(sweep, GALLAGHER, 96, 1, 0x1000000);
+    ok = sweep.report() && ok;
+  }
+  return ok;
+}
+
+int main() {
+  static const unsigned int hidLengths[] = {26, 27, 29, 30, 31,
+                                            32, 33, 34, 35, 36};
+  bool ok = true;
+  for (unsigned int bitCount : hidLengths) {
+    ok = sweepHID(bitCount) && ok;
+  }
+  ok = sweepGallagher() && ok;
+  return ok ? 0 : 1;
+}
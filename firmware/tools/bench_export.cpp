@@ -0,0 +1,186 @@
+// vim: ts=2 sw=2 et
+
+// host benchmark for the compressed card data export
+//
+// usage: bench_export <cards.jsonl> [-o out.gz] [-n iterations]
+//
+// feeds a recorded log through GzipStream the same way the
+// /api/carddata/export handler does (line by line, draining the output in
+// tcp sized chunks) and reports the compression ratio and throughput.
+// the output written with -o can be checked with `gzip -t`. the log is
+// also sent uncompressed through CardDataExport, the way /api/carddata
+// sends it, and must come out as it went in. exits non-zero if it doesn't.
+
+#include "card_export.h"
+#include "gzip_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// roughly what the async web server asks the filler for per call
+static const size_t kChunkSize = 1436;
+
+static size_t compress(GzipStream &gz, const std::vector<std::string> &lines,
+                       std::vector<uint8_t> *output) {
+  uint8_t chunk[kChunkSize];
+  size_t total = 0;
+
+  gz.begin();
+  for (const std::string &line : lines) {
+    const uint8_t *data = (const uint8_t *)line.data();
+    size_t left = line.size();
+    while (left > 0) {
+      size_t n = gz.write(data, left);
+      data += n;
+      left -= n;
+      if (left > 0) {
+        size_t got = gz.read(chunk, sizeof(chunk));
+        total += got;
+        if (output) {
+          output->insert(output->end(), chunk, chunk + got);
+        }
+      }
+    }
+  }
+  gz.finish();
+  while (!gz.done()) {
+    size_t got = gz.read(chunk, sizeof(chunk));
+    total += got;
+    if (output) {
+      output->insert(output->end(), chunk, chunk + got);
+    }
+  }
+  return total;
+}
+
+// the log from memory, as the sd card hands it to the export
+class MemoryReader : public RecordReader {
+public:
+  explicit MemoryReader(const std::string &data) : data(data), offset(0) {}
+
+  size_t read(uint8_t *buffer, size_t length) override {
+    size_t n = std::min(length, data.size() - offset);
+    memcpy(buffer, data.data() + offset, n);
+    offset += n;
+    return n;
+  }
+
+private:
+  const std::string &data;
+  size_t offset;
+};
+
+// send the log through an uncompressed export in tcp sized chunks. false if
+// the records don't come out as stored or the response doesn't end
+static bool exportPlain(const std::vector<std::string> &lines) {
+  std::string log;
+  std::string expected;
+  for (const std::string &line : lines) {
+    log += line;
+    // blank lines (the log's padding) are skipped
+    if (line.size() > 1 || (line.size() == 1 && line[0] != '\n')) {
+      expected += line;
+      if (line.back() != '\n') {
+        expected += '\n';
+      }
+    }
+  }
+
+  CardDataExport exp;
+  exp.compress = false;
+  exp.begin(new MemoryReader(log));
+  std::string output;
+  uint8_t chunk[kChunkSize];
+  size_t n;
+  while ((n = exp.fill(chunk, sizeof(chunk))) > 0) {
+    output.append((const char *)chunk, n);
+    if (output.size() > expected.size()) {
+      fprintf(stderr, "[-] uncompressed export doesn't end\n");
+      return false;
+    }
+  }
+  if (output != expected) {
+    fprintf(stderr, "[-] uncompressed export differs from the log\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *inputPath = nullptr;
+  const char *outputPath = nullptr;
+  int iterations = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else {
+      inputPath = argv[i];
+    }
+  }
+  if (!inputPath || iterations < 1) {
+    fprintf(stderr, "usage: %s <cards.jsonl> [-o out.gz] [-n iterations]\n",
+            argv[0]);
+    return 1;
+  }
+
+  std::ifstream in(inputPath, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "[-] failed to open %s\n", inputPath);
+    return 1;
+  }
+  std::vector<std::string> lines;
+  size_t inputBytes = 0;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!in.eof()) {
+      line += '\n';
+    }
+    inputBytes += line.size();
+    lines.push_back(line);
+  }
+
+  if (!exportPlain(lines)) {
+    return 1;
+  }
+  printf("[+] uncompressed export matches the log\n");
+
+  GzipStream *gz = new GzipStream();
+  std::vector<uint8_t> output;
+  size_t compressedBytes = compress(*gz, lines, &output);
+
+  if (outputPath) {
+    std::ofstream out(outputPath, std::ios::binary);
+    out.write((const char *)output.data(), output.size());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    compress(*gz, lines, nullptr);
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  delete gz;
+
+  double mb = (double)inputBytes * iterations / (1024.0 * 1024.0);
+  printf("[*] records:          %zu\n", lines.size());
+  printf("[*] input bytes:      %zu\n", inputBytes);
+  printf("[*] compressed bytes: %zu\n", compressedBytes);
+  printf("[*] ratio:            %.2fx (%.1f%% of input)\n",
+         (double)inputBytes / compressedBytes,
+         100.0 * compressedBytes / inputBytes);
+  printf("[*] throughput:       %.1f MB/s (%d iterations)\n", mb / seconds,
+         iterations);
+  printf("[*] encoder state:    %zu bytes\n", sizeof(GzipStream));
+  return 0;
+}
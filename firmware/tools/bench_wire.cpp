@@ -0,0 +1,299 @@
+// vim: ts=2 sw=2 et
+
+// host comparison of the /api/carddata wire formats
+//
+// usage: bench_wire <cards.jsonl> [-o out.msgpack] [-n iterations]
+//
+// converts a recorded log to the compact MessagePack encoding the same way
+// the firmware does (record by record), checks the packed raw bits round
+// trip, and reports the size of both formats (plain and gzipped) and the
+// conversion throughput. the output written with -o is what
+// /api/carddata?format=msgpack returns for the log.
+
+#include "card_msgpack.h"
+#include "gzip_stream.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// a flat json object as written to cards.jsonl. only what's needed for
+// records: string, unsigned number and null values
+struct JsonRecord {
+  std::vector<std::pair<std::string, std::string>> strings;
+  std::vector<std::pair<std::string, unsigned long>> numbers;
+
+  const char *str(const char *key) const {
+    for (const auto &field : strings) {
+      if (field.first == key) {
+        return field.second.c_str();
+      }
+    }
+    return nullptr;
+  }
+  bool num(const char *key, unsigned long &value) const {
+    for (const auto &field : numbers) {
+      if (field.first == key) {
+        value = field.second;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+static bool parseString(const char *&p, std::string &out) {
+  if (*p != '"') {
+    return false;
+  }
+  for (p++; *p && *p != '"'; p++) {
+    if (*p == '\\' && p[1]) {
+      p++;
+    }
+    out += *p;
+  }
+  if (*p != '"') {
+    return false;
+  }
+  p++;
+  return true;
+}
+
+static bool parseRecord(const std::string &line, JsonRecord &record) {
+  const char *p = line.c_str();
+  if (*p++ != '{') {
+    return false;
+  }
+  while (*p && *p != '}') {
+    std::string key;
+    if (!parseString(p, key) || *p++ != ':') {
+      return false;
+    }
+    if (*p == '"') {
+      std::string value;
+      if (!parseString(p, value)) {
+        return false;
+      }
+      record.strings.push_back({key, value});
+    } else if (strncmp(p, "null", 4) == 0) {
+      p += 4;
+    } else {
+      char *end;
+      unsigned long value = strtoul(p, &end, 10);
+      if (end == p) {
+        return false;
+      }
+      p = end;
+      record.numbers.push_back({key, value});
+    }
+    if (*p == ',') {
+      p++;
+    }
+  }
+  return *p == '}';
+}
+
+// same mapping as parseCardRecord() in card_msgpack.cpp
+static void recordFromJson(const JsonRecord &json, CardRecord &record) {
+  unsigned long value = 0;
+  record.cardType = json.str("card_type");
+  record.bitLength = json.num("bit_length", value) ? value : 0;
+  record.facilityCode = json.num("facility_code", value) ? value : 0;
+  record.cardNumber = json.num("card_number", value) ? value : 0;
+  record.hasRegionCode = json.num("region_code", record.regionCode);
+  record.hasIssueLevel = json.num("issue_level", record.issueLevel);
+  record.hex = json.str("hex");
+  record.raw = json.str("raw");
+  record.decodeStatus = json.str("decode_status");
+  record.hasTimestamp = json.num("timestamp", record.timestamp);
+  record.hasId = json.num("id", record.id);
+}
+
+// skip one MessagePack value of the types packCardRecord() writes, returns
+// the position after it or nullptr
+static const uint8_t *skipValue(const uint8_t *p, const uint8_t *end) {
+  if (p >= end) {
+    return nullptr;
+  }
+  uint8_t type = *p++;
+  size_t len = 0;
+  if (type < 0x80 || type == 0xc0) {
+    return p;
+  } else if ((type & 0xe0) == 0xa0) {
+    len = type & 0x1f;
+  } else if (type == 0xcc) {
+    len = 1;
+  } else if (type == 0xcd) {
+    len = 2;
+  } else if (type == 0xce) {
+    len = 4;
+  } else if (type == 0xc4 || type == 0xd9) {
+    len = p < end ? *p++ : 0;
+  } else if (type == 0xc5 || type == 0xda) {
+    len = p + 1 < end ? (p[0] << 8) | p[1] : 0;
+    p += 2;
+  } else {
+    return nullptr;
+  }
+  return p + len <= end ? p + len : nullptr;
+}
+
+// unpack the raw field of a packed record and compare it to the original
+static bool checkRawBits(const uint8_t *packed, size_t len, const char *raw) {
+  const uint8_t *end = packed + len;
+  const uint8_t *p = packed;
+  if (*p++ != (0x90 | CARD_MSGPACK_FIELDS)) {
+    return false;
+  }
+  for (int i = 0; i < 7; i++) {
+    p = skipValue(p, end);
+    if (!p) {
+      return false;
+    }
+  }
+  if (!raw) {
+    return *p == 0xc0;
+  }
+  size_t bits = strlen(raw);
+  if (*p++ != 0xc4 || *p++ != (bits + 7) / 8) {
+    return false;
+  }
+  for (size_t i = 0; i < bits; i++) {
+    char bit = (p[i / 8] & (0x80 >> (i % 8))) ? '1' : '0';
+    if (bit != raw[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static size_t gzipSize(const std::vector<uint8_t> &data) {
+  GzipStream *gz = new GzipStream();
+  uint8_t chunk[1436];
+  size_t total = 0;
+  size_t offset = 0;
+
+  gz->begin();
+  while (offset < data.size()) {
+    offset += gz->write(data.data() + offset, data.size() - offset);
+    total += gz->read(chunk, sizeof(chunk));
+  }
+  gz->finish();
+  while (!gz->done()) {
+    total += gz->read(chunk, sizeof(chunk));
+  }
+  delete gz;
+  return total;
+}
+
+// convert every line, returns the number of records packed
+static size_t convert(const std::vector<std::string> &lines,
+                      std::vector<uint8_t> *output, size_t &failed) {
+  uint8_t packed[512];
+  size_t records = 0;
+  failed = 0;
+
+  for (const std::string &line : lines) {
+    JsonRecord json;
+    if (!parseRecord(line, json)) {
+      failed++;
+      continue;
+    }
+    CardRecord record;
+    recordFromJson(json, record);
+    size_t n = packCardRecord(record, packed, sizeof(packed));
+    if (n == 0) {
+      failed++;
+      continue;
+    }
+    if (output) {
+      if (!checkRawBits(packed, n, record.raw)) {
+        fprintf(stderr, "[-] raw bits don't round trip: %s\n", line.c_str());
+        failed++;
+      }
+      output->insert(output->end(), packed, packed + n);
+    }
+    records++;
+  }
+  return records;
+}
+
+int main(int argc, char **argv) {
+  const char *inputPath = nullptr;
+  const char *outputPath = nullptr;
+  int iterations = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else {
+      inputPath = argv[i];
+    }
+  }
+  if (!inputPath || iterations < 1) {
+    fprintf(stderr,
+            "usage: %s <cards.jsonl> [-o out.msgpack] [-n iterations]\n",
+            argv[0]);
+    return 1;
+  }
+
+  std::ifstream in(inputPath, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "[-] failed to open %s\n", inputPath);
+    return 1;
+  }
+  std::vector<std::string> lines;
+  std::vector<uint8_t> ndjson;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    lines.push_back(line);
+    ndjson.insert(ndjson.end(), line.begin(), line.end());
+    ndjson.push_back('\n');
+  }
+
+  std::vector<uint8_t> msgpack;
+  size_t failed = 0;
+  size_t records = convert(lines, &msgpack, failed);
+
+  if (outputPath) {
+    std::ofstream out(outputPath, std::ios::binary);
+    out.write((const char *)msgpack.data(), msgpack.size());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    size_t ignored;
+    convert(lines, nullptr, ignored);
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  size_t ndjsonGzip = gzipSize(ndjson);
+  size_t msgpackGzip = gzipSize(msgpack);
+
+  printf("[*] records:          %zu (%zu failed)\n", records, failed);
+  printf("[*] ndjson bytes:     %zu (%.1f per record)\n", ndjson.size(),
+         (double)ndjson.size() / records);
+  printf("[*] msgpack bytes:    %zu (%.1f per record, %.2fx smaller)\n",
+         msgpack.size(), (double)msgpack.size() / records,
+         (double)ndjson.size() / msgpack.size());
+  printf("[*] ndjson gzipped:   %zu\n", ndjsonGzip);
+  printf("[*] msgpack gzipped:  %zu (%.2fx smaller)\n", msgpackGzip,
+         (double)ndjsonGzip / msgpackGzip);
+  printf("[*] conversion:       %.0f records/s, %.1f MB/s of ndjson in "
+         "(%d iterations)\n",
+         records * iterations / seconds,
+         ndjson.size() * iterations / seconds / (1024.0 * 1024.0),
+         iterations);
+  return failed ? 1 : 0;
+}
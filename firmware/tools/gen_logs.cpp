@@ -0,0 +1,102 @@
+// vim: ts=2 sw=2 et
+
+// write made up cards.jsonl logs for a number of devices, in the format the
+// firmware stores, for benchmarking analyze_logs
+//
+// usage: gen_logs <dir> <devices> <records per device> [credentials]
+//
+// writes <dir>/unit<n>/cards.jsonl. records are drawn from a shared pool of
+// credentials, so the same cards turn up on several devices. most of the
+// pool decodes, the rest are frames with bad parity or unsupported lengths
+
+#include "card_decoder.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static uint64_t seed = 1;
+
+static uint32_t random32() {
+  seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+  return seed >> 32;
+}
+
+static const unsigned int hidLengths[] = {26, 26, 26, 26, 34, 35, 37};
+
+static void randomFrame(CardData &card) {
+  unsigned char bits[MAX_BITS];
+  unsigned int length = hidLengths[random32() % 7];
+  // keep unsupported lengths and one in ten of the rest whatever they decode
+  // to, the others until they decode
+  bool anything = length == 37 || random32() % 10 == 0;
+  do {
+    // a handful of facility codes, as on a real site
+    uint32_t facility = random32() % 16;
+    for (unsigned int i = 0; i < length; i++) {
+      bits[i] = i >= 1 && i < 9 ? (facility >> (8 - i)) & 1 : random32() & 1;
+    }
+  } while (!decodeCard(bits, length, card) && !anything);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    fprintf(stderr,
+            "usage: %s <dir> <devices> <records per device> [credentials]\n",
+            argv[0]);
+    return 1;
+  }
+  std::string dir = argv[1];
+  unsigned int devices = atoi(argv[2]);
+  unsigned long records = strtoul(argv[3], nullptr, 10);
+  unsigned long credentials =
+      argc > 4 ? strtoul(argv[4], nullptr, 10) : records / 20 + 1;
+
+  std::vector<CardData> pool(credentials);
+  for (CardData &card : pool) {
+    randomFrame(card);
+  }
+
+  mkdir(dir.c_str(), 0755);
+  for (unsigned int d = 0; d < devices; d++) {
+    std::string unit = dir + "/unit" + std::to_string(d + 1);
+    mkdir(unit.c_str(), 0755);
+    std::string path = unit + "/cards.jsonl";
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "[-] failed to open %s\n", path.c_str());
+      return 1;
+    }
+
+    unsigned long timestamp = 1760000000 + d * 3600;
+    for (unsigned long id = 0; id < records; id++) {
+      // some cards are used far more than others
+      unsigned long pick = random32() % credentials;
+      if (random32() % 2) {
+        pick %= credentials / 16 + 1;
+      }
+      const CardData &card = pool[pick];
+      char raw[MAX_BITS + 1];
+      formatRawBits(card, raw, sizeof(raw));
+
+      fprintf(out,
+              "{\"card_type\":\"%s\",\"bit_length\":%u,\"facility_code\":%lu,"
+              "\"card_number\":%lu,\"raw\":\"%s\",\"hex\":\"%s\","
+              "\"decode_status\":\"%s\",\"id\":%lu",
+              cardTypeToString(card.cardType), card.bitCount,
+              card.facilityCode, card.cardNumber, raw, card.hex,
+              decodeStatusToString(card.status), id);
+      // the first records of a log are from before the clock was set
+      if (id >= 16) {
+        timestamp += random32() % 60;
+        fprintf(out, ",\"timestamp\":%lu", timestamp);
+      }
+      fputs("}\n", out);
+    }
+    fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,288 @@
+// vim: ts=2 sw=2 et
+
+// host-side weigand edge simulator
+//
+// usage: sim_capture
+//
+// drives WiegandCapture with generated data line edges the way the firmware's
+// interrupts and event-driven loop do, including the interrupt latency of
+// waking from light sleep for the first edge after idle, then decodes the
+// frames. exits non-zero if any scenario expected to capture cleanly doesn't.
+
+#include "card_decoder.h"
+#include "wiegand_capture.h"
+
+#include <cstdio>
+#include <vector>
+
+struct Edge {
+  uint32_t time;
+  unsigned char line;
+  bool low;
+};
+
+// timing of a generated pulse train, in microseconds
+struct PulseTiming {
+  uint32_t width;
+  uint32_t interval;
+};
+
+static const PulseTiming kDefaultTiming = {50, 2000};
+
+// 26 bit hid frame with parity
+static std::vector<unsigned char> hid26(unsigned long facilityCode,
+                                        unsigned long cardNumber) {
+  std::vector<unsigned char> bits(26);
+  for (int i = 0; i < 8; i++) {
+    bits[1 + i] = (facilityCode >> (7 - i)) & 1;
+  }
+  for (int i = 0; i < 16; i++) {
+    bits[9 + i] = (cardNumber >> (15 - i)) & 1;
+  }
+  int even = 0;
+  int odd = 1;
+  for (int i = 1; i < 13; i++) {
+    even ^= bits[i];
+  }
+  for (int i = 13; i < 25; i++) {
+    odd ^= bits[i];
+  }
+  bits[0] = even;
+  bits[25] = odd;
+  return bits;
+}
+
+static void addFrame(std::vector<Edge> &edges, uint32_t start,
+                     const std::vector<unsigned char> &bits,
+                     PulseTiming timing = kDefaultTiming) {
+  for (size_t i = 0; i < bits.size(); i++) {
+    uint32_t t = start + i * timing.interval;
+    edges.push_back({t, bits[i], true});
+    edges.push_back({t + timing.width, bits[i], false});
+  }
+}
+
+static void addPulse(std::vector<Edge> &edges, uint32_t start,
+                     unsigned char line, uint32_t width) {
+  edges.push_back({start, line, true});
+  edges.push_back({start + width, line, false});
+}
+
+// esp-idf only enters light sleep when it expects to stay idle this long
+// (CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP, 3 ticks)
+static const uint32_t kIdleBeforeSleep = 3000;
+
+// replays edges against the capture code. once the cpu has been idle for
+// kIdleBeforeSleep it light sleeps, and the next edge only wakes it:
+// interrupts for lines whose level differs from what the capture code last
+// saw are delivered once wakeLatency has passed (the data line interrupts are
+// level triggered, so a pulse that is over by then is lost)
+class Simulator {
+public:
+  Simulator(bool lightSleep, uint32_t wakeLatency)
+      : lightSleep(lightSleep), wakeLatency(wakeLatency) {
+    capture.wakeCompensation = lightSleep;
+  }
+
+  void run(const std::vector<Edge> &edges) {
+    lastActivity = edges.front().time - kIdleBeforeSleep;
+    for (const Edge &edge : edges) {
+      finishWake(edge.time);
+      pollLoop(edge.time);
+
+      level[edge.line] = edge.low;
+      if (waking) {
+        // still waking up, the edge only changes the line level
+        continue;
+      }
+      if (lightSleep && edge.time - lastActivity >= kIdleBeforeSleep) {
+        if (wakeLatency > 0) {
+          waking = true;
+          wakeAt = edge.time + wakeLatency;
+          continue;
+        }
+      }
+      deliver(edge.line, edge.time);
+    }
+    uint32_t end = edges.back().time + 2 * FRAME_GAP;
+    finishWake(end);
+    pollLoop(end);
+  }
+
+  std::vector<CardData> cards;
+  WiegandCapture capture;
+
+private:
+  // the cpu is back up, deliver the interrupts still pending
+  void finishWake(uint32_t now) {
+    if (!waking || now - wakeAt >= 0x80000000u) {
+      return;
+    }
+    waking = false;
+    for (unsigned char line = 0; line < 2; line++) {
+      if (level[line] != seen[line]) {
+        deliver(line, wakeAt);
+      }
+    }
+    lastActivity = wakeAt;
+  }
+
+  // what loop() sees at time now
+  void pollLoop(uint32_t now) {
+    if (capture.frameComplete(now)) {
+      unsigned char bits[MAX_BITS];
+      unsigned int count = capture.takeFrame(bits);
+      if (count > 0) {
+        CardData card;
+        decodeCard(bits, count, card);
+        cards.push_back(card);
+      }
+    }
+  }
+
+  void deliver(unsigned char line, uint32_t now) {
+    seen[line] = level[line];
+    capture.onEdge(line, level[line], level[line ^ 1], now);
+    lastActivity = now;
+  }
+
+  bool lightSleep;
+  uint32_t wakeLatency;
+  bool waking = false;
+  uint32_t wakeAt = 0;
+  uint32_t lastActivity = 0;
+  bool level[2] = {false, false};
+  bool seen[2] = {false, false};
+};
+
+static int failures = 0;
+
+static void expect(const char *name, bool expected, bool ok) {
+  printf("[%s] %s%s\n", ok ? "+" : (expected ? "-" : "*"), name,
+         ok ? "" : (expected ? " FAILED" : " (expected loss)"));
+  if (expected && !ok) {
+    failures++;
+  }
+}
+
+static bool capturedCard(const Simulator &sim, unsigned long facilityCode,
+                         unsigned long cardNumber) {
+  return sim.cards.size() == 1 && sim.cards[0].status == DECODE_OK &&
+         sim.cards[0].facilityCode == facilityCode &&
+         sim.cards[0].cardNumber == cardNumber;
+}
+
+int main() {
+  const unsigned long fc = 123;
+  const unsigned long cn = 45678;
+  // ten minutes of idle before the card, close to the micros() wrap
+  const uint32_t idleStart = 0xFFFFFFFFu - 300000000u;
+  const uint32_t frameStart = idleStart + 600000000u;
+
+  {
+    Simulator sim(false, 0);
+    std::vector<Edge> edges;
+    addFrame(edges, frameStart, hid26(fc, cn));
+    sim.run(edges);
+    expect("first bit after idle, awake", true, capturedCard(sim, fc, cn));
+  }
+
+  // light sleep: the first falling edge is seen late, or not at all once the
+  // wake latency exceeds the pulse width
+  const uint32_t latencies[] = {0, 5, 20, 45, 49, 60, 250};
+  for (uint32_t latency : latencies) {
+    Simulator sim(true, latency);
+    std::vector<Edge> edges;
+    addFrame(edges, frameStart, hid26(fc, cn));
+    sim.run(edges);
+    char name[96];
+    snprintf(name, sizeof(name),
+             "first bit after idle, light sleep, %uus wake latency (%uus "
+             "pulse)",
+             latency, kDefaultTiming.width);
+    expect(name, latency < kDefaultTiming.width, capturedCard(sim, fc, cn));
+  }
+
+  {
+    Simulator sim(true, 20);
+    std::vector<Edge> edges;
+    addFrame(edges, frameStart, hid26(fc, cn));
+    addFrame(edges, frameStart + 5000000u, hid26(fc + 1, cn + 1));
+    sim.run(edges);
+    expect("back to back cards, light sleep",
+           true,
+           sim.cards.size() == 2 && sim.cards[1].facilityCode == fc + 1 &&
+               sim.cards[1].cardNumber == cn + 1);
+  }
+
+  {
+    // 3us spikes on both lines in between the real bits
+    Simulator sim(false, 0);
+    std::vector<Edge> edges;
+    std::vector<unsigned char> bits = hid26(fc, cn);
+    for (size_t i = 0; i < bits.size(); i++) {
+      uint32_t t = frameStart + i * 2000;
+      addPulse(edges, t, bits[i], 50);
+      addPulse(edges, t + 700, i & 1, 3);
+    }
+    sim.run(edges);
+    expect("glitches between bits", true,
+           capturedCard(sim, fc, cn) &&
+               sim.capture.stats.pulsesTooShort == bits.size());
+  }
+
+  {
+    // crosstalk: every bit also pulls the other line low
+    Simulator sim(false, 0);
+    std::vector<Edge> edges;
+    std::vector<unsigned char> bits = hid26(fc, cn);
+    addFrame(edges, frameStart, bits);
+    for (size_t i = 0; i < 4; i++) {
+      uint32_t t = frameStart + 60000 + i * 2000;
+      edges.push_back({t, 0, true});
+      edges.push_back({t + 5, 1, true});
+      edges.push_back({t + 50, 0, false});
+      edges.push_back({t + 55, 1, false});
+    }
+    sim.run(edges);
+    expect("both lines low", true,
+           capturedCard(sim, fc, cn) && sim.capture.stats.bothLinesLow == 4);
+  }
+
+  {
+    // reader power-up burst
+    Simulator sim(false, 0);
+    std::vector<Edge> edges;
+    addFrame(edges, frameStart, std::vector<unsigned char>(8, 1));
+    sim.run(edges);
+    expect("short burst dropped before decode", true,
+           sim.cards.empty() && sim.capture.stats.framesTooShort == 1);
+  }
+
+  {
+    // min_frame_bits is the shortest frame kept, 26 still takes hid 26
+    Simulator sim(false, 0);
+    sim.capture.minFrameBits = 26;
+    std::vector<Edge> edges;
+    addFrame(edges, frameStart, hid26(fc, cn));
+    std::vector<unsigned char> bits = hid26(fc, cn);
+    bits.pop_back();
+    addFrame(edges, frameStart + 100000, bits);
+    sim.run(edges);
+    expect("frames min_frame_bits long kept", true,
+           capturedCard(sim, fc, cn) &&
+               sim.capture.stats.framesTooShort == 1);
+  }
+
+  {
+    Simulator sim(false, 0);
+    std::vector<Edge> edges;
+    addFrame(edges, frameStart, hid26(fc, cn), {600, 2000});
+    sim.run(edges);
+    expect("over long pulses dropped", true,
+           sim.cards.empty() && sim.capture.stats.pulsesTooLong == 26);
+  }
+
+  printf("%s\n", failures ? "[-] failures" : "[+] all passed");
+  return failures ? 1 : 0;
+}
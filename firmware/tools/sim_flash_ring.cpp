@@ -0,0 +1,429 @@
+// vim: ts=2 sw=2 et
+
+// host-side flash ring simulator
+//
+// usage: sim_flash_ring [seed]
+//
+// runs FlashRing against simulated nor flash, where writes can only clear
+// bits, through overflow, migration, clearing and power cuts that stop a
+// write or erase part way, remounting after each cut the way a reboot does.
+// checks that every record that was stored is either migrated or still
+// pending, once, in order and intact, that the ring keeps the newest records
+// when it overflows, that sectors wear evenly and that record ids carry on
+// after those on a card mounted after boot. exits non-zero if any check
+// fails.
+
+#include "flash_ring.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// nor flash: erased bytes are 0xff and writes only clear bits. a power cut
+// can be scheduled after a number of bytes, the write or erase in progress
+// when it hits is left part done
+class SimFlash : public RingFlash {
+public:
+  explicit SimFlash(size_t size) : data(size, 0xff), cutAfter(-1), cut(false) {}
+
+  size_t size() const override { return data.size(); }
+
+  bool read(size_t offset, void *buffer, size_t length) override {
+    if (cut || offset + length > data.size()) {
+      return false;
+    }
+    memcpy(buffer, &data[offset], length);
+    return true;
+  }
+
+  bool write(size_t offset, const void *buffer, size_t length) override {
+    if (cut || offset + length > data.size()) {
+      return false;
+    }
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    for (size_t i = 0; i < length; i++) {
+      if (spend()) {
+        // the byte being programmed when the power went only got some bits
+        data[offset + i] &= bytes[i] | 0x0f;
+        return false;
+      }
+      data[offset + i] &= bytes[i];
+    }
+    bytesWritten += length;
+    return true;
+  }
+
+  bool erase(size_t offset) override {
+    if (cut || offset % FLASH_RING_SECTOR_SIZE != 0 ||
+        offset >= data.size()) {
+      return false;
+    }
+    erases++;
+    if (spend()) {
+      // half erased
+      memset(&data[offset], 0xff, FLASH_RING_SECTOR_SIZE / 2);
+      return false;
+    }
+    memset(&data[offset], 0xff, FLASH_RING_SECTOR_SIZE);
+    return true;
+  }
+
+  // cut the power after this many more bytes or erases, -1 for never
+  void cutPower(long after) {
+    cutAfter = after;
+    cut = false;
+  }
+  bool powerCut() const { return cut; }
+
+  std::vector<uint8_t> data;
+  unsigned long bytesWritten = 0;
+  unsigned long erases = 0;
+
+private:
+  bool spend() {
+    if (cutAfter < 0) {
+      return false;
+    }
+    if (cutAfter-- == 0) {
+      cut = true;
+    }
+    return cut;
+  }
+
+  long cutAfter;
+  bool cut;
+};
+
+static std::mt19937 rng;
+
+// a card record line of varying length for id
+static std::string recordLine(unsigned long id) {
+  std::mt19937 lineRng(id);
+  char line[RECORD_LINE_SIZE];
+  int n = snprintf(line, sizeof(line),
+                   "{\"id\":%lu,\"card_type\":\"hid\",\"bit_length\":26,"
+                   "\"facility_code\":%u,\"card_number\":%u,\"raw\":\"",
+                   id, (unsigned)(lineRng() % 256),
+                   (unsigned)(lineRng() % 65536));
+  int bits = 26 + lineRng() % 200;
+  for (int i = 0; i < bits; i++) {
+    line[n++] = '0' + (lineRng() & 1);
+  }
+  n += snprintf(line + n, sizeof(line) - n, "\",\"timestamp\":%lu}\n",
+                1760000000ul + id);
+  return std::string(line, n);
+}
+
+static unsigned long recordId(const char *line, size_t length) {
+  std::string text(line, length);
+  if (text.compare(0, 6, "{\"id\":") != 0) {
+    return 0;
+  }
+  return strtoul(text.c_str() + 6, nullptr, 10);
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *scenario, const char *what) {
+  if (!ok) {
+    // the first few are enough to go on
+    if (failures < 10) {
+      printf("  FAIL %s: %s\n", scenario, what);
+    }
+    failures++;
+  }
+}
+
+// the pending records in order, checking each is intact
+static std::vector<unsigned long> pendingIds(FlashRing &ring,
+                                             const char *scenario) {
+  std::vector<unsigned long> ids;
+  FlashRingReader reader(ring);
+  std::string text;
+  uint8_t buffer[700];
+  size_t n;
+  while ((n = reader.read(buffer, sizeof(buffer))) > 0) {
+    text.append((const char *)buffer, n);
+  }
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) {
+      check(false, scenario, "record without a newline");
+      break;
+    }
+    unsigned long id = recordId(text.data() + start, end + 1 - start);
+    check(text.compare(start, end + 1 - start, recordLine(id)) == 0,
+          scenario, "record doesn't match what was stored");
+    ids.push_back(id);
+    start = end + 1;
+  }
+  check(ids.size() == ring.pending(), scenario,
+        "reader and pending count disagree");
+  return ids;
+}
+
+// move up to count records out of the ring, the way the firmware does to
+// the sd card
+static void migrate(FlashRing &ring, std::vector<unsigned long> &sd,
+                    unsigned long count) {
+  char line[RECORD_LINE_SIZE];
+  for (unsigned long i = 0; i < count; i++) {
+    RingPosition position;
+    size_t n = ring.oldest(position, line, sizeof(line));
+    if (n == 0) {
+      break;
+    }
+    sd.push_back(recordId(line, n));
+    if (!ring.markMigrated(position)) {
+      break;
+    }
+  }
+}
+
+static void printWear(const FlashRing &ring, const SimFlash &flash,
+                      unsigned long records) {
+  printf("  %lu records, erase cycles %u..%u, %.1f flash bytes and %.3f "
+         "erases per record\n",
+         records, ring.minEraseCount(), ring.maxEraseCount(),
+         (double)flash.bytesWritten / records,
+         (double)flash.erases / records);
+}
+
+// no migration: the ring keeps the newest records and never erases while
+// appending when it is reserved between records
+static void overflow() {
+  const char *name = "overflow";
+  printf("%s\n", name);
+  SimFlash flash(64 * FLASH_RING_SECTOR_SIZE);
+  FlashRing ring;
+  check(ring.begin(flash), name, "begin");
+  unsigned long total = 20000;
+  for (unsigned long id = 1; id <= total; id++) {
+    std::string line = recordLine(id);
+    check(ring.append(line.data(), line.size()), name, "append");
+    ring.reserve();
+  }
+  std::vector<unsigned long> ids = pendingIds(ring, name);
+  bool suffix = !ids.empty() && ids.back() == total;
+  for (size_t i = 1; i < ids.size(); i++) {
+    suffix = suffix && ids[i] == ids[i - 1] + 1;
+  }
+  check(suffix, name, "pending records aren't the newest ones in order");
+  check(ring.stats().dropped + ids.size() == total, name,
+        "dropped and pending don't add up");
+  check(ring.pendingBytes() * 10 > ring.capacity() * 9, name,
+        "ring holds less than 90% of its capacity");
+  check(ring.stats().inlineErases == 0, name, "erased while appending");
+  check(ring.maxEraseCount() - ring.minEraseCount() <= 1, name,
+        "sectors wear unevenly");
+
+  FlashRing again;
+  check(again.begin(flash), name, "remount");
+  check(pendingIds(again, name) == ids, name, "remount lost records");
+  printf("  kept %zu of %lu, %lu bytes of %zu\n", ids.size(), total,
+         (unsigned long)ring.pendingBytes(), ring.capacity());
+  printWear(ring, flash, total);
+}
+
+// bursts of records while the sd card is away, then migration, with the
+// power cut at random points if cuts is set
+static void migration(bool cuts) {
+  const char *name = cuts ? "power cuts" : "migration";
+  printf("%s\n", name);
+  SimFlash flash(32 * FLASH_RING_SECTOR_SIZE);
+  FlashRing ring;
+  check(ring.begin(flash), name, "begin");
+
+  std::vector<unsigned long> stored;
+  std::vector<unsigned long> sd;
+  // records whose append was cut short may or may not have made it
+  std::vector<unsigned long> unsure;
+  unsigned long nextId = 1;
+  unsigned long reboots = 0;
+  for (int round = 0; round < 3000; round++) {
+    if (cuts) {
+      flash.cutPower(rng() % 100000);
+    }
+    // a burst small enough to fit, so nothing is dropped
+    unsigned long burst = rng() % 60;
+    for (unsigned long i = 0; i < burst && !flash.powerCut(); i++) {
+      std::string line = recordLine(nextId);
+      if (ring.append(line.data(), line.size())) {
+        stored.push_back(nextId);
+      } else if (flash.powerCut()) {
+        unsure.push_back(nextId);
+      }
+      nextId++;
+      if (rng() % 4 == 0) {
+        ring.reserve();
+      }
+    }
+    // migration keeps up, rounds cut short don't get to it
+    if (!flash.powerCut()) {
+      migrate(ring, sd, burst + rng() % 40);
+    }
+    check(ring.stats().dropped == 0, name, "ring overflowed");
+    if (!flash.powerCut()) {
+      ring.reserve();
+    }
+    if (flash.powerCut()) {
+      flash.cutPower(-1);
+      reboots++;
+      check(ring.begin(flash), name, "remount after a power cut");
+    }
+  }
+  flash.cutPower(-1);
+  check(ring.begin(flash), name, "remount");
+  std::vector<unsigned long> pending = pendingIds(ring, name);
+  migrate(ring, sd, ~0ul);
+  check(ring.pending() == 0, name, "records left after migrating them all");
+
+  // a cut between copying a record and marking it leaves it to be copied
+  // again, the copies are next to each other
+  std::vector<unsigned long> all;
+  unsigned long copies = 0;
+  for (unsigned long id : sd) {
+    if (!all.empty() && all.back() == id) {
+      copies++;
+    } else {
+      all.push_back(id);
+    }
+  }
+  bool ordered = true;
+  for (size_t i = 1; i < all.size(); i++) {
+    ordered = ordered && all[i] > all[i - 1];
+  }
+  check(ordered, name, "records migrated out of order");
+  size_t found = 0;
+  size_t extra = 0;
+  for (unsigned long id : all) {
+    if (found < stored.size() && stored[found] == id) {
+      found++;
+    } else {
+      bool maybe = false;
+      for (unsigned long u : unsure) {
+        maybe = maybe || u == id;
+      }
+      check(maybe, name, "migrated a record that was never stored");
+      extra++;
+    }
+  }
+  check(found == stored.size(), name, "stored records went missing");
+  check(cuts || copies == 0, name, "records migrated twice");
+  check(ring.maxEraseCount() - ring.minEraseCount() <= (cuts ? 2u : 1u), name,
+        "sectors wear unevenly");
+  printf("  %zu records stored, %zu migrated, %lu power cuts, %lu copied "
+         "twice, %zu cut short appends that made it\n",
+         stored.size(), all.size(), reboots, copies, extra);
+  printWear(ring, flash, nextId - 1);
+}
+
+// clearing throws everything away, before and after a remount
+static void clearing() {
+  const char *name = "clear";
+  printf("%s\n", name);
+  SimFlash flash(16 * FLASH_RING_SECTOR_SIZE);
+  FlashRing ring;
+  check(ring.begin(flash), name, "begin");
+  for (unsigned long id = 1; id <= 300; id++) {
+    std::string line = recordLine(id);
+    ring.append(line.data(), line.size());
+  }
+  check(ring.clear(), name, "clear");
+  check(ring.pending() == 0, name, "records left after clearing");
+  FlashRing again;
+  check(again.begin(flash), name, "remount");
+  check(again.pending() == 0, name, "cleared records came back");
+  for (unsigned long id = 301; id <= 310; id++) {
+    std::string line = recordLine(id);
+    again.append(line.data(), line.size());
+  }
+  std::vector<unsigned long> ids = pendingIds(again, name);
+  check(ids.size() == 10 && ids.front() == 301, name,
+        "records after clearing");
+  char line[RECORD_LINE_SIZE];
+  size_t n = again.newest(line, sizeof(line));
+  check(recordId(line, n) == 310, name, "newest record");
+  printf("  ok\n");
+}
+
+// the id after the newest record on the card and in the ring, or next if
+// that is higher, the way the firmware carries ids on at boot and when a
+// card is mounted later
+static unsigned long followingId(FlashRing &ring,
+                                 const std::vector<unsigned long> &sd,
+                                 unsigned long next) {
+  if (!sd.empty() && sd.back() + 1 > next) {
+    next = sd.back() + 1;
+  }
+  char line[RECORD_LINE_SIZE];
+  size_t n = ring.newest(line, sizeof(line));
+  if (n > 0 && recordId(line, n) + 1 > next) {
+    next = recordId(line, n) + 1;
+  }
+  return next;
+}
+
+// booting without the card and mounting one that already holds records:
+// ids taken after it is mounted carry on after the card's
+static void lateCard() {
+  const char *name = "late card";
+  printf("%s\n", name);
+  SimFlash flash(16 * FLASH_RING_SECTOR_SIZE);
+  FlashRing ring;
+  check(ring.begin(flash), name, "begin");
+  std::vector<unsigned long> sd;
+  unsigned long nextId = followingId(ring, sd, 0);
+  for (int i = 0; i < 40; i++) {
+    std::string line = recordLine(nextId++);
+    check(ring.append(line.data(), line.size()), name, "append");
+  }
+
+  std::vector<unsigned long> card;
+  for (unsigned long id = 0; id < 500; id++) {
+    card.push_back(id);
+  }
+  sd = card;
+  nextId = followingId(ring, sd, nextId);
+  check(nextId == 500, name, "ids don't carry on after the card's");
+  unsigned long firstAfter = nextId;
+  // records keep going to the ring while older ones wait to move
+  for (int i = 0; i < 20; i++) {
+    std::string line = recordLine(nextId++);
+    check(ring.append(line.data(), line.size()), name, "append");
+    migrate(ring, sd, 3);
+  }
+  migrate(ring, sd, ~0ul);
+  check(ring.pending() == 0, name, "records left after migrating them all");
+  check(sd.size() == card.size() + 60, name, "records went missing");
+  for (size_t i = card.size() + 40; i < sd.size(); i++) {
+    check(sd[i] >= firstAfter, name,
+          "record taken after mounting has an id the card already had");
+  }
+
+  // a reboot with the card in picks up from the newest record
+  FlashRing again;
+  check(again.begin(flash), name, "remount");
+  check(followingId(again, sd, 0) == nextId, name,
+        "ids after a reboot go back");
+  printf("  ok\n");
+}
+
+int main(int argc, char **argv) {
+  rng.seed(argc > 1 ? strtoul(argv[1], nullptr, 10) : 1);
+  overflow();
+  migration(false);
+  migration(true);
+  clearing();
+  lateCard();
+  if (failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}